@@ -4,18 +4,29 @@
 */
 #include <assert.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
 #include "vector.h"
 #include "matrix.h"
 #include "eigen.h"
 #include "linsolve.h"
+#include "util.h"
+#include "parallel.h"
 
 struct eigen* eigen_new() {
     struct eigen* e = malloc(sizeof(struct eigen));
+    e->eigenvalues_imag = NULL;
     return e;
 }
 
 void eigen_free(struct eigen* e) {
     vector_free(e->eigenvalues);
+    if(e->eigenvalues_imag != NULL) {
+        vector_free(e->eigenvalues_imag);
+    }
     matrix_free(e->eigenvectors);
     free(e);
 }
@@ -23,83 +34,468 @@ void eigen_free(struct eigen* e) {
 /* Compute the eigenvalues and eigenvectors of a matrix M.
 
   The eigenvalues are computed using the QR algorithm, then the eigenvectors
-  are computed by inverse iteration.
+  are computed by inverse iteration.  The imaginary parts of the eigenvalues
+  are kept in eigenvalues_imag, the eigenvectors are only meaningful for the
+  real eigenvalues.
 */
 struct eigen* eigen_solve(struct matrix* M, double tol, int max_iter) {
     assert(M->n_row == M->n_col);
 
-    struct vector* eigenvalues = eigen_solve_eigenvalues(M, tol, max_iter);
+    struct vector* eigenvalues = vector_new(M->n_row);
+    struct vector* eigenvalues_imag = vector_new(M->n_row);
+    eigen_solve_eigenvalues_into(eigenvalues, eigenvalues_imag, M, tol, max_iter);
     struct matrix* eigenvectors = eigen_solve_eigenvectors(
                                       M, eigenvalues, tol, max_iter);
 
     struct eigen* e = eigen_new();
     e->n = M->n_row;
     e->eigenvalues = eigenvalues;
+    e->eigenvalues_imag = eigenvalues_imag;
     e->eigenvectors = eigenvectors;
 
     return e;
 }
 
-/* Compute the eigenvalues of a matrix using the QR algorithm.
+/* Reduce a square matrix to upper Hessenberg form (zero below the first
+   subdiagonal) by a similarity transformation, H = P^t M P.
 
-  This is a renormalized version of power iteration that converges to a full
-  set of eigenvalues.  Starting with the matrix M = M0, we iterate:
+   Each step k chooses a Householder reflection I - beta v v^t that zeros
+   column k below the subdiagonal, and applies it on both sides.  The
+   eigenvalues of H are those of M, and each QR iteration on H only costs
+   O(n^2).
+*/
+struct matrix* matrix_hessenberg(struct matrix* M) {
+    assert(M->n_row == M->n_col);
+    int n = M->n_row;
+    struct matrix* H = matrix_copy(M);
+    double* v = malloc(sizeof(double) * n);
+    check_memory((void*) v);
+    double* w = malloc(sizeof(double) * n);
+    check_memory((void*) w);
 
-    M0 = Q0 R0, M1 = R0 Q0;
-    M1 = Q1 R1, M2 = R1 Q1;
-    M2 = Q2 R2, M3 = R2 Q2;
-    ...
+    for(int k = 0; k < n - 2; k++) {
+        // The column is scaled by its largest entry, so that squares of
+        // tiny entries do not underflow.
+        double scale = 0;
+        for(int i = k + 1; i < n; i++) {
+            scale = fmax(scale, fabs(MATRIX_IDX_INTO(H, i, k)));
+        }
+        if(scale == 0) {
+            continue;
+        }
+        double norm_sq = 0;
+        for(int i = k + 1; i < n; i++) {
+            v[i] = MATRIX_IDX_INTO(H, i, k) / scale;
+            norm_sq += v[i] * v[i];
+        }
+        double alpha = sqrt(norm_sq);
+        if(v[k + 1] > 0) {
+            alpha = -alpha;
+        }
+        double v0 = v[k + 1];
+        v[k + 1] -= alpha;
+        double beta = 2 / (norm_sq - 2 * alpha * v0 + alpha * alpha);
+        alpha *= scale;
+
+        // H <- (I - beta v v^t) H, rows k+1..n-1.  Row by row, as H is
+        // stored by rows: first w = beta v^t H, then H -= v w.
+        for(int j = k; j < n; j++) {
+            w[j] = 0;
+        }
+        for(int i = k + 1; i < n; i++) {
+            double* row = DATA(H) + i * n;
+            for(int j = k; j < n; j++) {
+                w[j] += v[i] * row[j];
+            }
+        }
+        for(int i = k + 1; i < n; i++) {
+            double* row = DATA(H) + i * n;
+            double bv = beta * v[i];
+            for(int j = k; j < n; j++) {
+                row[j] -= bv * w[j];
+            }
+        }
+        // H <- H (I - beta v v^t), columns k+1..n-1.
+        for(int i = 0; i < n; i++) {
+            double* row = DATA(H) + i * n;
+            double dp = 0;
+            for(int j = k + 1; j < n; j++) {
+                dp += row[j] * v[j];
+            }
+            dp *= beta;
+            for(int j = k + 1; j < n; j++) {
+                row[j] -= dp * v[j];
+            }
+        }
+        MATRIX_IDX_INTO(H, k + 1, k) = alpha;
+        for(int i = k + 2; i < n; i++) {
+            MATRIX_IDX_INTO(H, i, k) = 0;
+        }
+    }
+
+    free(v); free(w);
+    return H;
+}
+
+/* Apply the Householder reflection I - beta v v^t, acting on the n_v (2 or 3)
+   consecutive indices starting at k, on the left to rows of H (columns
+   col_lo..col_hi) and on the right to columns of H (rows row_lo..row_hi).
+   The right application is also accumulated into the columns of Z when it is
+   not NULL.
+
+   This is the inner loop of the QR algorithm, so the two cases are written
+   out with the reflection folded into three scalars.
+*/
+static void reflect_columns(struct matrix* A, int k, int n_v, double* v, double beta,
+                            int row_lo, int row_hi) {
+    int n = A->n_col;
+    double t0 = beta * v[0], t1 = beta * v[1], t2 = (n_v == 3) ? beta * v[2] : 0;
+    double* row = DATA(A) + row_lo * n + k;
+    if(n_v == 3) {
+        for(int i = row_lo; i <= row_hi; i++, row += n) {
+            double dp = row[0] * v[0] + row[1] * v[1] + row[2] * v[2];
+            row[0] -= dp * t0;
+            row[1] -= dp * t1;
+            row[2] -= dp * t2;
+        }
+    } else {
+        for(int i = row_lo; i <= row_hi; i++, row += n) {
+            double dp = row[0] * v[0] + row[1] * v[1];
+            row[0] -= dp * t0;
+            row[1] -= dp * t1;
+        }
+    }
+}
+
+static void reflect(struct matrix* H, struct matrix* Z, int k, int n_v,
+                    double* v, double beta,
+                    int col_lo, int col_hi, int row_lo, int row_hi) {
+    int n = H->n_col;
+    double t0 = beta * v[0], t1 = beta * v[1], t2 = (n_v == 3) ? beta * v[2] : 0;
+    double* r0 = DATA(H) + k * n;
+    double* r1 = r0 + n;
+    if(n_v == 3) {
+        double* r2 = r1 + n;
+        for(int j = col_lo; j <= col_hi; j++) {
+            double dp = r0[j] * v[0] + r1[j] * v[1] + r2[j] * v[2];
+            r0[j] -= dp * t0;
+            r1[j] -= dp * t1;
+            r2[j] -= dp * t2;
+        }
+    } else {
+        for(int j = col_lo; j <= col_hi; j++) {
+            double dp = r0[j] * v[0] + r1[j] * v[1];
+            r0[j] -= dp * t0;
+            r1[j] -= dp * t1;
+        }
+    }
+    reflect_columns(H, k, n_v, v, beta, row_lo, row_hi);
+    if(Z != NULL) {
+        reflect_columns(Z, k, n_v, v, beta, 0, Z->n_row - 1);
+    }
+}
+
+/* Householder vector for x (of length 2 or 3), so that
+   (I - beta v v^t) x is a multiple of the first unit vector.  x is scaled
+   by its largest entry first, as the bulge entries can get tiny enough for
+   their squares to underflow.  Returns false if x is zero.
+*/
+static bool householder(double* x, int n_x, double* v, double* beta) {
+    double scale = 0;
+    for(int l = 0; l < n_x; l++) {
+        scale = fmax(scale, fabs(x[l]));
+    }
+    if(scale == 0) {
+        return false;
+    }
+    double norm_sq = 0;
+    for(int l = 0; l < n_x; l++) {
+        v[l] = x[l] / scale;
+        norm_sq += v[l] * v[l];
+    }
+    double alpha = (v[0] > 0) ? -sqrt(norm_sq) : sqrt(norm_sq);
+    double v0 = v[0];
+    v[0] -= alpha;
+    *beta = 2 / (norm_sq - 2 * alpha * v0 + alpha * alpha);
+    return true;
+}
+
+/* One implicit double shift QR step (Francis step) on the diagonal block
+   lo..hi (at least 3 x 3) of an upper Hessenberg matrix H.
+
+   The two shifts are the roots of x^2 - s x + t.  Rather than forming
+   (H - mu_1 I)(H - mu_2 I) = QR, only its first column is computed, a
+   reflection mapping it to a multiple of the first unit vector is applied on
+   both sides of H, and the resulting bulge is chased down the subdiagonal
+   with further 3 x 3 reflections.  This costs O(n^2) and stays in real
+   arithmetic even when the shifts are complex conjugates.
+
+   Only the block is updated when Z is NULL (this is enough for eigenvalues),
+   otherwise the whole of H is transformed and the reflections accumulated
+   into Z.
+*/
+void eigen_francis_step(struct matrix* H, int lo, int hi, double s, double t,
+                        struct matrix* Z) {
+    assert(hi - lo >= 2);
+    int n = H->n_row;
+    int col_hi = (Z == NULL) ? hi : n - 1;
+    int row_lo = (Z == NULL) ? lo : 0;
+    double x[3], v[3], beta;
+
+    double h00 = MATRIX_IDX_INTO(H, lo, lo), h01 = MATRIX_IDX_INTO(H, lo, lo + 1);
+    double h10 = MATRIX_IDX_INTO(H, lo + 1, lo), h11 = MATRIX_IDX_INTO(H, lo + 1, lo + 1);
+    x[0] = h00 * h00 + h01 * h10 - s * h00 + t;
+    x[1] = h10 * (h00 + h11 - s);
+    x[2] = h10 * MATRIX_IDX_INTO(H, lo + 2, lo + 1);
+
+    for(int k = lo; k <= hi - 2; k++) {
+        if(householder(x, 3, v, &beta)) {
+            int col_lo = (k > lo) ? k - 1 : lo;
+            int row_hi = (k + 3 < hi) ? k + 3 : hi;
+            reflect(H, Z, k, 3, v, beta, col_lo, col_hi, row_lo, row_hi);
+            if(k > lo) {
+                // The reflection zeroed the bulge below the subdiagonal.
+                MATRIX_IDX_INTO(H, k + 1, k - 1) = 0;
+                MATRIX_IDX_INTO(H, k + 2, k - 1) = 0;
+            }
+        }
+        x[0] = MATRIX_IDX_INTO(H, k + 1, k);
+        x[1] = MATRIX_IDX_INTO(H, k + 2, k);
+        x[2] = (k + 3 <= hi) ? MATRIX_IDX_INTO(H, k + 3, k) : 0;
+    }
+    if(householder(x, 2, v, &beta)) {
+        reflect(H, Z, hi - 1, 2, v, beta, hi - 2, col_hi, row_lo, hi);
+        MATRIX_IDX_INTO(H, hi, hi - 2) = 0;
+    }
+}
+
+/* Eigenvalues of the 2 x 2 block [a b; c d].  Real eigenvalues are ordered
+   by decreasing absolute value, complex ones have positive imaginary part
+   first.
+*/
+static void eigenvalues_2x2(double a, double b, double c, double d,
+                            double* re, double* im) {
+    double p = 0.5 * (a - d);
+    double q = p * p + b * c;
+    if(q >= 0) {
+        double z = p + ((p >= 0) ? sqrt(q) : -sqrt(q));
+        double l0 = d + z;
+        double l1 = (z != 0) ? d - (b * c) / z : d + z;
+        if(fabs(l1) > fabs(l0)) {
+            double tmp = l0; l0 = l1; l1 = tmp;
+        }
+        re[0] = l0; re[1] = l1;
+        im[0] = 0;  im[1] = 0;
+    } else {
+        re[0] = re[1] = d + p;
+        im[0] = sqrt(-q);
+        im[1] = -im[0];
+    }
+}
+
+/* Compute the (possibly complex) eigenvalues of a matrix, storing their real
+   and imaginary parts in the reciever vectors.
+
+   M is reduced to Hessenberg form, then Francis double shift QR steps are
+   applied to the trailing unreduced block.  The shifts are the eigenvalues
+   of the trailing 2 x 2 block, which makes the last (or second to last)
+   subdiagonal entry converge quadratically to zero.  Whenever a subdiagonal
+   entry is smaller than tol relative to its diagonal neighbours it is set
+   to zero, and the problem splits (deflates) into smaller ones.  Each 1 x 1
+   or 2 x 2 block split off the bottom gives one or two eigenvalues.
+
+   The eigenvalues come out in the order of the diagonal of the final
+   (quasi) triangular matrix.  max_iter bounds the number of steps spent on
+   each eigenvalue.
+*/
+void eigen_solve_eigenvalues_into(struct vector* real, struct vector* imag,
+                                  struct matrix* M, double tol, int max_iter) {
+    assert(M->n_row == M->n_col);
+    assert(real->length == M->n_row);
+    assert(imag->length == M->n_row);
+    int n = M->n_row;
+    struct matrix* H = matrix_hessenberg(M);
+    double eps = (tol > DBL_EPSILON) ? tol : DBL_EPSILON;
+
+    double norm = 0;
+    for(int i = 0; i < n; i++) {
+        for(int j = (i > 0) ? i - 1 : 0; j < n; j++) {
+            norm += fabs(MATRIX_IDX_INTO(H, i, j));
+        }
+    }
+
+    int hi = n - 1;
+    int its = 0;
+    while(hi >= 0) {
+        // Look for a negligible subdiagonal entry, splitting off H[lo..hi].
+        int lo;
+        for(lo = hi; lo > 0; lo--) {
+            double s = fabs(MATRIX_IDX_INTO(H, lo - 1, lo - 1)) + fabs(MATRIX_IDX_INTO(H, lo, lo));
+            if(s == 0) {
+                s = norm;
+            }
+            if(fabs(MATRIX_IDX_INTO(H, lo, lo - 1)) <= eps * s) {
+                MATRIX_IDX_INTO(H, lo, lo - 1) = 0;
+                break;
+            }
+        }
+
+        if(lo == hi) {
+            VECTOR_IDX_INTO(real, hi) = MATRIX_IDX_INTO(H, hi, hi);
+            VECTOR_IDX_INTO(imag, hi) = 0;
+            hi -= 1;
+            its = 0;
+        } else if(lo == hi - 1) {
+            eigenvalues_2x2(MATRIX_IDX_INTO(H, hi - 1, hi - 1), MATRIX_IDX_INTO(H, hi - 1, hi),
+                            MATRIX_IDX_INTO(H, hi, hi - 1), MATRIX_IDX_INTO(H, hi, hi),
+                            DATA(real) + hi - 1, DATA(imag) + hi - 1);
+            hi -= 2;
+            its = 0;
+        } else if(its >= max_iter) {
+            // Out of iterations, report the diagonal of the unreduced block.
+            for(int i = lo; i <= hi; i++) {
+                VECTOR_IDX_INTO(real, i) = MATRIX_IDX_INTO(H, i, i);
+                VECTOR_IDX_INTO(imag, i) = 0;
+            }
+            hi = lo - 1;
+            its = 0;
+        } else {
+            double a = MATRIX_IDX_INTO(H, hi - 1, hi - 1), b = MATRIX_IDX_INTO(H, hi - 1, hi);
+            double c = MATRIX_IDX_INTO(H, hi, hi - 1), d = MATRIX_IDX_INTO(H, hi, hi);
+            double s = a + d;
+            double t = a * d - b * c;
+            if(its == 10 || its == 20) {
+                // Exceptional shifts, to break out of rare cycles.
+                double e = fabs(c) + fabs(MATRIX_IDX_INTO(H, hi - 1, hi - 2));
+                s = 2 * (d + 0.75 * e);
+                t = (d + 0.75 * e) * (d + 0.75 * e) + 0.4375 * e * e;
+            }
+            eigen_francis_step(H, lo, hi, s, t, NULL);
+            its++;
+        }
+    }
 
-  For a general matrix with a full set of eigenvalues, this sequence will
-  converge to an upper diagonal matrix:
+    matrix_free(H);
+}
 
-    Mi -> upper diagonal matrix
+/* Compute the eigenvalues of a matrix, see eigen_solve_eigenvalues_into.
 
-  The diagonal entries of this matrix are the eigenvalues of M.
+   Only the real parts of the eigenvalues are returned, which are the
+   eigenvalues themselves when they are all real (for example when M is
+   symmetric).
 */
 struct vector* eigen_solve_eigenvalues(struct matrix* M,
                                        double tol,
                                        int max_iter) {
 
     assert(M->n_row == M->n_col);
+    struct vector* real = vector_new(M->n_row);
+    struct vector* imag = vector_new(M->n_row);
+    eigen_solve_eigenvalues_into(real, imag, M, tol, max_iter);
+    vector_free(imag);
+    return real;
+}
+
+/* The shift of eigenvalue i is perturbed a little, to prevent M - lambda I
+   from being singular.  The perturbation is a hash of i rather than a call
+   to rand(), so that it does not depend on which thread gets to it first.
+*/
+static double eigenvalue_perturbation(int i) {
+    uint64_t z = 0x9e3779b97f4a7c15ULL * (uint64_t) (i + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z = z ^ (z >> 31);
+    return ((z >> 11) * (1.0 / 9007199254740992.0)) * 0.000001;
+}
+
+/* Inverse iteration with the shifted matrix M - lambda I, which is factored
+   once.  See eigen_backsolve.
+*/
+static struct vector* inverse_iteration(struct matrix* M_minus_lambda_I,
+                                        double tol, int max_iter) {
+    struct qr_decomp* qr = matrix_qr_decomposition(M_minus_lambda_I);
+    struct vector* current = vector_constant(M_minus_lambda_I->n_row, 1);
+    struct vector* previous;
 
-    struct matrix* X = matrix_copy(M);
     int i = 0;
-    // QR algorithm iterations.
     do {
-        struct qr_decomp* qr = matrix_qr_decomposition(X);
-        matrix_multiply_into(X, qr->r, qr->q);
-        qr_decomp_free(qr);
+        if(i > 0) {
+            vector_free(previous);
+        }
+        previous = current;
+        current = linsolve_from_qr(qr, previous);
+        // We reverse the sign of the vector if the first entry is not positive.
+        // Often the algorithm will oscilate between a vector and its negative
+        // after convergence.
+        if(VECTOR_IDX_INTO(current, 0) < 0) {
+            for(int j = 0; j < current->length; j++) {
+                VECTOR_IDX_INTO(current, j) = -VECTOR_IDX_INTO(current, j);
+            }
+        }
+        vector_normalize_into(current, current);
         i++;
-    } while(!matrix_is_upper_triangular(X, tol) && (i < max_iter));
+    } while(!vector_equal(current, previous, tol) && (i < max_iter));
 
-    struct vector* diagonal = matrix_diagonal(X);
-    matrix_free(X);
-    return diagonal;
+    vector_free(previous);
+    qr_decomp_free(qr);
+    return current;
+}
+
+struct eigenvector_batch {
+    struct matrix* M;
+    struct vector* eigenvalues;
+    struct matrix* eigenvectors;
+    // One M - lambda I per thread.
+    struct matrix** shifted;
+    double tol;
+    int max_iter;
+};
+
+static void eigenvector_task(void* arg, int i, int thread_idx) {
+    struct eigenvector_batch* batch = arg;
+    struct matrix* shifted = batch->shifted[thread_idx];
+    double lambda = VECTOR_IDX_INTO(batch->eigenvalues, i) + eigenvalue_perturbation(i);
+    memcpy(DATA(shifted), DATA(batch->M), sizeof(double) * shifted->n_row * shifted->n_col);
+    for(int j = 0; j < shifted->n_row; j++) {
+        MATRIX_IDX_INTO(shifted, j, j) -= lambda;
+    }
+    struct vector* eigenvector = inverse_iteration(shifted, batch->tol, batch->max_iter);
+    matrix_copy_vector_into_column(batch->eigenvectors, eigenvector, i);
+    vector_free(eigenvector);
 }
 
 /* Solve for the eigenvectors of a matrix M once the eigenvalues are known
    using inverse iteration.
+
+   The inverse iterations for the different eigenvalues are independent, and
+   run concurrently on the thread pool, each thread with its own shifted
+   matrix.  The result does not depend on the number of threads.
 */
 struct matrix* eigen_solve_eigenvectors(struct matrix* M,
                                         struct vector* eigenvalues,
                                         double tol,
                                         int max_iter) {
 
-    assert(eigenvalues->length = M->n_row);
-    assert(eigenvalues->length = M->n_col);
+    assert(eigenvalues->length == M->n_row);
+    assert(eigenvalues->length == M->n_col);
 
-    double eigenvalue;
     int n_eigenvalues = M->n_col;
     struct matrix* eigenvectors = matrix_new(n_eigenvalues, n_eigenvalues);
 
-    for(int i = 0; i < n_eigenvalues; i++) {
-        eigenvalue = VECTOR_IDX_INTO(eigenvalues, i);
-        struct vector* eigenvector = eigen_backsolve(M, eigenvalue, tol, max_iter);
-        matrix_copy_vector_into_column(eigenvectors, eigenvector, i);
-        vector_free(eigenvector);
+    int n_threads = parallel_num_threads();
+    struct matrix** shifted = malloc(sizeof(struct matrix*) * n_threads);
+    check_memory((void*) shifted);
+    for(int t = 0; t < n_threads; t++) {
+        // Threads beyond the number of eigenvalues are never used.
+        shifted[t] = (t < n_eigenvalues) ? matrix_new(M->n_row, M->n_col) : NULL;
     }
+    struct eigenvector_batch batch = {M, eigenvalues, eigenvectors, shifted, tol, max_iter};
+    parallel_for(n_eigenvalues, 1, eigenvector_task, &batch);
 
+    for(int t = 0; t < n_threads && t < n_eigenvalues; t++) {
+        matrix_free(shifted[t]);
+    }
+    free(shifted);
     return eigenvectors;
 }
 
@@ -119,40 +515,17 @@ struct matrix* eigen_solve_eigenvectors(struct matrix* M,
     ...
 
   This algorithm will converge to the eigenvector associated with the eigenvalue
-  closest to lambda.
+  closest to lambda.  M' is factored once, and the factors reused for every
+  solve.
 */
 struct vector* eigen_backsolve(
                    struct matrix* M, double eigenvalue, double tol, int max_iter) {
 
-    struct vector* current = vector_constant(M->n_row, 1);
-    struct vector* previous;
     // Preturb the eigenvalue a litle to prevent our right hand side matrix
     // from becoming singular.
-    double lambda = eigenvalue + ((double) rand() / (double) RAND_MAX) * 0.000001;
-
+    double lambda = eigenvalue + eigenvalue_perturbation(0);
     struct matrix* M_minus_lambda_I = matrix_M_minus_lambda_I(M, lambda);
-
-    int i = 0;
-    do {
-        if(i > 0) {
-            vector_free(previous);
-        }
-        previous = current;
-        current = linsolve_qr(M_minus_lambda_I, previous);
-        // We reverse the sign of the vector if the first entry is not positive.
-        // Often the algorithm will oscilate between a vector and its negative
-        // after convergence.
-        if(VECTOR_IDX_INTO(current, 0) < 0) {
-            for(int j = 0; j < current->length; j++) {
-                VECTOR_IDX_INTO(current, j) = -VECTOR_IDX_INTO(current, j);
-            }
-        }
-        vector_normalize_into(current, current);
-        // vector_print(current);
-        i++;
-    } while(!vector_equal(current, previous, tol) && (i < max_iter));
-
-    vector_free(previous);
+    struct vector* eigenvector = inverse_iteration(M_minus_lambda_I, tol, max_iter);
     matrix_free(M_minus_lambda_I);
-    return current;
+    return eigenvector;
 }
@@ -8,6 +8,7 @@
 struct eigen {
     int n;
     struct vector* eigenvalues;
+    struct vector* eigenvalues_imag;
     struct matrix* eigenvectors;
 };
 
@@ -16,7 +17,13 @@ void eigen_free(struct eigen* e);
 
 struct eigen* eigen_solve(struct matrix* M, double tol, int max_iter);
 struct vector* eigen_solve_eigenvalues(struct matrix* M, double tol, int max_iter);
+void eigen_solve_eigenvalues_into(struct vector* real, struct vector* imag,
+                                  struct matrix* M, double tol, int max_iter);
 struct matrix* eigen_solve_eigenvectors(
     struct matrix* M, struct vector* eigenvectors, double tol, int max_iter);
 struct vector* eigen_backsolve(
     struct matrix* M, double eigenvalue, double tol, int max_iter);
+
+struct matrix* matrix_hessenberg(struct matrix* M);
+void eigen_francis_step(struct matrix* H, int lo, int hi, double s, double t,
+                        struct matrix* Z);
@@ -0,0 +1,631 @@
+/* eigen_krylov.c
+  (c) Alexis Rigaud, 2024
+
+  Thick restart Lanczos and implicitly restarted Arnoldi, for a few
+  eigenpairs of a large matrix.
+*/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <complex.h>
+#include <assert.h>
+#include "vector.h"
+#include "matrix.h"
+#include "util.h"
+#include "parallel.h"
+#include "eigen.h"
+#include "eigen_symmetric.h"
+#include "linop.h"
+#include "eigen_krylov.h"
+
+// Columns of w updated together by a thread when orthogonalizing.
+#define BASIS_BLOCK 1024
+
+
+/************************************
+ * Krylov basis.
+ ************************************/
+
+/* The basis vectors are the rows of v (m x n), so every product with the
+   basis runs over contiguous memory.
+*/
+struct basis {
+    int n;
+    int n_vectors;
+    const double* v;
+    const double* w;
+    double* h;
+};
+
+static void basis_project_one(void* arg, int i, int thread_idx) {
+    (void) thread_idx;
+    struct basis* b = arg;
+    const double* vi = b->v + (size_t) i * b->n;
+    double s = 0;
+    for(int r = 0; r < b->n; r++) {
+        s += vi[r] * b->w[r];
+    }
+    b->h[i] = s;
+}
+
+static void basis_subtract_block(void* arg, int block, int thread_idx) {
+    (void) thread_idx;
+    struct basis* b = arg;
+    int r0 = block * BASIS_BLOCK;
+    int r1 = (r0 + BASIS_BLOCK < b->n) ? r0 + BASIS_BLOCK : b->n;
+    double* w = (double*) b->w;
+    for(int i = 0; i < b->n_vectors; i++) {
+        const double* vi = b->v + (size_t) i * b->n;
+        double hi = b->h[i];
+        for(int r = r0; r < r1; r++) {
+            w[r] -= hi * vi[r];
+        }
+    }
+}
+
+/* Orthogonalize w against the first n_vectors rows of v, by classical
+   Gram-Schmidt done twice (which is as good as modified Gram-Schmidt, and
+   made of two matrix vector products).  The coefficients are stored in h,
+   and the norm of what is left of w is returned.
+*/
+static double orthogonalize(const double* v, int n, int n_vectors, double* w,
+                            double* h, double* h_pass) {
+    struct basis b = {n, n_vectors, v, w, h_pass};
+    for(int i = 0; i < n_vectors; i++) {
+        h[i] = 0;
+    }
+    for(int pass = 0; pass < 2; pass++) {
+        parallel_for(n_vectors, 1 + 16384 / n, basis_project_one, &b);
+        parallel_for((n + BASIS_BLOCK - 1) / BASIS_BLOCK, 1, basis_subtract_block, &b);
+        for(int i = 0; i < n_vectors; i++) {
+            h[i] += h_pass[i];
+        }
+    }
+    double norm_sq = 0;
+    for(int r = 0; r < n; r++) {
+        norm_sq += w[r] * w[r];
+    }
+    return sqrt(norm_sq);
+}
+
+/* A reproducible pseudo random vector, so that runs do not depend on the
+   state of rand().
+*/
+static void random_vector(double* x, int n, uint64_t seed) {
+    for(int r = 0; r < n; r++) {
+        uint64_t z = seed + 0x9e3779b97f4a7c15ULL * (uint64_t) (r + 1);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z = z ^ (z >> 31);
+        x[r] = 2 * ((z >> 11) * (1.0 / 9007199254740992.0)) - 1;
+    }
+}
+
+/* Make row j of v a unit vector orthogonal to the rows before it: w
+   normalized if it has norm beta, else (when the Krylov space became
+   invariant) a fresh random direction.  Returns the coupling coefficient,
+   zero in the second case.
+*/
+static double next_basis_vector(double* v, int n, int j, double* w, double beta,
+                                double scale, double* h, double* h_pass) {
+    double* vj = v + (size_t) j * n;
+    if(beta > n * DBL_EPSILON * scale) {
+        for(int r = 0; r < n; r++) {
+            vj[r] = w[r] / beta;
+        }
+        return beta;
+    }
+    for(uint64_t seed = j + 1; ; seed += 7919) {
+        random_vector(vj, n, seed);
+        double norm = orthogonalize(v, n, j, vj, h, h_pass);
+        if(norm > 0.5) {
+            for(int r = 0; r < n; r++) {
+                vj[r] /= norm;
+            }
+            return 0;
+        }
+    }
+}
+
+// Basis size for k wanted eigenpairs.
+static int krylov_dimension(int n, int k) {
+    int m = (2 * k + 1 > k + 20) ? 2 * k + 1 : k + 20;
+    return (m < n) ? m : n;
+}
+
+/* Leading rows of the basis V <- the combinations c^t V (c is m x k_new),
+   through a k_new x n temporary.
+*/
+static void combine_basis(struct matrix* V, struct matrix* c) {
+    struct matrix* combined = matrix_multiply_MtN(c, V);
+    memcpy(DATA(V), DATA(combined), sizeof(double) * (size_t) c->n_col * V->n_col);
+    matrix_free(combined);
+}
+
+struct ritz_item {
+    double re;
+    double im;
+    double key;
+    int index;
+};
+
+static int compare_ritz(const void* x, const void* y) {
+    const struct ritz_item* a = x;
+    const struct ritz_item* b = y;
+    if(a->key != b->key) {
+        return (a->key < b->key) - (a->key > b->key);
+    }
+    // Conjugate pairs stay together, positive imaginary part first.
+    if(a->re != b->re) {
+        return (a->re < b->re) - (a->re > b->re);
+    }
+    return (a->im < b->im) - (a->im > b->im);
+}
+
+// Most wanted first.
+static void sort_ritz(struct ritz_item* items, int m, enum eigen_which which) {
+    for(int i = 0; i < m; i++) {
+        switch(which) {
+        case EIGEN_LARGEST_MAGNITUDE:
+            items[i].key = hypot(items[i].re, items[i].im);
+            break;
+        case EIGEN_LARGEST:
+            items[i].key = items[i].re;
+            break;
+        case EIGEN_SMALLEST:
+            items[i].key = -items[i].re;
+            break;
+        }
+    }
+    qsort(items, m, sizeof(struct ritz_item), compare_ritz);
+}
+
+
+/************************************
+ * Lanczos.
+ ************************************/
+
+/* Thick restart Lanczos (Wu and Simon), equivalent to implicitly restarted
+   Lanczos with exact shifts.
+
+   The basis is extended by Lanczos steps (with full reorthogonalization)
+   up to m vectors, and the projected matrix T = V^t A V is diagonalized.
+   If the wanted Ritz pairs have not converged, the basis restarts from the
+   best k + (m - k) / 2 Ritz vectors plus the residual direction, T
+   becoming diagonal with an arrow of couplings to the residual, and the
+   Lanczos steps continue from there.
+*/
+struct eigen* eigen_solve_lanczos(struct linop* A, int k, enum eigen_which which,
+                                  double tol, int max_restarts) {
+    assert(A->n_row == A->n_col);
+    int n = A->n_row;
+    assert(k >= 1 && k <= n);
+    int m = krylov_dimension(n, k);
+
+    struct matrix* V = matrix_new(m, n);
+    double* v = DATA(V);
+    double* w = malloc(sizeof(double) * n);
+    check_memory((void*) w);
+    double* h = malloc(sizeof(double) * 2 * m);
+    check_memory((void*) h);
+    struct matrix* T = matrix_zeros(m, m);
+    struct ritz_item* items = malloc(sizeof(struct ritz_item) * m);
+    check_memory((void*) items);
+
+    random_vector(v, n, 0);
+    double norm = orthogonalize(v, n, 0, v, h, h + m);
+    for(int r = 0; r < n; r++) {
+        v[r] /= norm;
+    }
+
+    int j0 = 0;
+    double scale = 0;
+    struct eigen* te = NULL;
+    for(int restart = 0; ; restart++) {
+        double beta = 0;
+        for(int j = j0; j < m; j++) {
+            A->apply(A->ctx, v + (size_t) j * n, w);
+            beta = orthogonalize(v, n, j + 1, w, h, h + m);
+            for(int i = 0; i <= j; i++) {
+                MATRIX_IDX_INTO(T, i, j) = h[i];
+                MATRIX_IDX_INTO(T, j, i) = h[i];
+            }
+            scale = fmax(scale, fabs(h[j]) + beta);
+            if(j < m - 1) {
+                next_basis_vector(v, n, j + 1, w, beta, scale, h, h + m);
+            }
+        }
+
+        if(te != NULL) {
+            eigen_free(te);
+        }
+        te = eigen_solve_symmetric(T);
+        for(int i = 0; i < m; i++) {
+            items[i].re = VECTOR_IDX_INTO(te->eigenvalues, i);
+            items[i].im = 0;
+            items[i].index = i;
+        }
+        sort_ritz(items, m, which);
+
+        // The residual of Ritz pair i is beta |e_m^t y_i|.
+        bool converged = (m == n);
+        if(!converged) {
+            converged = true;
+            for(int i = 0; i < k; i++) {
+                double y_last = MATRIX_IDX_INTO(te->eigenvectors, m - 1, items[i].index);
+                double bound = tol * fmax(fabs(items[i].re), DBL_EPSILON * scale);
+                converged = converged && beta * fabs(y_last) <= bound;
+            }
+        }
+        if(converged || restart >= max_restarts) {
+            break;
+        }
+
+        // Thick restart.
+        int n_keep = k + (m - k) / 2;
+        if(n_keep > m - 1) {
+            n_keep = m - 1;
+        }
+        struct matrix* c = matrix_new(m, n_keep);
+        for(int i = 0; i < m; i++) {
+            for(int l = 0; l < n_keep; l++) {
+                MATRIX_IDX_INTO(c, i, l) = MATRIX_IDX_INTO(te->eigenvectors, i, items[l].index);
+            }
+        }
+        combine_basis(V, c);
+        matrix_free(c);
+        double* v_keep = v + (size_t) n_keep * n;
+        for(int r = 0; r < n; r++) {
+            v_keep[r] = w[r] / beta;
+        }
+        for(int i = 0; i < m * m; i++) {
+            DATA(T)[i] = 0;
+        }
+        for(int l = 0; l < n_keep; l++) {
+            MATRIX_IDX_INTO(T, l, l) = items[l].re;
+            double coupling = beta * MATRIX_IDX_INTO(te->eigenvectors, m - 1, items[l].index);
+            MATRIX_IDX_INTO(T, l, n_keep) = coupling;
+            MATRIX_IDX_INTO(T, n_keep, l) = coupling;
+        }
+        j0 = n_keep;
+    }
+
+    // Ritz vectors V^t y for the k wanted pairs.
+    struct eigen* e = eigen_new();
+    e->n = k;
+    e->eigenvalues = vector_new(k);
+    struct matrix* y = matrix_new(m, k);
+    for(int l = 0; l < k; l++) {
+        VECTOR_IDX_INTO(e->eigenvalues, l) = items[l].re;
+        for(int i = 0; i < m; i++) {
+            MATRIX_IDX_INTO(y, i, l) = MATRIX_IDX_INTO(te->eigenvectors, i, items[l].index);
+        }
+    }
+    e->eigenvectors = matrix_multiply_MtN(V, y);
+
+    matrix_free_many(3, T, y, V); eigen_free(te);
+    free(w); free(h); free(items);
+    return e;
+}
+
+
+/************************************
+ * Arnoldi.
+ ************************************/
+
+/* An eigenvector of the upper Hessenberg matrix h (m x m) for its (complex)
+   eigenvalue theta, by inverse iteration: Gaussian elimination with partial
+   pivoting of h - theta I only works on neighbouring rows, a tiny pivot
+   standing in for the exact singularity.  b is m x m complex workspace.
+*/
+static void hessenberg_eigenvector(struct matrix* h, double complex theta,
+                                   double complex* y, double complex* b,
+                                   bool* swapped) {
+    int m = h->n_row;
+    double norm = 0;
+    for(int i = 0; i < m; i++) {
+        for(int j = 0; j < m; j++) {
+            b[i * m + j] = MATRIX_IDX_INTO(h, i, j) - ((i == j) ? theta : 0);
+            norm = fmax(norm, cabs(b[i * m + j]));
+        }
+    }
+    double tiny = DBL_EPSILON * fmax(norm, DBL_MIN);
+
+    // LU, the multipliers go in the subdiagonal.
+    for(int i = 0; i < m - 1; i++) {
+        swapped[i] = cabs(b[(i + 1) * m + i]) > cabs(b[i * m + i]);
+        if(swapped[i]) {
+            for(int j = i; j < m; j++) {
+                double complex tmp = b[i * m + j];
+                b[i * m + j] = b[(i + 1) * m + j];
+                b[(i + 1) * m + j] = tmp;
+            }
+        }
+        if(cabs(b[i * m + i]) < tiny) {
+            b[i * m + i] = tiny;
+        }
+        double complex l = b[(i + 1) * m + i] / b[i * m + i];
+        for(int j = i + 1; j < m; j++) {
+            b[(i + 1) * m + j] -= l * b[i * m + j];
+        }
+        b[(i + 1) * m + i] = l;
+    }
+    if(cabs(b[(m - 1) * m + m - 1]) < tiny) {
+        b[(m - 1) * m + m - 1] = tiny;
+    }
+
+    for(int i = 0; i < m; i++) {
+        y[i] = 1;
+    }
+    for(int iter = 0; iter < 3; iter++) {
+        for(int i = 0; i < m - 1; i++) {
+            if(swapped[i]) {
+                double complex tmp = y[i]; y[i] = y[i + 1]; y[i + 1] = tmp;
+            }
+            y[i + 1] -= b[(i + 1) * m + i] * y[i];
+        }
+        for(int i = m - 1; i >= 0; i--) {
+            double complex s = y[i];
+            for(int j = i + 1; j < m; j++) {
+                s -= b[i * m + j] * y[j];
+            }
+            y[i] = s / b[i * m + i];
+        }
+        double y_norm = 0;
+        for(int i = 0; i < m; i++) {
+            y_norm += creal(y[i] * conj(y[i]));
+        }
+        y_norm = sqrt(y_norm);
+        for(int i = 0; i < m; i++) {
+            y[i] /= y_norm;
+        }
+    }
+}
+
+/* One explicitly shifted QR step on the diagonal block lo..hi of H,
+   H - mu I = QR, H <- RQ + mu I, by plane rotations applied to all of H and
+   accumulated into the columns of Z.  Used for a real shift left without a
+   partner for a double step, and on 2 x 2 blocks.
+*/
+static void single_shift_step(struct matrix* H, int lo, int hi, double mu,
+                              struct matrix* Z) {
+    int m = H->n_row;
+    double* c = malloc(sizeof(double) * 2 * m);
+    check_memory((void*) c);
+    double* s = c + m;
+    for(int i = lo; i <= hi; i++) {
+        MATRIX_IDX_INTO(H, i, i) -= mu;
+    }
+    for(int i = lo; i < hi; i++) {
+        double a = MATRIX_IDX_INTO(H, i, i), b = MATRIX_IDX_INTO(H, i + 1, i);
+        double r = hypot(a, b);
+        c[i] = (r == 0) ? 1 : a / r;
+        s[i] = (r == 0) ? 0 : b / r;
+        for(int j = i; j < m; j++) {
+            double x = MATRIX_IDX_INTO(H, i, j), y = MATRIX_IDX_INTO(H, i + 1, j);
+            MATRIX_IDX_INTO(H, i, j) = c[i] * x + s[i] * y;
+            MATRIX_IDX_INTO(H, i + 1, j) = -s[i] * x + c[i] * y;
+        }
+    }
+    for(int i = lo; i < hi; i++) {
+        for(int r = 0; r <= i + 1; r++) {
+            double x = MATRIX_IDX_INTO(H, r, i), y = MATRIX_IDX_INTO(H, r, i + 1);
+            MATRIX_IDX_INTO(H, r, i) = c[i] * x + s[i] * y;
+            MATRIX_IDX_INTO(H, r, i + 1) = -s[i] * x + c[i] * y;
+        }
+        for(int r = 0; r < Z->n_row; r++) {
+            double x = MATRIX_IDX_INTO(Z, r, i), y = MATRIX_IDX_INTO(Z, r, i + 1);
+            MATRIX_IDX_INTO(Z, r, i) = c[i] * x + s[i] * y;
+            MATRIX_IDX_INTO(Z, r, i + 1) = -s[i] * x + c[i] * y;
+        }
+    }
+    for(int i = lo; i <= hi; i++) {
+        MATRIX_IDX_INTO(H, i, i) += mu;
+    }
+    free(c);
+}
+
+/* Apply the shifts mu_1, mu_2 (the roots of x^2 - s x + t, or only mu_1
+   when single) to H, accumulating into Q.
+
+   Converged Ritz values leave negligible entries on the subdiagonal of H,
+   which a bulge can not be chased through, so H is split there and the
+   shifts applied to each unreduced block.
+*/
+static void apply_shifts(struct matrix* H, struct matrix* Q, bool single,
+                         double mu_1, double mu_2, double s, double t) {
+    int m = H->n_row;
+    int lo = 0;
+    for(int hi = 0; hi < m; hi++) {
+        if(hi < m - 1) {
+            double sub = fabs(MATRIX_IDX_INTO(H, hi + 1, hi));
+            double diag = fabs(MATRIX_IDX_INTO(H, hi, hi)) + fabs(MATRIX_IDX_INTO(H, hi + 1, hi + 1));
+            if(sub > DBL_EPSILON * diag) {
+                continue;
+            }
+            MATRIX_IDX_INTO(H, hi + 1, hi) = 0;
+        }
+        if(single) {
+            if(hi > lo) {
+                single_shift_step(H, lo, hi, mu_1, Q);
+            }
+        } else if(hi - lo >= 2) {
+            eigen_francis_step(H, lo, hi, s, t, Q);
+        } else if(hi - lo == 1 && !isnan(mu_2)) {
+            single_shift_step(H, lo, hi, mu_1, Q);
+            single_shift_step(H, lo, hi, mu_2, Q);
+        }
+        lo = hi + 1;
+    }
+}
+
+/* Implicitly restarted Arnoldi (Sorensen), with exact shifts.
+
+   The Arnoldi factorization A V_m^t = V_m^t H + f e_m^t is compressed to
+   k vectors by QR steps on H shifted by the m - k unwanted Ritz values
+   (Francis double steps for conjugate pairs and pairs of real shifts),
+   which filters the unwanted directions out of the starting vector without
+   any product with A, and is then extended again to m vectors.
+*/
+struct eigen* eigen_solve_arnoldi(struct linop* A, int k, enum eigen_which which,
+                                  double tol, int max_restarts) {
+    assert(A->n_row == A->n_col);
+    int n = A->n_row;
+    assert(k >= 1 && k <= n);
+    int m = krylov_dimension(n, k + 1);
+
+    struct matrix* V = matrix_new(m, n);
+    double* v = DATA(V);
+    double* w = malloc(sizeof(double) * n);
+    check_memory((void*) w);
+    double* f = malloc(sizeof(double) * n);
+    check_memory((void*) f);
+    double* h = malloc(sizeof(double) * 2 * m);
+    check_memory((void*) h);
+    struct matrix* H = matrix_zeros(m, m);
+    struct vector* re = vector_new(m);
+    struct vector* im = vector_new(m);
+    struct ritz_item* items = malloc(sizeof(struct ritz_item) * m);
+    check_memory((void*) items);
+    double complex* y = malloc(sizeof(double complex) * m * (m + 1));
+    check_memory((void*) y);
+    double complex* lu = y + m;
+    bool* swapped = malloc(sizeof(bool) * m);
+    check_memory((void*) swapped);
+
+    random_vector(v, n, 0);
+    double norm = orthogonalize(v, n, 0, v, h, h + m);
+    for(int r = 0; r < n; r++) {
+        v[r] /= norm;
+    }
+
+    int j0 = 0;
+    int n_wanted = k;
+    double scale = 0;
+    for(int restart = 0; ; restart++) {
+        double beta = 0;
+        for(int j = j0; j < m; j++) {
+            A->apply(A->ctx, v + (size_t) j * n, w);
+            beta = orthogonalize(v, n, j + 1, w, h, h + m);
+            for(int i = 0; i <= j; i++) {
+                MATRIX_IDX_INTO(H, i, j) = h[i];
+            }
+            scale = fmax(scale, fabs(h[j]) + beta);
+            if(j < m - 1) {
+                MATRIX_IDX_INTO(H, j + 1, j) =
+                    next_basis_vector(v, n, j + 1, w, beta, scale, h, h + m);
+            }
+        }
+        memcpy(f, w, sizeof(double) * n);
+
+        eigen_solve_eigenvalues_into(re, im, H, 0, 100);
+        for(int i = 0; i < m; i++) {
+            items[i].re = VECTOR_IDX_INTO(re, i);
+            items[i].im = VECTOR_IDX_INTO(im, i);
+            items[i].index = i;
+        }
+        sort_ritz(items, m, which);
+        // Do not split a conjugate pair between wanted and unwanted.
+        n_wanted = k;
+        if(items[k - 1].im > 0 && k < m) {
+            n_wanted = k + 1;
+        }
+
+        int n_converged = 0;
+        for(int i = 0; i < n_wanted; i++) {
+            hessenberg_eigenvector(H, items[i].re + I * items[i].im, y, lu, swapped);
+            double bound = tol * fmax(hypot(items[i].re, items[i].im), DBL_EPSILON * scale);
+            n_converged += (beta * cabs(y[m - 1]) <= bound);
+        }
+        if(n_converged == n_wanted || m == n || restart >= max_restarts) {
+            break;
+        }
+
+        // Keep a few more vectors than wanted as pairs converge, which
+        // speeds up the others (as in ARPACK).
+        int n_keep = n_wanted + ((n_converged < (m - n_wanted) / 2) ? n_converged : (m - n_wanted) / 2);
+        if(items[n_keep - 1].im > 0) {
+            n_keep++;
+        }
+        if(n_keep > m - 2) {
+            break;
+        }
+
+        // Apply the unwanted Ritz values as shifts.
+        struct matrix* Q = matrix_identity(m);
+        for(int i = n_keep; i < m; i++) {
+            double a = items[i].re, b = items[i].im;
+            if(b != 0 && i + 1 < m && items[i + 1].re == a && items[i + 1].im == -b) {
+                // A complex pair, not usable on 2 x 2 blocks in real arithmetic.
+                apply_shifts(H, Q, false, a, NAN, 2 * a, a * a + b * b);
+                i++;
+            } else if(b == 0 && i + 1 < m && items[i + 1].im == 0) {
+                double c = items[i + 1].re;
+                apply_shifts(H, Q, false, a, c, a + c, a * c);
+                i++;
+            } else {
+                apply_shifts(H, Q, true, a, NAN, 0, 0);
+            }
+        }
+
+        // Compress to p vectors, then
+        // f <- v_p H[p][p - 1] + f Q[m - 1][p - 1].
+        int p = n_keep;
+        double beta_p = MATRIX_IDX_INTO(H, p, p - 1);
+        double sigma = MATRIX_IDX_INTO(Q, m - 1, p - 1);
+        struct matrix* c = matrix_new(m, p + 1);
+        for(int i = 0; i < m; i++) {
+            for(int l = 0; l <= p; l++) {
+                MATRIX_IDX_INTO(c, i, l) = MATRIX_IDX_INTO(Q, i, l);
+            }
+        }
+        combine_basis(V, c);
+        matrix_free_many(2, c, Q);
+        double* vp = v + (size_t) p * n;
+        for(int r = 0; r < n; r++) {
+            w[r] = vp[r] * beta_p + f[r] * sigma;
+        }
+        for(int i = 0; i < m; i++) {
+            for(int j = 0; j < m; j++) {
+                if(i >= p || j >= p) {
+                    MATRIX_IDX_INTO(H, i, j) = 0;
+                }
+            }
+        }
+        // w is orthogonal to the kept vectors up to rounding, clean it up.
+        double beta_w = orthogonalize(v, n, p, w, h, h + m);
+        MATRIX_IDX_INTO(H, p, p - 1) = next_basis_vector(v, n, p, w, beta_w, scale, h, h + m);
+        j0 = p;
+    }
+
+    // Ritz vectors V^t y, a complex y giving the real and imaginary parts.
+    struct eigen* e = eigen_new();
+    e->n = n_wanted;
+    e->eigenvalues = vector_new(n_wanted);
+    e->eigenvalues_imag = vector_new(n_wanted);
+    struct matrix* yr = matrix_zeros(m, n_wanted);
+    for(int l = 0; l < n_wanted; l++) {
+        VECTOR_IDX_INTO(e->eigenvalues, l) = items[l].re;
+        VECTOR_IDX_INTO(e->eigenvalues_imag, l) = items[l].im;
+        hessenberg_eigenvector(H, items[l].re + I * items[l].im, y, lu, swapped);
+        for(int i = 0; i < m; i++) {
+            MATRIX_IDX_INTO(yr, i, l) = creal(y[i]);
+            if(items[l].im > 0 && l + 1 < n_wanted) {
+                MATRIX_IDX_INTO(yr, i, l + 1) = cimag(y[i]);
+            }
+        }
+        if(items[l].im > 0 && l + 1 < n_wanted) {
+            VECTOR_IDX_INTO(e->eigenvalues, l + 1) = items[l + 1].re;
+            VECTOR_IDX_INTO(e->eigenvalues_imag, l + 1) = items[l + 1].im;
+            l++;
+        }
+    }
+    e->eigenvectors = matrix_multiply_MtN(V, yr);
+
+    matrix_free_many(3, H, yr, V); vector_free_many(2, re, im);
+    free(w); free(f); free(h); free(items); free(y); free(swapped);
+    return e;
+}
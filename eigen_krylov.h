@@ -0,0 +1,37 @@
+/* eigen_krylov.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include "vector.h"
+#include "matrix.h"
+#include "eigen.h"
+#include "linop.h"
+
+/* A few eigenpairs of a large matrix, by restarted Krylov methods.
+
+   Only products with the operator are needed, so A may be a dense matrix
+   (see linop_from_matrix) or a sparse or implicit one, and the workspace is
+   O(n m) for a Krylov basis of m vectors, with m about 2k.
+
+   which selects the wanted end of the spectrum, by absolute value or by
+   (real part of the) eigenvalue.  The eigenpairs are returned in that
+   order, in a struct eigen of n = k eigenpairs: eigenvalues (and
+   eigenvalues_imag for Arnoldi) have length k and eigenvectors is
+   A->n_row x k.
+
+   eigen_solve_lanczos is for symmetric operators, eigen_solve_arnoldi for
+   general ones.  Arnoldi may return k + 1 eigenpairs rather than split a
+   complex conjugate pair, whose eigenvector x + iy is stored as x and y in
+   two consecutive columns.  Pairs are accepted when their residual
+   |A x - lambda x| is below tol |lambda|.
+*/
+enum eigen_which {
+    EIGEN_LARGEST_MAGNITUDE,
+    EIGEN_LARGEST,
+    EIGEN_SMALLEST
+};
+
+struct eigen* eigen_solve_lanczos(struct linop* A, int k, enum eigen_which which,
+                                  double tol, int max_restarts);
+struct eigen* eigen_solve_arnoldi(struct linop* A, int k, enum eigen_which which,
+                                  double tol, int max_restarts);
@@ -0,0 +1,768 @@
+/* eigen_symmetric.c
+  (c) Alexis Rigaud, 2024
+
+  Symmetric eigensolver: Householder reduction to tridiagonal form, then
+  Cuppen's divide and conquer on the tridiagonal matrix.
+*/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include "vector.h"
+#include "matrix.h"
+#include "util.h"
+#include "parallel.h"
+#include "eigen.h"
+#include "eigen_symmetric.h"
+
+// Columns reduced together before the trailing matrix is updated.
+#define TRIDIAGONAL_PANEL 32
+// Tridiagonal problems at most this size are solved by QL iterations.
+#define DIVIDE_CONQUER_LEAF 25
+// Maximum QL iterations per eigenvalue.
+#define QL_MAX_ITER 60
+
+
+/************************************
+ * Reduction to tridiagonal form.
+ ************************************/
+
+/* The working state of the reduction.  a is a full n x n (symmetric) copy
+   of the matrix, the reflection I - beta[k] v v^t of step k is stored with v
+   in column k of a below the diagonal.  The panel's reflections and their
+   updates are kept by rows in vt and wt (TRIDIAGONAL_PANEL x n), so that the
+   trailing matrix is updated once per panel by
+       A <- A - V W^t - W V^t.
+*/
+struct tridiagonal {
+    int n;
+    double* a;
+    double* vt;
+    double* wt;
+    int n_panel;
+    int lo;
+    const double* x;
+    double* y;
+};
+
+// y[r] = A[r, lo:n] x[lo:n], for row r = lo + i.
+static void tridiagonal_matvec_row(void* arg, int i, int thread_idx) {
+    (void) thread_idx;
+    struct tridiagonal* t = arg;
+    int r = t->lo + i;
+    const double* row = t->a + r * t->n;
+    double s = 0;
+    for(int c = t->lo; c < t->n; c++) {
+        s += row[c] * t->x[c];
+    }
+    t->y[r] = s;
+}
+
+// A[r, lo:n] -= V[r, :] W[lo:n, :]^t + W[r, :] V[lo:n, :]^t, for row r = lo + i.
+static void tridiagonal_update_row(void* arg, int i, int thread_idx) {
+    (void) thread_idx;
+    struct tridiagonal* t = arg;
+    int n = t->n;
+    int r = t->lo + i;
+    double* row = t->a + r * n;
+    for(int l = 0; l < t->n_panel; l++) {
+        double vr = t->vt[l * n + r];
+        double wr = t->wt[l * n + r];
+        const double* vl = t->vt + l * n;
+        const double* wl = t->wt + l * n;
+        for(int c = t->lo; c < n; c++) {
+            row[c] -= vr * wl[c] + wr * vl[c];
+        }
+    }
+}
+
+/* Reduce the symmetric matrix a (n x n, by rows) to a tridiagonal matrix
+   Q^t A Q, with diagonal d and off diagonal e (e[k] couples k and k + 1),
+   where Q = H_0 H_1 ... H_{n-3} is a product of Householder reflections.
+
+   The reflections of a panel of columns are generated one at a time, each
+   from its column updated with the previous reflections of the panel only,
+   and the trailing matrix gets the whole panel at once as a rank 2 nb
+   update.  This does the bulk of the work as a matrix product, split by
+   rows over the thread pool.
+*/
+static void tridiagonalize(double* a, int n, double* d, double* e, double* beta) {
+    struct tridiagonal t;
+    t.n = n;
+    t.a = a;
+    t.vt = calloc((size_t) TRIDIAGONAL_PANEL * n, sizeof(double));
+    check_memory((void*) t.vt);
+    t.wt = calloc((size_t) TRIDIAGONAL_PANEL * n, sizeof(double));
+    check_memory((void*) t.wt);
+    double* y = malloc(sizeof(double) * n);
+    check_memory((void*) y);
+
+    for(int j0 = 0; j0 < n - 2; j0 += TRIDIAGONAL_PANEL) {
+        int nb = (n - 2 - j0 < TRIDIAGONAL_PANEL) ? n - 2 - j0 : TRIDIAGONAL_PANEL;
+        for(int i = 0; i < nb; i++) {
+            int k = j0 + i;
+            double* vi = t.vt + i * n;
+            double* wi = t.wt + i * n;
+
+            // Bring column k up to date with the panel so far.
+            for(int l = 0; l < i; l++) {
+                double vk = t.vt[l * n + k];
+                double wk = t.wt[l * n + k];
+                for(int r = k; r < n; r++) {
+                    a[r * n + k] -= t.vt[l * n + r] * wk + t.wt[l * n + r] * vk;
+                }
+            }
+            d[k] = a[k * n + k];
+
+            // Householder reflection zeroing a[k+2:n, k].
+            double x0 = a[(k + 1) * n + k];
+            double sigma = 0;
+            for(int r = k + 2; r < n; r++) {
+                sigma += a[r * n + k] * a[r * n + k];
+            }
+            memset(vi, 0, sizeof(double) * n);
+            memset(wi, 0, sizeof(double) * n);
+            if(sigma == 0) {
+                beta[k] = 0;
+                e[k] = x0;
+                for(int r = k + 1; r < n; r++) {
+                    a[r * n + k] = 0;
+                }
+                continue;
+            }
+            double alpha = sqrt(x0 * x0 + sigma);
+            if(x0 > 0) {
+                alpha = -alpha;
+            }
+            vi[k + 1] = x0 - alpha;
+            for(int r = k + 2; r < n; r++) {
+                vi[r] = a[r * n + k];
+            }
+            beta[k] = 2 / (vi[k + 1] * vi[k + 1] + sigma);
+            e[k] = alpha;
+            for(int r = k + 1; r < n; r++) {
+                a[r * n + k] = vi[r];
+            }
+
+            // w = beta (A - V W^t - W V^t) v, then w -= (beta / 2) (w^t v) v,
+            // so that H A H = A - v w^t - w v^t.
+            t.lo = k + 1;
+            t.x = vi;
+            t.y = y;
+            parallel_for(n - k - 1, 1 + 4096 / (n - k), tridiagonal_matvec_row, &t);
+            for(int l = 0; l < i; l++) {
+                double wv = 0, vv = 0;
+                for(int r = k + 1; r < n; r++) {
+                    wv += t.wt[l * n + r] * vi[r];
+                    vv += t.vt[l * n + r] * vi[r];
+                }
+                for(int r = k + 1; r < n; r++) {
+                    y[r] -= t.vt[l * n + r] * wv + t.wt[l * n + r] * vv;
+                }
+            }
+            double yv = 0;
+            for(int r = k + 1; r < n; r++) {
+                y[r] *= beta[k];
+                yv += y[r] * vi[r];
+            }
+            for(int r = k + 1; r < n; r++) {
+                wi[r] = y[r] - 0.5 * beta[k] * yv * vi[r];
+            }
+        }
+
+        // The trailing matrix gets the whole panel.
+        t.n_panel = nb;
+        t.lo = j0 + nb;
+        parallel_for(n - t.lo, 1 + 4096 / (nb * (n - t.lo)), tridiagonal_update_row, &t);
+    }
+
+    if(n >= 2) {
+        d[n - 2] = a[(n - 2) * n + n - 2];
+        e[n - 2] = a[(n - 1) * n + n - 2];
+    }
+    d[n - 1] = a[(n - 1) * n + n - 1];
+    e[n - 1] = 0;
+
+    free(t.vt); free(t.wt); free(y);
+}
+
+struct back_transform {
+    int n;
+    const double* a;
+    const double* beta;
+    double* z;
+};
+
+#define BACK_TRANSFORM_BLOCK 32
+
+/* Z <- Q Z on a block of columns of Z, applying the reflections stored in a
+   last to first.
+*/
+static void back_transform_block(void* arg, int block, int thread_idx) {
+    (void) thread_idx;
+    struct back_transform* bt = arg;
+    int n = bt->n;
+    int c0 = block * BACK_TRANSFORM_BLOCK;
+    int c1 = (c0 + BACK_TRANSFORM_BLOCK < n) ? c0 + BACK_TRANSFORM_BLOCK : n;
+    double s[BACK_TRANSFORM_BLOCK];
+    for(int k = n - 3; k >= 0; k--) {
+        if(bt->beta[k] == 0) {
+            continue;
+        }
+        for(int c = c0; c < c1; c++) {
+            s[c - c0] = 0;
+        }
+        for(int r = k + 1; r < n; r++) {
+            double vr = bt->a[r * n + k];
+            const double* zr = bt->z + r * n;
+            for(int c = c0; c < c1; c++) {
+                s[c - c0] += vr * zr[c];
+            }
+        }
+        for(int r = k + 1; r < n; r++) {
+            double bvr = bt->beta[k] * bt->a[r * n + k];
+            double* zr = bt->z + r * n;
+            for(int c = c0; c < c1; c++) {
+                zr[c] -= bvr * s[c - c0];
+            }
+        }
+    }
+}
+
+
+/************************************
+ * Symmetric tridiagonal eigenproblem.
+ ************************************/
+
+/* Sort d[0..n-1] in increasing order, permuting the columns of the n x n
+   block of q (leading dimension ldq) along when it is not NULL.  Selection
+   sort, this is only used on the small leaf problems.
+*/
+static void sort_eigenpairs(double* d, int n, double* q, int ldq) {
+    for(int i = 0; i < n - 1; i++) {
+        int min = i;
+        for(int j = i + 1; j < n; j++) {
+            if(d[j] < d[min]) {
+                min = j;
+            }
+        }
+        if(min == i) {
+            continue;
+        }
+        double tmp = d[i]; d[i] = d[min]; d[min] = tmp;
+        if(q != NULL) {
+            for(int r = 0; r < n; r++) {
+                tmp = q[r * ldq + i];
+                q[r * ldq + i] = q[r * ldq + min];
+                q[r * ldq + min] = tmp;
+            }
+        }
+    }
+}
+
+/* Implicit QL iterations with Wilkinson shifts on the tridiagonal matrix with
+   diagonal d and off diagonal e (e[n-1] is used as scratch).  On return d
+   holds the eigenvalues in increasing order, and when q is not NULL the n x n
+   block of q (identity on entry) holds the eigenvectors.
+
+   Each iteration chases the shift through the unreduced block l..m with
+   plane rotations, from the bottom up; the e[l] entry converges cubically
+   to zero.
+*/
+static void tridiagonal_ql(double* d, double* e, int n, double* q, int ldq) {
+    e[n - 1] = 0;
+    for(int l = 0; l < n; l++) {
+        for(int iter = 0; iter < QL_MAX_ITER; iter++) {
+            int m;
+            for(m = l; m < n - 1; m++) {
+                double dd = fabs(d[m]) + fabs(d[m + 1]);
+                if(fabs(e[m]) <= DBL_EPSILON * dd) {
+                    break;
+                }
+            }
+            if(m == l) {
+                break;
+            }
+
+            // Wilkinson shift, the eigenvalue of the leading 2 x 2 block
+            // closer to d[l].
+            double g = (d[l + 1] - d[l]) / (2 * e[l]);
+            double r = hypot(g, 1.0);
+            g = d[m] - d[l] + e[l] / (g + copysign(r, g));
+            double s = 1, c = 1, p = 0;
+            int i;
+            for(i = m - 1; i >= l; i--) {
+                double f = s * e[i];
+                double b = c * e[i];
+                r = hypot(f, g);
+                e[i + 1] = r;
+                if(r == 0) {
+                    // Underflow, the block splits.
+                    d[i + 1] -= p;
+                    e[m] = 0;
+                    break;
+                }
+                s = f / r;
+                c = g / r;
+                g = d[i + 1] - p;
+                r = (d[i] - g) * s + 2 * c * b;
+                p = s * r;
+                d[i + 1] = g + p;
+                g = c * r - b;
+                if(q != NULL) {
+                    for(int k = 0; k < n; k++) {
+                        double* row = q + k * ldq;
+                        double qi = row[i], qi1 = row[i + 1];
+                        row[i + 1] = s * qi + c * qi1;
+                        row[i] = c * qi - s * qi1;
+                    }
+                }
+            }
+            if(r == 0 && i >= l) {
+                continue;
+            }
+            d[l] -= p;
+            e[l] = g;
+            e[m] = 0;
+        }
+    }
+    sort_eigenpairs(d, n, q, ldq);
+}
+
+/* The rank one merge of divide and conquer: eigenvalues and eigenvectors of
+   D + rho z z^t, with D = diag(d) and z of unit length.
+*/
+struct secular {
+    int k;
+    double rho;
+    const double* d;     // Non deflated poles, increasing.
+    const double* z;
+    int* origin;         // Root j is d[origin[j]] + tau[j].
+    double* tau;
+    double* zhat;
+    double* u;           // Eigenvectors, by columns (k x k).
+    // Matrix product C = A U over the rows of the merged block.
+    int n_rows;
+    const double* qa;    // n_rows x k
+    double* qc;          // n_rows x k
+};
+
+/* Root j of the secular equation
+       f(lambda) = 1 + rho sum_i z_i^2 / (d_i - lambda) = 0,
+   which lies between d[j] and d[j+1] (or d[k-1] + rho |z|^2 for the last).
+
+   The root is found as an offset tau from the closer pole, so that the
+   differences d_i - lambda = (d_i - d_origin) - tau are computed accurately
+   even when the root is very close to a pole.  Newton steps are kept inside
+   a bracket, and fall back to bisection when they leave it.
+*/
+static void secular_root(void* arg, int j, int thread_idx) {
+    (void) thread_idx;
+    struct secular* sec = arg;
+    int k = sec->k;
+    const double* d = sec->d;
+    const double* z = sec->z;
+    double rho = sec->rho;
+
+    int o;
+    double lo, hi;
+    if(j < k - 1) {
+        double gap = d[j + 1] - d[j];
+        double mid = gap / 2;
+        double f = 1;
+        for(int i = 0; i < k; i++) {
+            f += rho * z[i] * z[i] / ((d[i] - d[j]) - mid);
+        }
+        if(f >= 0) {
+            o = j; lo = 0; hi = mid;
+        } else {
+            o = j + 1; lo = -mid; hi = 0;
+        }
+    } else {
+        double zz = 0;
+        for(int i = 0; i < k; i++) {
+            zz += z[i] * z[i];
+        }
+        o = k - 1; lo = 0; hi = rho * zz;
+    }
+
+    double tau = (lo + hi) / 2;
+    for(int iter = 0; iter < 200; iter++) {
+        double f = 1, fp = 0, f_abs = 1;
+        for(int i = 0; i < k; i++) {
+            double t = z[i] / ((d[i] - d[o]) - tau);
+            f += rho * z[i] * t;
+            fp += rho * t * t;
+            f_abs += fabs(rho * z[i] * t);
+        }
+        if(f == 0) {
+            break;
+        }
+        if(f < 0) {
+            lo = tau;
+        } else {
+            hi = tau;
+        }
+        if(fabs(f) <= 4 * k * DBL_EPSILON * f_abs) {
+            break;
+        }
+        double next = tau - f / fp;
+        if(!(next > lo && next < hi)) {
+            next = lo + (hi - lo) / 2;
+        }
+        if(next == tau || hi - lo <= DBL_EPSILON * fmax(fabs(lo), fabs(hi))) {
+            break;
+        }
+        tau = next;
+    }
+    sec->origin[j] = o;
+    sec->tau[j] = tau;
+}
+
+// lambda_j - d_i, accurately.
+static double root_minus_pole(struct secular* sec, int j, int i) {
+    return (sec->d[sec->origin[j]] - sec->d[i]) + sec->tau[j];
+}
+
+/* Gu and Eisenstat: recompute z from the computed roots, as the vector for
+   which they are the exact eigenvalues of D + rho zhat zhat^t,
+       zhat_i^2 = prod_j (lambda_j - d_i) / (rho prod_{j != i} (d_j - d_i)).
+   The eigenvectors (d_i - lambda_j)^-1 zhat_i are then numerically
+   orthogonal, however close the roots.
+*/
+static void secular_zhat(void* arg, int i, int thread_idx) {
+    (void) thread_idx;
+    struct secular* sec = arg;
+    int k = sec->k;
+    const double* d = sec->d;
+    double prod = root_minus_pole(sec, k - 1, i) / sec->rho;
+    for(int j = 0; j < i; j++) {
+        prod *= root_minus_pole(sec, j, i) / (d[j] - d[i]);
+    }
+    for(int j = i; j < k - 1; j++) {
+        prod *= root_minus_pole(sec, j, i) / (d[j + 1] - d[i]);
+    }
+    sec->zhat[i] = copysign(sqrt(fabs(prod)), sec->z[i]);
+}
+
+static void secular_vector(void* arg, int j, int thread_idx) {
+    (void) thread_idx;
+    struct secular* sec = arg;
+    int k = sec->k;
+    double* u = sec->u + j;
+    double norm_sq = 0;
+    for(int i = 0; i < k; i++) {
+        u[i * k] = -sec->zhat[i] / root_minus_pole(sec, j, i);
+        norm_sq += u[i * k] * u[i * k];
+    }
+    double norm = sqrt(norm_sq);
+    for(int i = 0; i < k; i++) {
+        u[i * k] /= norm;
+    }
+}
+
+/* Row r of C = A U.  A is mostly the block diagonal eigenvector matrix of
+   the two halves, so its zeros are skipped.
+*/
+static void secular_product_row(void* arg, int r, int thread_idx) {
+    (void) thread_idx;
+    struct secular* sec = arg;
+    int k = sec->k;
+    const double* ar = sec->qa + r * k;
+    double* cr = sec->qc + r * k;
+    for(int j = 0; j < k; j++) {
+        cr[j] = 0;
+    }
+    for(int i = 0; i < k; i++) {
+        if(ar[i] == 0) {
+            continue;
+        }
+        const double* ui = sec->u + i * k;
+        for(int j = 0; j < k; j++) {
+            cr[j] += ar[i] * ui[j];
+        }
+    }
+}
+
+struct sort_item {
+    double value;
+    int index;
+};
+
+static int compare_increasing(const void* x, const void* y) {
+    double vx = ((const struct sort_item*) x)->value;
+    double vy = ((const struct sort_item*) y)->value;
+    return (vx > vy) - (vx < vy);
+}
+
+/* Merge the solutions of the two halves of a tridiagonal problem.
+
+   On entry d[0..m-1] and d[m..n-1] are the (increasing) eigenvalues of the
+   two halves and q is block diagonal with their eigenvectors.  The full
+   matrix is Q (D + rho w w^t) Q^t, where w is made of the last row of the
+   first block and (sign times) the first row of the second block.
+
+   Deflation first removes the easy eigenpairs: those with a negligible
+   component of w (the eigenpair of D is kept), and one of each pair of
+   nearly equal poles (rotated so that its component vanishes).  The
+   remaining k eigenvalues are the roots of the secular equation, and the
+   eigenvectors of the merged problem are Q times the eigenvectors of the
+   rank one update, a n x k by k x k matrix product.
+*/
+static void tridiagonal_merge(double* d, int n, int m, double* q, int ldq,
+                              double rho, double sign) {
+    double* z = malloc(sizeof(double) * n);
+    check_memory((void*) z);
+    for(int i = 0; i < m; i++) {
+        z[i] = q[(m - 1) * ldq + i] / sqrt(2.0);
+    }
+    for(int i = m; i < n; i++) {
+        z[i] = sign * q[m * ldq + i] / sqrt(2.0);
+    }
+    rho *= 2;
+
+    struct sort_item* order = malloc(sizeof(struct sort_item) * n);
+    check_memory((void*) order);
+    double d_max = 0;
+    for(int i = 0; i < n; i++) {
+        order[i].value = d[i];
+        order[i].index = i;
+        d_max = fmax(d_max, fabs(d[i]));
+    }
+    qsort(order, n, sizeof(struct sort_item), compare_increasing);
+    double tol = 8 * DBL_EPSILON * fmax(d_max, rho);
+
+    int* kept = malloc(sizeof(int) * n);
+    check_memory((void*) kept);
+    bool* deflated = calloc(n, sizeof(bool));
+    check_memory((void*) deflated);
+    int k = 0;
+    int prev = -1;
+    for(int t = 0; t < n; t++) {
+        int i = order[t].index;
+        if(rho * fabs(z[i]) <= tol) {
+            deflated[i] = true;
+            continue;
+        }
+        if(prev >= 0) {
+            double tau = hypot(z[prev], z[i]);
+            double c = z[i] / tau;
+            double s = -z[prev] / tau;
+            if(fabs((d[i] - d[prev]) * c * s) <= tol) {
+                // Rotate the weight of prev onto i, and deflate prev.
+                z[i] = tau;
+                z[prev] = 0;
+                for(int r = 0; r < n; r++) {
+                    double* row = q + r * ldq;
+                    double qp = row[prev], qi = row[i];
+                    row[prev] = c * qp + s * qi;
+                    row[i] = c * qi - s * qp;
+                }
+                double dp = d[prev] * c * c + d[i] * s * s;
+                d[i] = d[prev] * s * s + d[i] * c * c;
+                d[prev] = dp;
+                deflated[prev] = true;
+            } else {
+                kept[k++] = prev;
+            }
+        }
+        prev = i;
+    }
+    if(prev >= 0) {
+        kept[k++] = prev;
+    }
+    // Rotations may have moved poles a little, keep them increasing.
+    for(int a = 1; a < k; a++) {
+        int idx = kept[a];
+        int b = a - 1;
+        while(b >= 0 && d[kept[b]] > d[idx]) {
+            kept[b + 1] = kept[b];
+            b--;
+        }
+        kept[b + 1] = idx;
+    }
+
+    double* work = malloc(sizeof(double) * (size_t) (4 * k + k * k + 2 * n * k + 1));
+    check_memory((void*) work);
+    int* origin = malloc(sizeof(int) * (k + 1));
+    check_memory((void*) origin);
+    struct secular sec;
+    double* dk = work;
+    double* zk = dk + k;
+    sec.k = k;
+    sec.rho = rho;
+    sec.d = dk;
+    sec.z = zk;
+    sec.origin = origin;
+    sec.tau = zk + k;
+    sec.zhat = sec.tau + k;
+    sec.u = sec.zhat + k;
+    double* qa = sec.u + k * k;
+    sec.qa = qa;
+    sec.qc = qa + n * k;
+    sec.n_rows = n;
+    for(int j = 0; j < k; j++) {
+        dk[j] = d[kept[j]];
+        zk[j] = z[kept[j]];
+        for(int r = 0; r < n; r++) {
+            qa[r * k + j] = q[r * ldq + kept[j]];
+        }
+    }
+
+    int grain = 1 + 4096 / (k + 1);
+    parallel_for(k, grain, secular_root, &sec);
+    parallel_for(k, grain, secular_zhat, &sec);
+    parallel_for(k, grain, secular_vector, &sec);
+    parallel_for(n, 1 + 65536 / (k * k + 1), secular_product_row, &sec);
+
+    // Gather all eigenpairs, sorted.
+    int n_out = 0;
+    for(int j = 0; j < k; j++) {
+        order[n_out].value = dk[origin[j]] + sec.tau[j];
+        order[n_out].index = -1 - j;
+        n_out++;
+    }
+    for(int i = 0; i < n; i++) {
+        if(deflated[i]) {
+            order[n_out].value = d[i];
+            order[n_out].index = i;
+            n_out++;
+        }
+    }
+    assert(n_out == n);
+    qsort(order, n, sizeof(struct sort_item), compare_increasing);
+
+    double* merged = malloc(sizeof(double) * (size_t) n * n);
+    check_memory((void*) merged);
+    for(int t = 0; t < n; t++) {
+        int idx = order[t].index;
+        d[t] = order[t].value;
+        for(int r = 0; r < n; r++) {
+            merged[r * n + t] = (idx < 0) ? sec.qc[r * k + (-1 - idx)] : q[r * ldq + idx];
+        }
+    }
+    for(int r = 0; r < n; r++) {
+        memcpy(q + r * ldq, merged + r * n, sizeof(double) * n);
+    }
+
+    free(z); free(order); free(kept); free(deflated);
+    free(work); free(origin); free(merged);
+}
+
+/* Divide and conquer (Cuppen).  Splitting the tridiagonal matrix at m with
+   off diagonal entry b gives two independent tridiagonal problems (with
+   |b| removed from the two diagonal entries next to the split) plus the
+   rank one correction |b| w w^t.  On return d holds the eigenvalues in
+   increasing order and the n x n block of q the eigenvectors.
+*/
+static void tridiagonal_divide_conquer(double* d, double* e, int n, double* q, int ldq) {
+    for(int r = 0; r < n; r++) {
+        memset(q + r * ldq, 0, sizeof(double) * n);
+    }
+    if(n <= DIVIDE_CONQUER_LEAF) {
+        for(int r = 0; r < n; r++) {
+            q[r * ldq + r] = 1;
+        }
+        tridiagonal_ql(d, e, n, q, ldq);
+        return;
+    }
+    int m = n / 2;
+    double b = e[m - 1];
+    double rho = fabs(b);
+    d[m - 1] -= rho;
+    d[m] -= rho;
+    tridiagonal_divide_conquer(d, e, m, q, ldq);
+    tridiagonal_divide_conquer(d + m, e + m, n - m, q + m * ldq + m, ldq);
+    tridiagonal_merge(d, n, m, q, ldq, rho, (b >= 0) ? 1 : -1);
+}
+
+
+/************************************
+ * Driver.
+ ************************************/
+
+// Symmetric copy of M, from its lower triangle.
+static double* symmetric_copy(struct matrix* M) {
+    int n = M->n_row;
+    double* a = malloc(sizeof(double) * (size_t) n * n);
+    check_memory((void*) a);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j <= i; j++) {
+            a[i * n + j] = a[j * n + i] = MATRIX_IDX_INTO(M, i, j);
+        }
+    }
+    return a;
+}
+
+/* Compute the eigenvalues and eigenvectors of a symmetric matrix.
+
+   M is reduced to tridiagonal form T = Q^t M Q, the eigendecomposition of
+   T is computed by divide and conquer, and its eigenvectors are mapped back
+   by Q.  This is O(n^3) overall, with most of the work done as matrix
+   products over the thread pool, and the eigenvectors come out orthogonal
+   to working precision.
+*/
+struct eigen* eigen_solve_symmetric(struct matrix* M) {
+    assert(M->n_row == M->n_col);
+    int n = M->n_row;
+    double* a = symmetric_copy(M);
+    double* d = malloc(sizeof(double) * n);
+    check_memory((void*) d);
+    double* e = malloc(sizeof(double) * n);
+    check_memory((void*) e);
+    double* beta = calloc(n, sizeof(double));
+    check_memory((void*) beta);
+
+    tridiagonalize(a, n, d, e, beta);
+    struct matrix* z = matrix_new(n, n);
+    tridiagonal_divide_conquer(d, e, n, DATA(z), n);
+
+    struct back_transform bt = {n, a, beta, DATA(z)};
+    int n_blocks = (n + BACK_TRANSFORM_BLOCK - 1) / BACK_TRANSFORM_BLOCK;
+    parallel_for(n_blocks, 1, back_transform_block, &bt);
+
+    // Decreasing order.
+    struct eigen* eig = eigen_new();
+    eig->n = n;
+    eig->eigenvalues = vector_new(n);
+    eig->eigenvectors = matrix_new(n, n);
+    for(int j = 0; j < n; j++) {
+        VECTOR_IDX_INTO(eig->eigenvalues, j) = d[n - 1 - j];
+    }
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < n; j++) {
+            MATRIX_IDX_INTO(eig->eigenvectors, i, j) = MATRIX_IDX_INTO(z, i, n - 1 - j);
+        }
+    }
+
+    matrix_free(z);
+    free(a); free(d); free(e); free(beta);
+    return eig;
+}
+
+/* Eigenvalues only, in decreasing order: the tridiagonal matrix is solved
+   by QL iterations in O(n^2).
+*/
+struct vector* eigen_solve_symmetric_eigenvalues(struct matrix* M) {
+    assert(M->n_row == M->n_col);
+    int n = M->n_row;
+    double* a = symmetric_copy(M);
+    double* d = malloc(sizeof(double) * n);
+    check_memory((void*) d);
+    double* e = malloc(sizeof(double) * n);
+    check_memory((void*) e);
+    double* beta = calloc(n, sizeof(double));
+    check_memory((void*) beta);
+
+    tridiagonalize(a, n, d, e, beta);
+    tridiagonal_ql(d, e, n, NULL, 0);
+
+    struct vector* eigenvalues = vector_new(n);
+    for(int j = 0; j < n; j++) {
+        VECTOR_IDX_INTO(eigenvalues, j) = d[n - 1 - j];
+    }
+    free(a); free(d); free(e); free(beta);
+    return eigenvalues;
+}
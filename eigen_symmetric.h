@@ -0,0 +1,16 @@
+/* eigen_symmetric.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include "vector.h"
+#include "matrix.h"
+#include "eigen.h"
+
+/* Eigenvalues and eigenvectors of a symmetric matrix.
+
+   The eigenvalues are returned in decreasing order, and the columns of the
+   eigenvectors matrix are the matching (orthonormal) eigenvectors.  Only the
+   lower triangle of M is read.
+*/
+struct eigen*  eigen_solve_symmetric(struct matrix* M);
+struct vector* eigen_solve_symmetric_eigenvalues(struct matrix* M);
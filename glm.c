@@ -0,0 +1,225 @@
+/* glm.c
+  (c) Alexis Rigaud, 2024
+
+  Generalized linear models, fit by iteratively reweighted least squares.
+*/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include "vector.h"
+#include "matrix.h"
+#include "util.h"
+#include "parallel.h"
+#include "linsolve.h"
+#include "glm.h"
+
+// Rows handled together by a thread in a pass over X.
+#define GLM_BLOCK 256
+
+struct glm* glm_new(void) {
+    struct glm* g = malloc(sizeof(struct glm));
+    check_memory((void*) g);
+    return g;
+}
+
+void glm_free(struct glm* g) {
+    vector_free(g->beta);
+    free(g);
+}
+
+/* The mean mu of the response for the linear predictor eta, and the IRLS
+   weight, which for a canonical link is both d mu / d eta and the variance
+   function at mu.  The mean is kept off the boundary of its range, where
+   the weight would vanish.
+*/
+static void glm_mean(enum glm_family family, double eta, double* mu, double* weight) {
+    switch(family) {
+    case GLM_LOGISTIC:
+        *mu = 1 / (1 + exp(-eta));
+        *mu = fmin(fmax(*mu, DBL_EPSILON), 1 - DBL_EPSILON);
+        *weight = *mu * (1 - *mu);
+        break;
+    case GLM_POISSON:
+        *mu = exp(fmin(eta, 700));
+        *mu = fmax(*mu, DBL_EPSILON);
+        *weight = *mu;
+        break;
+    }
+}
+
+// y log(y / mu), zero when y is.
+static double y_log_y_over_mu(double y, double mu) {
+    return (y == 0) ? 0 : y * log(y / mu);
+}
+
+// The contribution of one observation to the deviance.
+static double glm_unit_deviance(enum glm_family family, double y, double mu) {
+    switch(family) {
+    case GLM_LOGISTIC:
+        return 2 * (y_log_y_over_mu(y, mu) + y_log_y_over_mu(1 - y, 1 - mu));
+    case GLM_POISSON:
+        return 2 * (y_log_y_over_mu(y, mu) - (y - mu));
+    }
+    return 0;
+}
+
+/* The buffers of a fit, allocated once.  Each thread accumulates into its
+   own slice of gram (p x p), rhs (p) and deviance.
+*/
+struct irls {
+    struct matrix* X;
+    struct vector* y;
+    enum glm_family family;
+    int p;
+    int n_threads;
+    double* beta;
+    double* gram;
+    double* rhs;
+    double* deviance;
+};
+
+/* One block of rows of the pass: with eta = x^t beta and the working
+   response z = eta + (y - mu) / w, accumulate the upper triangle of the
+   weighted Gram matrix X^t W X, row by row as rank one updates w x x^t
+   (the symmetric rank k update of the block), and X^t W z.
+*/
+static void irls_block(void* arg, int block, int thread_idx) {
+    struct irls* irls = arg;
+    int p = irls->p;
+    double* gram = irls->gram + (size_t) thread_idx * p * p;
+    double* rhs = irls->rhs + (size_t) thread_idx * p;
+    double deviance = 0;
+    int end = (block + 1) * GLM_BLOCK;
+    if(end > irls->X->n_row) {
+        end = irls->X->n_row;
+    }
+    for(int i = block * GLM_BLOCK; i < end; i++) {
+        const double* x = DATA(irls->X) + (size_t) i * p;
+        double eta = 0;
+        for(int a = 0; a < p; a++) {
+            eta += x[a] * irls->beta[a];
+        }
+        double y = VECTOR_IDX_INTO(irls->y, i), mu, w;
+        glm_mean(irls->family, eta, &mu, &w);
+        deviance += glm_unit_deviance(irls->family, y, mu);
+        double wz = w * eta + (y - mu);
+        for(int a = 0; a < p; a++) {
+            rhs[a] += wz * x[a];
+            double wx_a = w * x[a];
+            double* gram_a = gram + a * p;
+            for(int b = a; b < p; b++) {
+                gram_a[b] += wx_a * x[b];
+            }
+        }
+    }
+    irls->deviance[thread_idx] += deviance;
+}
+
+/* A single pass over X at the current beta, leaving the normal equations
+   in the first slices of gram and rhs.  Returns the deviance at beta.
+*/
+static double irls_pass(struct irls* irls) {
+    int p = irls->p;
+    memset(irls->gram, 0, sizeof(double) * irls->n_threads * p * p);
+    memset(irls->rhs, 0, sizeof(double) * irls->n_threads * p);
+    memset(irls->deviance, 0, sizeof(double) * irls->n_threads);
+    int n_blocks = (irls->X->n_row + GLM_BLOCK - 1) / GLM_BLOCK;
+    parallel_for(n_blocks, 1 + 4 * p / GLM_BLOCK, irls_block, irls);
+    for(int t = 1; t < irls->n_threads; t++) {
+        for(int a = 0; a < p * p; a++) {
+            irls->gram[a] += irls->gram[t * p * p + a];
+        }
+        for(int a = 0; a < p; a++) {
+            irls->rhs[a] += irls->rhs[t * p + a];
+        }
+        irls->deviance[0] += irls->deviance[t];
+    }
+    return irls->deviance[0];
+}
+
+/* Fit a generalized linear model by iteratively reweighted least squares.
+
+  Each iteration is a Newton step for the log likelihood, the weighted least
+  squares problem
+
+      (X^t W X) beta = X^t W z
+
+  with the weights W and working response z of the current fit.  Its normal
+  equations are formed in a single pass over X, which also gives the
+  deviance of the current fit, and solved by Cholesky.  All the buffers are
+  allocated before the first iteration.  If the deviance goes up, the step
+  is halved until it does not (beyond the tolerance).
+*/
+struct glm* glm_fit(struct matrix* X, struct vector* y, enum glm_family family,
+                    struct vector* beta_start, double tol, int max_iter) {
+    assert(X->n_row == y->length);
+    assert(beta_start == NULL || beta_start->length == X->n_col);
+    int p = X->n_col;
+    struct irls irls;
+    irls.X = X;
+    irls.y = y;
+    irls.family = family;
+    irls.p = p;
+    irls.n_threads = parallel_num_threads();
+    irls.gram = malloc(sizeof(double) * irls.n_threads * (p * p + p + 1));
+    check_memory((void*) irls.gram);
+    irls.rhs = irls.gram + irls.n_threads * p * p;
+    irls.deviance = irls.rhs + irls.n_threads * p;
+    double* beta_old = malloc(sizeof(double) * p);
+    check_memory((void*) beta_old);
+
+    struct glm* g = glm_new();
+    g->n = X->n_row;
+    g->p = p;
+    g->family = family;
+    g->beta = (beta_start == NULL) ? vector_zeros(p) : vector_copy(beta_start);
+    g->converged = false;
+    irls.beta = DATA(g->beta);
+
+    double deviance_old = INFINITY;
+    int iter;
+    for(iter = 0; ; iter++) {
+        double deviance = irls_pass(&irls);
+        for(int halving = 0; iter > 0 && !(deviance - deviance_old <= tol * (fabs(deviance_old) + 0.1))
+                                && halving < 30; halving++) {
+            for(int a = 0; a < p; a++) {
+                irls.beta[a] = (irls.beta[a] + beta_old[a]) / 2;
+            }
+            deviance = irls_pass(&irls);
+        }
+        g->deviance = deviance;
+        if(iter > 0 && fabs(deviance - deviance_old) <= tol * (fabs(deviance) + 0.1)) {
+            g->converged = true;
+            break;
+        }
+        if(iter >= max_iter) {
+            break;
+        }
+        memcpy(beta_old, irls.beta, sizeof(double) * p);
+        deviance_old = deviance;
+        memcpy(irls.beta, irls.rhs, sizeof(double) * p);
+        if(!linsolve_cholesky_in_place(irls.gram, irls.beta, p)) {
+            // X^t W X is singular, the coefficients are not identifiable.
+            memcpy(irls.beta, beta_old, sizeof(double) * p);
+            break;
+        }
+    }
+    g->n_iter = iter;
+
+    free(irls.gram); free(beta_old);
+    return g;
+}
+
+/* The mean response for the rows of X. */
+struct vector* glm_predict(struct glm* g, struct matrix* X) {
+    assert(X->n_col == g->p);
+    struct vector* mu = matrix_vector_multiply(X, g->beta);
+    for(int i = 0; i < mu->length; i++) {
+        double w;
+        glm_mean(g->family, VECTOR_IDX_INTO(mu, i), &VECTOR_IDX_INTO(mu, i), &w);
+    }
+    return mu;
+}
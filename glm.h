@@ -0,0 +1,40 @@
+/* glm.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+
+/* Generalized linear models, with their canonical links:
+
+     - GLM_LOGISTIC: y in [0, 1], mean 1 / (1 + exp(-X b)).
+     - GLM_POISSON: counts y >= 0, mean exp(X b).
+
+   glm_fit finds the maximum likelihood coefficients by iteratively
+   reweighted least squares, starting from beta_start (a previous fit, for
+   a warm start) or from zero when it is NULL.  It stops when the deviance
+   changes by less than tol relative to its value, or after max_iter
+   iterations.
+*/
+enum glm_family {
+    GLM_LOGISTIC,
+    GLM_POISSON
+};
+
+struct glm {
+    long n;
+    int p;
+    enum glm_family family;
+    struct vector* beta;
+    double deviance;
+    int n_iter;
+    bool converged;
+};
+
+struct glm* glm_new(void);
+void        glm_free(struct glm* g);
+
+struct glm*    glm_fit(struct matrix* X, struct vector* y, enum glm_family family,
+                       struct vector* beta_start, double tol, int max_iter);
+struct vector* glm_predict(struct glm* g, struct matrix* X);
@@ -6,9 +6,30 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
 
+#include "util.h"
+#include "matrix.h"
 #include "kernel.h"
 
+#define OCL_MAX_PLATFORMS 8
+
+enum opencl_state {
+    OCL_UNINITIALIZED,
+    OCL_READY,
+    OCL_UNAVAILABLE
+};
+
+static struct opencl_s runtime;
+static enum opencl_state runtime_state = OCL_UNINITIALIZED;
+static pthread_mutex_t runtime_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* names of the kernels of kernels.cl, by enum opencl_kernel */
+static const char* kernel_names[OCL_N_KERNELS] = {"gemm_f64", "gemm_f32"};
+
 /* OpenCL 1.2 error handler */
 void opencl_err_hander(cl_int err)
 {
@@ -88,113 +109,699 @@ void debug_opencl(struct opencl_s* opencl)
     clGetProgramBuildInfo(opencl->program, opencl->device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, NULL);
     buffer[BUF_MAX_SIZE-1] = '\0';
     printf("%s\n", buffer);
-    exit(EXIT_FAILURE);
 }
 
-/* read a .cl file and place content into buffer */
-char* kernel_read(void)
+/* read a .cl file and place content into buffer, NULL if not found */
+static char* kernel_read(void)
 {
-    FILE* kernels_file = fopen("../kernels.cl", "r");
+    const char* paths[] = {getenv("LINALG_KERNELS"), "kernels.cl", "../kernels.cl"};
+    FILE* kernels_file = NULL;
+    for(int i = 0; i < 3 && kernels_file == NULL; i++) {
+        if(paths[i] != NULL) {
+            kernels_file = fopen(paths[i], "r");
+        }
+    }
     if(kernels_file == NULL) {
-        printf("Couldn't find the program file");
-        exit(EXIT_FAILURE);
+        printf("Couldn't find the program file\n");
+        return NULL;
     }
     fseek(kernels_file, 0, SEEK_END);
     size_t kernels_size = ftell(kernels_file);
     rewind(kernels_file);
     char* kernels_buffer = (char*)malloc(kernels_size + 1);
+    check_memory((void*) kernels_buffer);
+    kernels_size = fread(kernels_buffer, sizeof(char), kernels_size, kernels_file);
     kernels_buffer[kernels_size] = '\0';
-    fread(kernels_buffer, sizeof(char), kernels_size, kernels_file);
     fclose(kernels_file);
     return kernels_buffer;
 }
 
-/* compile kernels */
-void init_opencl(struct opencl_s* opencl)
+/* first GPU of any platform, else first device of any type */
+static bool select_device(struct opencl_s* opencl)
 {
+    cl_platform_id platforms[OCL_MAX_PLATFORMS];
+    cl_uint n_platforms = 0;
+    if (clGetPlatformIDs(OCL_MAX_PLATFORMS, platforms, &n_platforms) != CL_SUCCESS) return false;
+    if (n_platforms > OCL_MAX_PLATFORMS) n_platforms = OCL_MAX_PLATFORMS;
+    const cl_device_type types[] = {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL};
+    for(int t = 0; t < 2; t++) {
+        for(cl_uint p = 0; p < n_platforms; p++) {
+            if (clGetDeviceIDs(platforms[p], types[t], 1, &opencl->device, NULL) == CL_SUCCESS) {
+                opencl->platform = platforms[p];
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* does the device support doubles */
+static bool device_fp64(cl_device_id device)
+{
+    size_t size = 0;
+    clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, NULL, &size);
+    char* extensions = malloc(size + 1);
+    check_memory((void*) extensions);
+    extensions[0] = '\0';
+    clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, size, extensions, NULL);
+    extensions[size] = '\0';
+    bool fp64 = strstr(extensions, "cl_khr_fp64") != NULL;
+    free(extensions);
+    return fp64;
+}
+
+/* the kernel, or NULL if the device can not run it */
+static cl_kernel create_kernel(struct opencl_s* opencl, enum opencl_kernel k)
+{
+    if (k == OCL_GEMM_F64 && !opencl->fp64) return NULL;
     cl_int err = 0;
-    err = clGetPlatformIDs(1, &opencl->platform, NULL);
-    if (err) opencl_err_hander(err);
-    err = clGetDeviceIDs(opencl->platform, CL_DEVICE_TYPE_GPU, 1, &opencl->device, NULL);
+    cl_kernel kernel = clCreateKernel(opencl->program, kernel_names[k], &err);
     if (err) opencl_err_hander(err);
-    // TODO : check GPU + double support here
+    // The GEMM work-groups are TS x RTS.
+    size_t max_size = 0;
+    clGetKernelWorkGroupInfo(kernel, opencl->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL);
+    if (max_size < OCL_GEMM_TS * OCL_GEMM_TS / OCL_GEMM_WPT) {
+        clReleaseKernel(kernel);
+        return NULL;
+    }
+    return kernel;
+}
+
+/* create the context and queue, and compile all the kernels */
+static bool init_opencl(struct opencl_s* opencl)
+{
+    cl_int err = 0;
+    if (!select_device(opencl)) return false;
+    opencl->fp64 = device_fp64(opencl->device);
     opencl->context = clCreateContext(NULL, 1, &opencl->device, NULL, NULL, &err);
     if (err) opencl_err_hander(err);
     opencl->queue = clCreateCommandQueue(opencl->context, opencl->device, 0, &err);
     if (err) opencl_err_hander(err);
+    opencl->transfer = clCreateCommandQueue(opencl->context, opencl->device, 0, &err);
+    if (err) opencl_err_hander(err);
+    clGetDeviceInfo(opencl->device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &opencl->mem_size, NULL);
+    clGetDeviceInfo(opencl->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &opencl->max_alloc, NULL);
     char *kernelSource = kernel_read();
+    if (kernelSource == NULL) {
+        clReleaseCommandQueue(opencl->transfer);
+        clReleaseCommandQueue(opencl->queue);
+        clReleaseContext(opencl->context);
+        return false;
+    }
     opencl->program = clCreateProgramWithSource(opencl->context, 1, (const char **) &kernelSource, NULL, &err);
     if (err) opencl_err_hander(err);
     free(kernelSource);
-    //"-I/opt/homebrew/Cellar/llvm/19.1.3/lib/clang/19/include -I.."
-    err = clBuildProgram(opencl->program, 1, &opencl->device, NULL, NULL, NULL);
-    if (err) debug_opencl(opencl);
-    opencl->kernel = clCreateKernel(opencl->program, "matmult", &err); // TODO compile all the kernels
-    if (err) opencl_err_hander(err);
+    const char* options = opencl->fp64 ? "-D LINALG_FP64" : "";
+    err = clBuildProgram(opencl->program, 1, &opencl->device, options, NULL, NULL);
+    if (err) {
+        debug_opencl(opencl);
+        clReleaseProgram(opencl->program);
+        clReleaseCommandQueue(opencl->transfer);
+        clReleaseCommandQueue(opencl->queue);
+        clReleaseContext(opencl->context);
+        return false;
+    }
+    for(int k = 0; k < OCL_N_KERNELS; k++) {
+        opencl->kernels[k] = create_kernel(opencl, k);
+    }
+    opencl->n_pooled = 0;
+    return true;
 }
 
-// updage kernel input
-void kernel_inputs_update(struct opencl_s* opencl, struct params* params) {
-    clSetKernelArg(opencl->kernel, 0, sizeof(cl_mem), &params->m_out);
-    clSetKernelArg(opencl->kernel, 1, sizeof(cl_mem), &params->m_right);
-    clSetKernelArg(opencl->kernel, 2, sizeof(cl_mem), &params->m_left);
+/* free allocated mem */
+static void kernel_free(struct opencl_s* opencl)
+{
+    for(int i = 0; i < opencl->n_pooled; i++) {
+        clReleaseMemObject(opencl->pool[i]);
+    }
+    opencl->n_pooled = 0;
+    for(int k = 0; k < OCL_N_KERNELS; k++) {
+        if (opencl->kernels[k] != NULL) clReleaseKernel(opencl->kernels[k]);
+    }
+    clReleaseCommandQueue(opencl->transfer);
+    clReleaseCommandQueue(opencl->queue);
+    clReleaseProgram(opencl->program);
+    clReleaseContext(opencl->context);
+}
+
+bool opencl_init(void)
+{
+    pthread_mutex_lock(&runtime_lock);
+    if (runtime_state == OCL_UNINITIALIZED) {
+        runtime_state = init_opencl(&runtime) ? OCL_READY : OCL_UNAVAILABLE;
+    }
+    bool ready = runtime_state == OCL_READY;
+    pthread_mutex_unlock(&runtime_lock);
+    return ready;
+}
+
+void opencl_shutdown(void)
+{
+    pthread_mutex_lock(&runtime_lock);
+    if (runtime_state == OCL_READY) {
+        clFinish(runtime.queue);
+        clFinish(runtime.transfer);
+        kernel_free(&runtime);
+    }
+    runtime_state = OCL_UNINITIALIZED;
+    pthread_mutex_unlock(&runtime_lock);
+}
+
+/* the runtime, NULL when there is no device */
+struct opencl_s* opencl_runtime(void)
+{
+    return opencl_init() ? &runtime : NULL;
 }
 
-/* kernel memory init. */
-void kernel_init(struct opencl_s* opencl, struct params* params)
+void opencl_lock(void)
 {
+    pthread_mutex_lock(&runtime_lock);
+}
+
+void opencl_unlock(void)
+{
+    pthread_mutex_unlock(&runtime_lock);
+}
+
+/* A buffer of at least size bytes, with the lock held: the smallest pooled
+   one if it is not more than twice as large, else a new one.
+*/
+cl_mem opencl_buffer_acquire(size_t size)
+{
+    int best = -1;
+    for(int i = 0; i < runtime.n_pooled; i++) {
+        if (size <= runtime.pool_size[i] && runtime.pool_size[i] <= 2 * size
+            && (best < 0 || runtime.pool_size[i] < runtime.pool_size[best])) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        cl_mem buffer = runtime.pool[best];
+        runtime.n_pooled--;
+        runtime.pool[best] = runtime.pool[runtime.n_pooled];
+        runtime.pool_size[best] = runtime.pool_size[runtime.n_pooled];
+        return buffer;
+    }
     cl_int err = 0;
-    params->m_out   = clCreateBuffer(opencl->context, CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR, params->m_out_size * sizeof(double), NULL, &err);
+    cl_mem buffer = clCreateBuffer(runtime.context, CL_MEM_READ_WRITE, size, NULL, &err);
+    if (err == CL_MEM_OBJECT_ALLOCATION_FAILURE && runtime.n_pooled > 0) {
+        // Device memory held by the pool, give it back and try again.
+        for(int i = 0; i < runtime.n_pooled; i++) {
+            clReleaseMemObject(runtime.pool[i]);
+        }
+        runtime.n_pooled = 0;
+        buffer = clCreateBuffer(runtime.context, CL_MEM_READ_WRITE, size, NULL, &err);
+    }
     if (err) opencl_err_hander(err);
-    params->m_right = clCreateBuffer(opencl->context, CL_MEM_READ_ONLY  | CL_MEM_COPY_HOST_PTR,  params->m_right_size * sizeof(double), NULL, &err);
+    return buffer;
+}
+
+/* Return a buffer to the pool, with the lock held.  When the pool is full,
+   the smallest of its buffers and this one is released.
+*/
+void opencl_buffer_release(cl_mem buffer)
+{
+    size_t size = 0;
+    clGetMemObjectInfo(buffer, CL_MEM_SIZE, sizeof(size), &size, NULL);
+    if (runtime.n_pooled == OCL_POOL_SIZE) {
+        int smallest = 0;
+        for(int i = 1; i < runtime.n_pooled; i++) {
+            if (runtime.pool_size[i] < runtime.pool_size[smallest]) smallest = i;
+        }
+        if (size <= runtime.pool_size[smallest]) {
+            clReleaseMemObject(buffer);
+            return;
+        }
+        clReleaseMemObject(runtime.pool[smallest]);
+        runtime.pool[smallest] = buffer;
+        runtime.pool_size[smallest] = size;
+        return;
+    }
+    runtime.pool[runtime.n_pooled] = buffer;
+    runtime.pool_size[runtime.n_pooled] = size;
+    runtime.n_pooled++;
+}
+
+/* add e to a wait list, if there is an event */
+static cl_uint wait_for(cl_event* list, cl_uint n, cl_event e)
+{
+    if (e != NULL) list[n++] = e;
+    return n;
+}
+
+/* C = A B + beta C on device buffers, on the compute queue, with the lock held */
+static void enqueue_gemm(cl_kernel kernel, int M, int N, int K, cl_mem A, cl_mem B, cl_mem C,
+                         const void* beta, size_t real_size,
+                         cl_uint n_wait, const cl_event* wait, cl_event* event)
+{
+    clSetKernelArg(kernel, 0, sizeof(int), &M);
+    clSetKernelArg(kernel, 1, sizeof(int), &N);
+    clSetKernelArg(kernel, 2, sizeof(int), &K);
+    clSetKernelArg(kernel, 3, sizeof(cl_mem), &A);
+    clSetKernelArg(kernel, 4, sizeof(cl_mem), &B);
+    clSetKernelArg(kernel, 5, sizeof(cl_mem), &C);
+    clSetKernelArg(kernel, 6, real_size, beta);
+    // One work-item per column and WPT rows of C, in TS x TS tiles.
+    const size_t ts = OCL_GEMM_TS, rts = OCL_GEMM_TS / OCL_GEMM_WPT;
+    size_t local[2] = {ts, rts};
+    size_t global[2] = {(N + ts - 1) / ts * ts, (M + ts - 1) / ts * rts};
+    cl_int err = clEnqueueNDRangeKernel(runtime.queue, kernel, 2, NULL, global, local,
+                                        n_wait, n_wait ? wait : NULL, event);
     if (err) opencl_err_hander(err);
-    params->m_left  = clCreateBuffer(opencl->context, CL_MEM_READ_ONLY  | CL_MEM_COPY_HOST_PTR,  params->m_left_size * sizeof(double), NULL, &err);
+}
+
+/* upload, run, read back */
+static bool gemm(enum opencl_kernel k, int M, int N, int K, const void* A, const void* B, void* C,
+                 size_t real_size)
+{
+    assert(M > 0 && N > 0 && K > 0);
+    if (!opencl_init()) return false;
+    opencl_lock();
+    cl_kernel kernel = runtime.kernels[k];
+    if (kernel == NULL) {
+        opencl_unlock();
+        return false;
+    }
+    size_t a_size = real_size * M * K;
+    size_t b_size = real_size * K * N;
+    size_t c_size = real_size * M * N;
+    cl_mem m_a = opencl_buffer_acquire(a_size);
+    cl_mem m_b = opencl_buffer_acquire(b_size);
+    cl_mem m_c = opencl_buffer_acquire(c_size);
+    cl_int err = clEnqueueWriteBuffer(runtime.queue, m_a, CL_FALSE, 0, a_size, A, 0, NULL, NULL);
+    if (err) opencl_err_hander(err);
+    err = clEnqueueWriteBuffer(runtime.queue, m_b, CL_FALSE, 0, b_size, B, 0, NULL, NULL);
     if (err) opencl_err_hander(err);
-    kernel_inputs_update(opencl, params);
+    double zero_f64 = 0;
+    float zero_f32 = 0;
+    enqueue_gemm(kernel, M, N, K, m_a, m_b, m_c,
+                 (real_size == sizeof(double)) ? (void*) &zero_f64 : (void*) &zero_f32, real_size,
+                 0, NULL, NULL);
+    err = clEnqueueReadBuffer(runtime.queue, m_c, CL_TRUE, 0, c_size, C, 0, NULL, NULL);
+    if (err) opencl_err_hander(err);
+    opencl_buffer_release(m_a);
+    opencl_buffer_release(m_b);
+    opencl_buffer_release(m_c);
+    opencl_unlock();
+    return true;
 }
 
-/* (simple) call to GPU kernel (update input, queue, run, read back) */
-void kernel_run(struct opencl_s* opencl, struct params* params)
+bool opencl_gemm_f64(int M, int N, int K, const double* A, const double* B, double* C)
 {
-    clEnqueueNDRangeKernel(opencl->queue, opencl->kernel, params->m_dim, NULL, params->m_work, NULL, 0, NULL, NULL);
-    clFinish(opencl->queue);
-    clEnqueueReadBuffer(opencl->queue, params->m_out, CL_TRUE, 0, params->m_out_size * sizeof(double), params->m_out_ptr, 0, NULL, NULL);
+    return gemm(OCL_GEMM_F64, M, N, K, A, B, C, sizeof(double));
 }
 
-/* free allocated mem */
-void kernel_free(struct opencl_s* opencl)
+bool opencl_gemm_f32(int M, int N, int K, const float* A, const float* B, float* C)
 {
-    clReleaseKernel(opencl->kernel);
-    clReleaseCommandQueue(opencl->queue);
-    clReleaseProgram(opencl->program);
-    clReleaseContext(opencl->context);
+    return gemm(OCL_GEMM_F32, M, N, K, A, B, C, sizeof(float));
 }
 
 void matrix_multiply_ocl(struct matrix* Mprod, struct matrix* Mleft, struct matrix* Mright)
 {
-    struct opencl_s opencl;
-    struct params params;
-    init_opencl(&opencl); // opencl init
+    // Products of matrices on the device stay there.
+    if (Mleft->device != NULL || Mright->device != NULL) {
+        matrix_multiply_device_into(Mprod, Mleft, Mright);
+        return;
+    }
+    matrix_multiply_streamed_into(Mprod, Mleft, Mright, 0);
+}
+
+/* the f64 GEMM kernel with the lock held, or NULL (and the lock not held) */
+static cl_kernel lock_gemm_f64(void)
+{
+    cl_kernel kernel = NULL;
+    if (opencl_init()) {
+        opencl_lock();
+        kernel = runtime.kernels[OCL_GEMM_F64];
+        if (kernel == NULL) opencl_unlock();
+    }
+    return kernel;
+}
 
-    params.m_out_ptr    = Mprod->la_obj.data;
-    params.m_out_size   = Mprod->n_col * Mprod->n_row ;
-    params.m_left_size  = Mleft->n_col * Mleft->n_row ;
-    params.m_right_size = Mright->n_col * Mright->n_row ;
+/***********************
+ * Futures
+ ***********************/
 
-    params.m_dim = 3;
-    params.m_work[0] = Mprod->n_row;
-    params.m_work[1] = Mleft->n_row;
-    params.m_work[2] = Mprod->n_col;
+/* a future of the given event (NULL for work already done) */
+static struct opencl_future* future_new(cl_event event)
+{
+    struct opencl_future* f = malloc(sizeof(struct opencl_future));
+    check_memory((void*) f);
+    f->event = event;
+    f->synced = NULL;
+    f->n_buffers = 0;
+    return f;
+}
 
-    kernel_init(&opencl, &params); // memory init
-    kernel_run(&opencl, &params);  // loop i,j here
-    kernel_free(&opencl);          // free mem
+bool opencl_future_done(struct opencl_future* f)
+{
+    if (f->event == NULL) return true;
+    cl_int status = 0;
+    cl_int err = clGetEventInfo(f->event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+    if (err) opencl_err_hander(err);
+    return status == CL_COMPLETE;
+}
+
+void opencl_future_wait(struct opencl_future* f)
+{
+    if (f->event == NULL) return;
+    cl_int err = clWaitForEvents(1, &f->event);
+    if (err) opencl_err_hander(err);
+    opencl_lock();
+    clReleaseEvent(f->event);
+    f->event = NULL;
+    for(int i = 0; i < f->n_buffers; i++) {
+        opencl_buffer_release(f->buffers[i]);
+    }
+    f->n_buffers = 0;
+    if (f->synced != NULL) f->synced->device->host_valid = true;
+    opencl_unlock();
+}
+
+void opencl_future_free(struct opencl_future* f)
+{
+    opencl_future_wait(f);
+    free(f);
+}
+
+/***********************
+ * Device resident matrices
+ ***********************/
+
+/* the device copy of M, created out of date, with the lock held */
+static struct device_copy* device_copy(struct matrix* M)
+{
+    if (M->device == NULL) {
+        M->device = malloc(sizeof(struct device_copy));
+        check_memory((void*) M->device);
+        M->device->buffer = opencl_buffer_acquire(sizeof(double) * M->n_row * M->n_col);
+        M->device->event = NULL;
+        M->device->host_valid = true;
+        M->device->device_valid = false;
+    }
+    return M->device;
+}
+
+/* replace the last command on a device copy */
+static void set_event(struct device_copy* copy, cl_event event)
+{
+    if (copy->event != NULL) clReleaseEvent(copy->event);
+    copy->event = event;
+}
+
+/* upload M if its device copy is out of date, with the lock held */
+static void upload(struct matrix* M, cl_bool blocking)
+{
+    struct device_copy* copy = device_copy(M);
+    if (!copy->device_valid) {
+        size_t size = sizeof(double) * M->n_row * M->n_col;
+        cl_event wait[1], event = NULL;
+        cl_uint n_wait = wait_for(wait, 0, copy->event);
+        cl_int err = clEnqueueWriteBuffer(runtime.queue, copy->buffer, blocking, 0, size, DATA(M),
+                                          n_wait, n_wait ? wait : NULL, blocking ? NULL : &event);
+        if (err) opencl_err_hander(err);
+        set_event(copy, event);
+        copy->device_valid = true;
+    }
+}
+
+bool matrix_to_device(struct matrix* M)
+{
+    if (!opencl_init()) return false;
+    opencl_lock();
+    upload(M, CL_TRUE);
+    opencl_unlock();
+    return true;
+}
+
+void matrix_to_host(struct matrix* M)
+{
+    if (M->device == NULL || M->device->host_valid) return;
+    opencl_lock();
+    size_t size = sizeof(double) * M->n_row * M->n_col;
+    cl_event wait[1];
+    cl_uint n_wait = wait_for(wait, 0, M->device->event);
+    cl_int err = clEnqueueReadBuffer(runtime.queue, M->device->buffer, CL_TRUE, 0, size, DATA(M),
+                                     n_wait, n_wait ? wait : NULL, NULL);
+    if (err) opencl_err_hander(err);
+    set_event(M->device, NULL);
+    M->device->host_valid = true;
+    opencl_unlock();
+}
+
+struct opencl_future* matrix_to_host_async(struct matrix* M)
+{
+    if (M->device == NULL || M->device->host_valid) return future_new(NULL);
+    opencl_lock();
+    size_t size = sizeof(double) * M->n_row * M->n_col;
+    cl_event wait[1], event;
+    cl_uint n_wait = wait_for(wait, 0, M->device->event);
+    cl_int err = clEnqueueReadBuffer(runtime.transfer, M->device->buffer, CL_FALSE, 0, size, DATA(M),
+                                     n_wait, n_wait ? wait : NULL, &event);
+    if (err) opencl_err_hander(err);
+    clFlush(runtime.transfer);
+    clRetainEvent(event);
+    set_event(M->device, event);
+    opencl_unlock();
+    struct opencl_future* f = future_new(event);
+    f->synced = M;
+    return f;
+}
+
+void matrix_host_changed(struct matrix* M)
+{
+    if (M->device != NULL) {
+        M->device->host_valid = true;
+        M->device->device_valid = false;
+    }
+}
+
+void matrix_device_free(struct matrix* M)
+{
+    if (M->device == NULL) return;
+    if (M->device->event != NULL) {
+        clWaitForEvents(1, &M->device->event);
+        clReleaseEvent(M->device->event);
+    }
+    opencl_lock();
+    if (runtime_state == OCL_READY) {
+        opencl_buffer_release(M->device->buffer);
+    } else {
+        clReleaseMemObject(M->device->buffer);
+    }
+    opencl_unlock();
+    free(M->device);
+    M->device = NULL;
+}
+
+/* enqueue the product of matrices on the device, with the lock held */
+static cl_event enqueue_device_product(cl_kernel kernel, struct matrix* reciever,
+                                       struct matrix* Mleft, struct matrix* Mright, cl_bool blocking)
+{
+    upload(Mleft, blocking);
+    upload(Mright, blocking);
+    struct device_copy* copy = device_copy(reciever);
+    cl_event wait[3], event;
+    cl_uint n_wait = wait_for(wait, 0, Mleft->device->event);
+    n_wait = wait_for(wait, n_wait, Mright->device->event);
+    n_wait = wait_for(wait, n_wait, copy->event);
+    double zero = 0;
+    enqueue_gemm(kernel, reciever->n_row, reciever->n_col, Mleft->n_col,
+                 Mleft->device->buffer, Mright->device->buffer, copy->buffer, &zero, sizeof(double),
+                 n_wait, wait, &event);
+    clFlush(runtime.queue);
+    set_event(copy, event);
+    copy->device_valid = true;
+    copy->host_valid = false;
+    return event;
+}
+
+/* without a device, on the host */
+static void host_product(struct matrix* reciever, struct matrix* Mleft, struct matrix* Mright)
+{
+    matrix_to_host(Mleft);
+    matrix_to_host(Mright);
+    matrix_multiply_into(reciever, Mleft, Mright);
+    matrix_host_changed(reciever);
+}
+
+void matrix_multiply_device_into(struct matrix* reciever,
+                                 struct matrix* Mleft, struct matrix* Mright)
+{
+    assert(Mleft->n_col == Mright->n_row);
+    assert(reciever->n_row == Mleft->n_row && reciever->n_col == Mright->n_col);
+    assert(reciever != Mleft && reciever != Mright);
+    cl_kernel kernel = lock_gemm_f64();
+    if (kernel == NULL) {
+        host_product(reciever, Mleft, Mright);
+        return;
+    }
+    enqueue_device_product(kernel, reciever, Mleft, Mright, CL_TRUE);
+    opencl_unlock();
+}
+
+struct opencl_future* matrix_multiply_device_async(struct matrix* reciever,
+                                                   struct matrix* Mleft, struct matrix* Mright)
+{
+    assert(Mleft->n_col == Mright->n_row);
+    assert(reciever->n_row == Mleft->n_row && reciever->n_col == Mright->n_col);
+    assert(reciever != Mleft && reciever != Mright);
+    cl_kernel kernel = lock_gemm_f64();
+    if (kernel == NULL) {
+        host_product(reciever, Mleft, Mright);
+        return future_new(NULL);
+    }
+    cl_event event = enqueue_device_product(kernel, reciever, Mleft, Mright, CL_FALSE);
+    clRetainEvent(event);
+    opencl_unlock();
+    return future_new(event);
+}
+
+/***********************
+ * Streamed products
+ ***********************/
+
+/* Rows of the panels of a streamed product with K x N right operand, or 0
+   when that operand does not fit on the device: half the device memory is
+   used, that operand and two panels each of the left operand and of the
+   product.
+*/
+static int streamed_panel_rows(int M, int K, int N)
+{
+    size_t b_size = sizeof(double) * K * N;
+    size_t budget = runtime.mem_size / 2;
+    if (b_size > runtime.max_alloc || b_size >= budget) return 0;
+    size_t rows = (budget - b_size) / (2 * sizeof(double) * (K + N));
+    size_t max_rows = runtime.max_alloc / (sizeof(double) * (K > N ? K : N));
+    if (rows > max_rows) rows = max_rows;
+    if (rows > (size_t) M) return M;
+    if (rows > OCL_GEMM_TS) rows -= rows % OCL_GEMM_TS;
+    return (int) rows;
+}
+
+/* Write panel p of the left operand into the slot's buffer, after the
+   kernel that last read that buffer.
+*/
+static cl_event upload_panel(struct matrix* Mleft, cl_mem buffer, int p, int panel_rows,
+                             cl_event kernel_done)
+{
+    int row = p * panel_rows;
+    int n_rows = (Mleft->n_row - row < panel_rows) ? Mleft->n_row - row : panel_rows;
+    cl_event wait[1], event;
+    cl_uint n_wait = wait_for(wait, 0, kernel_done);
+    cl_int err = clEnqueueWriteBuffer(runtime.transfer, buffer, CL_FALSE, 0,
+                                      sizeof(double) * n_rows * Mleft->n_col,
+                                      DATA(Mleft) + (size_t) row * Mleft->n_col,
+                                      n_wait, n_wait ? wait : NULL, &event);
+    if (err) opencl_err_hander(err);
+    return event;
+}
+
+static void release_events(cl_event* events, int n)
+{
+    for(int i = 0; i < n; i++) {
+        if (events[i] != NULL) clReleaseEvent(events[i]);
+        events[i] = NULL;
+    }
+}
+
+struct opencl_future* matrix_multiply_streamed_async(struct matrix* reciever,
+                                                     struct matrix* Mleft, struct matrix* Mright,
+                                                     int panel_rows)
+{
+    assert(Mleft->n_col == Mright->n_row);
+    assert(reciever->n_row == Mleft->n_row && reciever->n_col == Mright->n_col);
+    assert(reciever != Mleft && reciever != Mright);
+    matrix_to_host(Mleft);
+    matrix_to_host(Mright);
+    matrix_host_changed(reciever);
+    int M = Mleft->n_row, K = Mleft->n_col, N = Mright->n_col;
+    cl_kernel kernel = lock_gemm_f64();
+    if (kernel != NULL && panel_rows <= 0) {
+        panel_rows = streamed_panel_rows(M, K, N);
+    }
+    if (kernel == NULL || panel_rows <= 0) {
+        if (kernel != NULL) opencl_unlock();
+        matrix_multiply_into(reciever, Mleft, Mright);
+        return future_new(NULL);
+    }
+    if (panel_rows > M) panel_rows = M;
+    int n_panels = (M + panel_rows - 1) / panel_rows;
+    int n_slots = (n_panels > 1) ? 2 : 1;
+
+    struct opencl_future* f = future_new(NULL);
+    cl_mem m_b = opencl_buffer_acquire(sizeof(double) * K * N);
+    cl_mem m_a[2], m_c[2];
+    f->buffers[f->n_buffers++] = m_b;
+    for(int s = 0; s < n_slots; s++) {
+        m_a[s] = opencl_buffer_acquire(sizeof(double) * panel_rows * K);
+        m_c[s] = opencl_buffer_acquire(sizeof(double) * panel_rows * N);
+        f->buffers[f->n_buffers++] = m_a[s];
+        f->buffers[f->n_buffers++] = m_c[s];
+    }
+
+    // Transfers on their own queue, the uploads one panel ahead of the
+    // kernels, so they overlap.
+    cl_event b_ready;
+    cl_int err = clEnqueueWriteBuffer(runtime.transfer, m_b, CL_FALSE, 0, sizeof(double) * K * N,
+                                      DATA(Mright), 0, NULL, &b_ready);
+    if (err) opencl_err_hander(err);
+    cl_event uploaded[2] = {NULL, NULL}, computed[2] = {NULL, NULL}, read[2] = {NULL, NULL};
+    uploaded[0] = upload_panel(Mleft, m_a[0], 0, panel_rows, NULL);
+    double zero = 0;
+    for(int p = 0; p < n_panels; p++) {
+        int s = p % n_slots;
+        int row = p * panel_rows;
+        int n_rows = (M - row < panel_rows) ? M - row : panel_rows;
+        // After the panel's upload, and the read of the product panel last
+        // in the slot.
+        cl_event wait[3];
+        cl_uint n_wait = wait_for(wait, 0, uploaded[s]);
+        n_wait = wait_for(wait, n_wait, b_ready);
+        n_wait = wait_for(wait, n_wait, read[s]);
+        release_events(&computed[s], 1);
+        enqueue_gemm(kernel, n_rows, N, K, m_a[s], m_b, m_c[s], &zero, sizeof(double),
+                     n_wait, wait, &computed[s]);
+        clFlush(runtime.queue);
+        if (p + 1 < n_panels) {
+            int t = (p + 1) % n_slots;
+            cl_event event = upload_panel(Mleft, m_a[t], p + 1, panel_rows, computed[t]);
+            release_events(&uploaded[t], 1);
+            uploaded[t] = event;
+        }
+        release_events(&read[s], 1);
+        err = clEnqueueReadBuffer(runtime.transfer, m_c[s], CL_FALSE, 0,
+                                  sizeof(double) * n_rows * N, DATA(reciever) + (size_t) row * N,
+                                  1, &computed[s], &read[s]);
+        if (err) opencl_err_hander(err);
+        clFlush(runtime.transfer);
+    }
+    // The transfer queue is in order: its last read completes the product.
+    f->event = read[(n_panels - 1) % n_slots];
+    read[(n_panels - 1) % n_slots] = NULL;
+    release_events(&b_ready, 1);
+    release_events(uploaded, 2);
+    release_events(computed, 2);
+    release_events(read, 2);
+    opencl_unlock();
+    return f;
+}
+
+void matrix_multiply_streamed_into(struct matrix* reciever,
+                                   struct matrix* Mleft, struct matrix* Mright, int panel_rows)
+{
+    opencl_future_free(matrix_multiply_streamed_async(reciever, Mleft, Mright, panel_rows));
 }
 
 /* example */
 void kernel_test(void)
 {
-    struct opencl_s opencl;
-    init_opencl(&opencl); // opencl init
-    kernel_free(&opencl); // free mem
+    if (!opencl_init()) {
+        printf("No OpenCL device, running on the host.\n");
+        return;
+    }
+    char name[256];
+    clGetDeviceInfo(runtime.device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    name[sizeof(name) - 1] = '\0';
+    printf("OpenCL device: %s (%s precision)\n", name, runtime.fp64 ? "double" : "single");
 }
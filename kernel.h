@@ -1,6 +1,7 @@
-/* kernels.c
+/* kernel.h
   (c) A. Rigaud, 2024
 */
+#pragma once
 
 #ifdef __APPLE__
 #include <OpenCL/opencl.h>
@@ -9,29 +10,162 @@
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "matrix.h"
 
-void kernel_test(void);
-void matrix_multiply_ocl(struct matrix* Mprod, struct matrix* Mleft, struct matrix* Mright);
+/* The OpenCL runtime of the process.
+
+   The platform, device, context, queue and program are set up once, by the
+   first call of opencl_init (which every OpenCL operation makes), and all
+   the kernels of kernels.cl are built then.  A GPU is preferred, any other
+   device is used otherwise.  kernels.cl is read from the path in the
+   LINALG_KERNELS environment variable, else from kernels.cl or
+   ../kernels.cl.  opencl_init returns false when there is no usable device,
+   and the operations then run on the host.
+
+   Device buffers are not released after use but kept in a pool, and handed
+   out again for requests of at most their size.
+
+   Kernels and uploads of device resident matrices run on an in-order
+   compute queue, and the transfers of streamed products and asynchronous
+   reads on a second queue, so that they overlap the kernels.
+
+   The runtime is shared by all threads: the calls that enqueue work hold
+   its lock (opencl_lock) while they do.  opencl_shutdown releases
+   everything, and a later call of opencl_init sets the runtime up again.
+*/
+enum opencl_kernel {
+    OCL_GEMM_F64,
+    OCL_GEMM_F32,
+    OCL_N_KERNELS
+};
+
+// The tiles of the GEMM kernels, as in kernels.cl.
+#define OCL_GEMM_TS 32
+#define OCL_GEMM_WPT 4
+
+#define OCL_POOL_SIZE 16
 
 struct opencl_s {
-    cl_kernel        kernel;
+    cl_platform_id   platform;
+    cl_device_id     device;
     cl_context       context;
     cl_command_queue queue;
+    cl_command_queue transfer;
     cl_program       program;
-    cl_platform_id   platform;
-    cl_device_id     device;
+    bool             fp64;
+    cl_ulong         mem_size;
+    cl_ulong         max_alloc;
+    // NULL for the kernels the device can not run.
+    cl_kernel        kernels[OCL_N_KERNELS];
+    // Free buffers, and their sizes.
+    cl_mem           pool[OCL_POOL_SIZE];
+    size_t           pool_size[OCL_POOL_SIZE];
+    int              n_pooled;
+};
+
+bool             opencl_init(void);
+void             opencl_shutdown(void);
+struct opencl_s* opencl_runtime(void);
+void             opencl_lock(void);
+void             opencl_unlock(void);
+
+cl_mem opencl_buffer_acquire(size_t size);
+void   opencl_buffer_release(cl_mem buffer);
+
+void opencl_err_hander(cl_int err);
+
+/* C = A B for row-major M x K and K x N arrays A and B, on the device.
+   Without a device (or, for doubles, without fp64 support), false is
+   returned and C is unchanged.
+*/
+bool opencl_gemm_f64(int M, int N, int K, const double* A, const double* B, double* C);
+bool opencl_gemm_f32(int M, int N, int K, const float* A, const float* B, float* C);
+
+/* Device resident matrices.
+
+   A matrix may own a copy of its data in a device buffer (M->device), with
+   flags telling which of the host and device copies are current.  Data
+   moves only when the side that is not current is needed: matrix_to_device
+   uploads the host data if the device copy is out of date, matrix_to_host
+   downloads the device data if the host copy is.
+
+   matrix_multiply_device_into leaves its product on the device only, with
+   the host copy out of date, and uploads the operands that are not
+   already there.  matrix_multiply of operands of which one is on the device
+   does the same, so chains of products stay on the device, and their
+   intermediates are never copied back.
+
+   The host functions of the library only see the host copy: call
+   matrix_to_host before reading a product from the host (or taking views
+   of it), and matrix_host_changed after writing the host data of a matrix
+   with a device copy.  matrix_free releases the device copy;
+   matrix_device_free releases it without updating the host copy.  Free the
+   device copies before opencl_shutdown.
+*/
+struct device_copy {
+    cl_mem   buffer;
+    // The last command on the buffer that later ones must wait for, or NULL.
+    cl_event event;
+    bool     host_valid;
+    bool     device_valid;
 };
 
-#define OCL_MAX_DIM 4
-struct params {
-    cl_mem m_out;
-    double* m_out_ptr;
-    cl_mem m_left;
-    cl_mem m_right;
-    size_t m_out_size;
-    size_t m_left_size;
-    size_t m_right_size;
-    size_t m_dim;
-    size_t m_work[OCL_MAX_DIM];
+bool matrix_to_device(struct matrix* M);
+void matrix_to_host(struct matrix* M);
+void matrix_host_changed(struct matrix* M);
+void matrix_device_free(struct matrix* M);
+void matrix_multiply_device_into(struct matrix* reciever,
+                                 struct matrix* Mleft, struct matrix* Mright);
+
+/* Asynchronous operations.
+
+   The _async functions enqueue their work and return at once, with a
+   future: opencl_future_done tells whether the work is complete,
+   opencl_future_wait waits for it, and opencl_future_free waits and frees
+   the future.  The operands must not be changed or freed before then, nor
+   the host data of the result read.  Successive operations on the same
+   matrices are ordered by OpenCL events, so a product can be enqueued on
+   the result of another before it is complete.  Without a device, the work
+   is done at once, and the future is already complete.
+
+   matrix_multiply_device_async is matrix_multiply_device_into, and
+   matrix_to_host_async reads back the device copy of M on the transfer
+   queue.
+
+   matrix_multiply_streamed_async computes a product of host matrices in
+   panels of panel_rows rows of the left operand and of the product, through
+   two buffers of each: the upload of a panel and the read back of the
+   previous one overlap the kernel of the current one.  Only the right
+   operand and four panels are on the device at once, so products larger
+   than its memory can be computed, as long as the right operand takes at
+   most half of it.  With panel_rows zero, the panels are as large as fit in
+   half the device memory (and otherwise the product is computed on the
+   host).  matrix_multiply of host matrices calls it with panel_rows zero.
+*/
+#define OCL_FUTURE_MAX_BUFFERS 5
+
+struct opencl_future {
+    cl_event       event;
+    // A matrix whose host copy is current on completion, or NULL.
+    struct matrix* synced;
+    // Buffers returned to the pool on completion.
+    cl_mem         buffers[OCL_FUTURE_MAX_BUFFERS];
+    int            n_buffers;
 };
+
+bool opencl_future_done(struct opencl_future* f);
+void opencl_future_wait(struct opencl_future* f);
+void opencl_future_free(struct opencl_future* f);
+
+struct opencl_future* matrix_multiply_device_async(struct matrix* reciever,
+                                                   struct matrix* Mleft, struct matrix* Mright);
+struct opencl_future* matrix_to_host_async(struct matrix* M);
+struct opencl_future* matrix_multiply_streamed_async(struct matrix* reciever,
+                                                     struct matrix* Mleft, struct matrix* Mright,
+                                                     int panel_rows);
+void matrix_multiply_streamed_into(struct matrix* reciever,
+                                   struct matrix* Mleft, struct matrix* Mright, int panel_rows);
+
+void kernel_test(void);
+void matrix_multiply_ocl(struct matrix* Mprod, struct matrix* Mleft, struct matrix* Mright);
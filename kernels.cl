@@ -1,49 +1,81 @@
-//#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+/* kernels.cl
+  (c) A. Rigaud, 2024
 
+  OpenCL kernels.  Matrices are passed as raw row-major buffers, with their
+  dimensions.
+*/
 
-struct linalg_obj {
-    bool owns_memory;
-    struct linalg_obj* memory_owner;
-    int ref_count;
-    double* data;
-};
+/* General matrix products, C = A B + beta C, for an M x K matrix A and a
+   K x N matrix B (C is not read when beta is zero).
 
-#ifndef OWNS_MEMORY
-#define OWNS_MEMORY(object) (((struct linalg_obj*) object)->owns_memory)
-#endif
-
-#ifndef MEMORY_OWNER
-#define MEMORY_OWNER(object) (((struct linalg_obj*) object)->memory_owner)
-#endif
+   Each work-group computes a TS x TS tile of C, one work-item per column
+   of the tile and WPT rows of it, kept in registers.  The work-groups are
+   TS x RTS work-items, and step through K one TS x TS tile of A and of B at
+   a time, loaded into local memory by all their work-items together, WPT
+   entries each.  Loads and stores are in row order, so consecutive
+   work-items access consecutive addresses.  The NDRange is (N, M / WPT)
+   rounded up to whole work-groups, and the work-items off the edges of the
+   matrices load zeros and store nothing.
+*/
+#define TS 32
+#define WPT 4
+#define RTS (TS / WPT)
 
-#ifndef REF_COUNT
-#define REF_COUNT(object) (((struct linalg_obj*) object)->ref_count)
-#endif
-
-#ifndef DATA
-#define DATA(object) (((__global struct linalg_obj*) object)->data)
-#endif
+#define GEMM_KERNEL(NAME, REAL)                                                    \
+__kernel __attribute__((reqd_work_group_size(TS, RTS, 1)))                         \
+void NAME(const int M, const int N, const int K,                                   \
+          const __global REAL* A, const __global REAL* B, __global REAL* C,        \
+          const REAL beta)                                                         \
+{                                                                                  \
+    const int col = get_local_id(0);                                               \
+    const int row = get_local_id(1);                                               \
+    const int global_col = TS * get_group_id(0) + col;                             \
+    const int tile_row = TS * get_group_id(1);                                     \
+                                                                                   \
+    __local REAL A_tile[TS][TS];                                                   \
+    __local REAL B_tile[TS][TS];                                                   \
+                                                                                   \
+    REAL acc[WPT];                                                                 \
+    for(int w = 0; w < WPT; w++) {                                                 \
+        acc[w] = 0;                                                                \
+    }                                                                              \
+                                                                                   \
+    const int n_tiles = (K + TS - 1) / TS;                                         \
+    for(int t = 0; t < n_tiles; t++) {                                             \
+        const int k_col = TS * t + col;                                            \
+        for(int w = 0; w < WPT; w++) {                                             \
+            const int r = row + w * RTS;                                           \
+            const int a_row = tile_row + r;                                        \
+            const int b_row = TS * t + r;                                          \
+            A_tile[r][col] = (a_row < M && k_col < K) ? A[a_row * K + k_col] : 0;  \
+            B_tile[r][col] = (b_row < K && global_col < N) ?                       \
+                             B[b_row * N + global_col] : 0;                        \
+        }                                                                          \
+        barrier(CLK_LOCAL_MEM_FENCE);                                              \
+        for(int k = 0; k < TS; k++) {                                              \
+            const REAL b = B_tile[k][col];                                         \
+            for(int w = 0; w < WPT; w++) {                                         \
+                acc[w] += A_tile[row + w * RTS][k] * b;                            \
+            }                                                                      \
+        }                                                                          \
+        barrier(CLK_LOCAL_MEM_FENCE);                                              \
+    }                                                                              \
+                                                                                   \
+    if(global_col < N) {                                                           \
+        for(int w = 0; w < WPT; w++) {                                             \
+            const int c_row = tile_row + row + w * RTS;                            \
+            if(c_row < M) {                                                        \
+                const int idx = c_row * N + global_col;                            \
+                C[idx] = (beta == 0) ? acc[w] : acc[w] + beta * C[idx];            \
+            }                                                                      \
+        }                                                                          \
+    }                                                                              \
+}
 
-struct matrix {
-    struct linalg_obj la_obj;
-    int n_row;
-    int n_col;
-};
+GEMM_KERNEL(gemm_f32, float)
 
-#ifndef _MATRIX_MACROS
-#define _MATRIX_MACROS
-#define MATRIX_ROW(M, i) ((i) / (M->n_row))
-#define MATRIX_COL(M, i) ((i) % (M->n_row))
-#define MATRIX_IDX(M, r, c) (((r) * (M->n_col)) + (c))
-#define MATRIX_IDX_INTO(M, r, c) (DATA(M)[MATRIX_IDX(M, r, c)])
+/* Built with -D LINALG_FP64 when the device supports doubles. */
+#ifdef LINALG_FP64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+GEMM_KERNEL(gemm_f64, double)
 #endif
-
-
-__kernel void matmult(__global struct matrix* Mprod, __global struct matrix* Mleft, __global struct matrix* Mright)
-{
-    int i = get_global_id(0); // for int i loop (to Mprod->n_row)
-    int k = get_global_id(1); // for int k loop (to Mleft->n_row)
-    int j = get_global_id(2); // for int j loop (to Mprod->n_col)
-
-    MATRIX_IDX_INTO(Mprod, i, j) += MATRIX_IDX_INTO(Mleft, k, i) * MATRIX_IDX_INTO(Mright, k, j);
-}
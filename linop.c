@@ -0,0 +1,94 @@
+/* linop.c
+  (c) Alexis Rigaud, 2024
+
+  Linear operators given by a matrix vector product.
+*/
+#include <stdlib.h>
+#include <assert.h>
+#include "vector.h"
+#include "matrix.h"
+#include "util.h"
+#include "parallel.h"
+#include "linop.h"
+
+struct linop* linop_new(int n_row, int n_col,
+                        void (*apply)(void* ctx, const double* x, double* y),
+                        void (*apply_transpose)(void* ctx, const double* x, double* y),
+                        void* ctx) {
+    assert(n_row >= 1 && n_col >= 1);
+    assert(apply != NULL);
+    struct linop* A = malloc(sizeof(struct linop));
+    check_memory((void*) A);
+    A->n_row = n_row;
+    A->n_col = n_col;
+    A->apply = apply;
+    A->apply_transpose = apply_transpose;
+    A->ctx = ctx;
+    A->free_ctx = NULL;
+    return A;
+}
+
+void linop_free(struct linop* A) {
+    if(A->free_ctx != NULL) {
+        A->free_ctx(A->ctx);
+    }
+    free(A);
+}
+
+struct matrix_product {
+    struct matrix* M;
+    const double* x;
+    double* y;
+};
+
+// Rows of y = M x.
+static void matrix_apply_row(void* arg, int i, int thread_idx) {
+    (void) thread_idx;
+    struct matrix_product* mp = arg;
+    int n_col = mp->M->n_col;
+    const double* row = DATA(mp->M) + i * n_col;
+    double sum = 0;
+    for(int j = 0; j < n_col; j++) {
+        sum += row[j] * mp->x[j];
+    }
+    mp->y[i] = sum;
+}
+
+static void matrix_apply(void* ctx, const double* x, double* y) {
+    struct matrix_product mp = {ctx, x, y};
+    parallel_for(mp.M->n_row, 1 + 16384 / mp.M->n_col, matrix_apply_row, &mp);
+}
+
+// y = M^t x, accumulated row by row for contiguous access.
+static void matrix_apply_transpose(void* ctx, const double* x, double* y) {
+    struct matrix* M = ctx;
+    for(int j = 0; j < M->n_col; j++) {
+        y[j] = 0;
+    }
+    for(int i = 0; i < M->n_row; i++) {
+        const double* row = DATA(M) + i * M->n_col;
+        for(int j = 0; j < M->n_col; j++) {
+            y[j] += x[i] * row[j];
+        }
+    }
+}
+
+/* The operator x -> M x of a dense matrix.  M is not copied, and must
+   outlive the operator.
+*/
+struct linop* linop_from_matrix(struct matrix* M) {
+    return linop_new(M->n_row, M->n_col, matrix_apply, matrix_apply_transpose, (void*) M);
+}
+
+void linop_apply_into(struct vector* reciever, struct linop* A, struct vector* x) {
+    assert(x->length == A->n_col);
+    assert(reciever->length == A->n_row);
+    A->apply(A->ctx, DATA(x), DATA(reciever));
+}
+
+void linop_apply_transpose_into(struct vector* reciever, struct linop* A, struct vector* x) {
+    assert(A->apply_transpose != NULL);
+    assert(x->length == A->n_row);
+    assert(reciever->length == A->n_col);
+    A->apply_transpose(A->ctx, DATA(x), DATA(reciever));
+}
@@ -0,0 +1,36 @@
+/* linop.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include "vector.h"
+#include "matrix.h"
+
+/* A linear operator, known only through its action on vectors.
+
+   apply(ctx, x, y) must store A x into y, where x has n_col entries and y
+   has n_row.  apply_transpose, which stores A^t x, is optional (NULL when
+   not available) and only needed by least squares solvers.  This is how
+   sparse or implicit matrices, which can not be formed densely, are passed
+   to the iterative solvers.
+
+   free_ctx, when not NULL, is called on ctx by linop_free, for operators
+   owning their context (such as preconditioners).
+*/
+struct linop {
+    int n_row;
+    int n_col;
+    void (*apply)(void* ctx, const double* x, double* y);
+    void (*apply_transpose)(void* ctx, const double* x, double* y);
+    void* ctx;
+    void (*free_ctx)(void* ctx);
+};
+
+struct linop* linop_new(int n_row, int n_col,
+                        void (*apply)(void* ctx, const double* x, double* y),
+                        void (*apply_transpose)(void* ctx, const double* x, double* y),
+                        void* ctx);
+struct linop* linop_from_matrix(struct matrix* M);
+void          linop_free(struct linop* A);
+
+void linop_apply_into(struct vector* reciever, struct linop* A, struct vector* x);
+void linop_apply_transpose_into(struct vector* reciever, struct linop* A, struct vector* x);
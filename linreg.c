@@ -7,9 +7,17 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <math.h>
+#include <limits.h>
 #include "matrix.h"
 #include "vector.h"
+#include "util.h"
+#include "parallel.h"
 #include "linsolve.h"
+#include "qr_update.h"
+#include "svd.h"
+#include "linop.h"
+#include "linsolve_krylov.h"
+#include "sketch.h"
 #include "linreg.h"
 
 /* Linear Regression.
@@ -27,10 +35,19 @@ struct linreg* linreg_new(void) {
 
 void linreg_free(struct linreg* lr) {
     vector_free(lr->beta);
-    vector_free(lr->y_hat);
+    if(lr->y_hat != NULL) {
+        vector_free(lr->y_hat);
+    }
     free(lr);
 }
 
+/* The sigma_resid of a fit to n rows with residual sum of squares rss, every
+   fitting path reports it with this normalization.
+*/
+static double linreg_sigma_resid(long n, double rss) {
+    return sqrt((n - 1) * rss);
+}
+
 /* Solve a linear regression problem using the qr decomposition of the matrix X.
 
   The idea here is that if X = QR, then the linear regression equations reduce
@@ -49,15 +66,13 @@ struct linreg* linreg_fit(struct matrix* X, struct vector* y) {
 
     // Calculate the residual standard deviation.
     struct vector* y_hat = linreg_predict(lr, X);
-    double sigma_resid_sq = 0; double resid = 0;
+    double rss = 0; double resid = 0;
     for(int i = 0; i < y->length; i++) {
         resid = VECTOR_IDX_INTO(y, i) - VECTOR_IDX_INTO(y_hat, i);
-        sigma_resid_sq += resid * resid;
+        rss += resid * resid;
     }
-    double norm_factor = y->length - 1;
-    double sigma_resid = sqrt(norm_factor * sigma_resid_sq);
     lr->y_hat = y_hat;
-    lr->sigma_resid = sigma_resid;
+    lr->sigma_resid = linreg_sigma_resid(y->length, rss);
 
     qr_decomp_free(qr);
     vector_free(qtv);
@@ -65,9 +80,810 @@ struct linreg* linreg_fit(struct matrix* X, struct vector* y) {
     return lr;
 }
 
+/* Predictions for the rows of X, which need not be the rows the model was
+   fit to.
+*/
 struct vector* linreg_predict(struct linreg* lr, struct matrix* X) {
-    assert(lr->n == X->n_row);
     assert(lr->p == X->n_col);
-    struct vector* preds = matrix_vector_multiply(X, lr->beta);
+    struct vector* preds = vector_new(X->n_row);
+    linreg_score_into(lr, X, preds);
     return preds;
 }
+
+// Rows scored together by a thread.
+#define SCORE_BLOCK 512
+// Below this many entries of X, scoring runs in the calling thread.
+#define SCORE_PARALLEL_MIN 65536
+
+/* x^t beta, with four partial sums, which the compiler can keep in vector
+   registers.
+*/
+static double score_row(const double* x, const double* beta, int p) {
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int j = 0;
+    for(; j + 4 <= p; j += 4) {
+        s0 += x[j] * beta[j];
+        s1 += x[j + 1] * beta[j + 1];
+        s2 += x[j + 2] * beta[j + 2];
+        s3 += x[j + 3] * beta[j + 3];
+    }
+    for(; j < p; j++) {
+        s0 += x[j] * beta[j];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+struct score {
+    struct matrix* X;
+    const double* beta;
+    double* out;
+};
+
+static void score_block(void* arg, int block, int thread_idx) {
+    (void) thread_idx;
+    struct score* sc = arg;
+    int p = sc->X->n_col;
+    int end = (block + 1) * SCORE_BLOCK;
+    if(end > sc->X->n_row) {
+        end = sc->X->n_row;
+    }
+    for(int i = block * SCORE_BLOCK; i < end; i++) {
+        sc->out[i] = score_row(DATA(sc->X) + (size_t) i * p, sc->beta, p);
+    }
+}
+
+/* Score the rows of X into out, which must have one entry per row.
+
+  Nothing is allocated, and small requests (a single row in particular) are
+  scored directly in the calling thread.  Large batches are split in blocks
+  of rows over the thread pool.
+*/
+void linreg_score_into(struct linreg* lr, struct matrix* X, struct vector* out) {
+    assert(lr->p == X->n_col);
+    assert(out->length == X->n_row);
+    struct score sc = {X, DATA(lr->beta), DATA(out)};
+    int n_blocks = (X->n_row + SCORE_BLOCK - 1) / SCORE_BLOCK;
+    if((long) X->n_row * X->n_col < SCORE_PARALLEL_MIN) {
+        for(int block = 0; block < n_blocks; block++) {
+            score_block(&sc, block, 0);
+        }
+    } else {
+        parallel_for(n_blocks, 1 + SCORE_PARALLEL_MIN / (SCORE_BLOCK * X->n_col), score_block, &sc);
+    }
+}
+
+
+struct linreg_multi* linreg_multi_new(void) {
+    struct linreg_multi* lr = malloc(sizeof(struct linreg_multi));
+    check_memory((void*) lr);
+    return lr;
+}
+
+void linreg_multi_free(struct linreg_multi* lr) {
+    matrix_free_many(2, lr->beta, lr->y_hat);
+    vector_free(lr->sigma_resid);
+    free(lr);
+}
+
+/* Fit a linear regression of each column of Y on X.
+
+  X is factored once, X = QR, then the coefficients of all the responses
+  solve R B = Q^t Y, which is a single matrix product and a triangular solve
+  with many right hand sides.  Column j of beta, y_hat and entry j of
+  sigma_resid are what linreg_fit returns for column j of Y.
+*/
+struct linreg_multi* linreg_fit_multi(struct matrix* X, struct matrix* Y) {
+    assert(X->n_row == Y->n_row);
+    struct linreg_multi* lr = linreg_multi_new();
+    lr->n = X->n_row;
+    lr->p = X->n_col;
+    lr->k = Y->n_col;
+
+    struct qr_decomp* qr = matrix_qr_decomposition(X);
+    struct matrix* qtY = matrix_multiply_MtN(qr->q, Y);
+    lr->beta = linsolve_upper_triangular_matrix(qr->r, qtY);
+    lr->y_hat = matrix_multiply(X, lr->beta);
+
+    // Residual sums of squares, accumulated by rows.
+    double* rss = calloc(lr->k, sizeof(double));
+    check_memory((void*) rss);
+    for(int i = 0; i < Y->n_row; i++) {
+        const double* y_i = DATA(Y) + (size_t) i * lr->k;
+        const double* y_hat_i = DATA(lr->y_hat) + (size_t) i * lr->k;
+        for(int j = 0; j < lr->k; j++) {
+            double resid = y_i[j] - y_hat_i[j];
+            rss[j] += resid * resid;
+        }
+    }
+    lr->sigma_resid = vector_new(lr->k);
+    for(int j = 0; j < lr->k; j++) {
+        VECTOR_IDX_INTO(lr->sigma_resid, j) = linreg_sigma_resid(Y->n_row, rss[j]);
+    }
+
+    free(rss);
+    qr_decomp_free(qr);
+    matrix_free(qtY);
+    return lr;
+}
+
+/* Ridge regression.
+
+  The ridge coefficients minimize |y - X b|^2 + lambda |b|^2 (every
+  coefficient is penalized, an intercept column included), and solve
+
+      (Xt X + lambda I) b = Xt y.
+
+  With the thin singular value decomposition X = U S V^t, this is
+
+      b = V diag(s_i / (s_i^2 + lambda)) U^t y,
+
+  so once X is decomposed, each penalty costs O(p min(n, p)).  The fitted
+  values shrink the components of y along the u_i by s_i^2 / (s_i^2 + lambda),
+  which gives the residual sum of squares and the effective degrees of
+  freedom df = sum_i s_i^2 / (s_i^2 + lambda) in O(min(n, p)), and with them
+  the generalized cross validation score
+
+      GCV = n RSS / (n - df)^2.
+*/
+struct ridge_path* ridge_path_new(void) {
+    struct ridge_path* path = malloc(sizeof(struct ridge_path));
+    check_memory((void*) path);
+    return path;
+}
+
+void ridge_path_free(struct ridge_path* path) {
+    vector_free_many(4, path->lambdas, path->df, path->rss, path->gcv);
+    matrix_free(path->beta);
+    free(path);
+}
+
+struct ridge_path* linreg_ridge_path(struct matrix* X, struct vector* y,
+                                     double* lambdas, int n_lambdas) {
+    assert(X->n_row == y->length);
+    assert(n_lambdas >= 1);
+    int n = X->n_row, p = X->n_col;
+    struct svd* svd = matrix_svd(X, SVD_THIN, 1e-12, 50);
+    int k = svd->k;
+    double* s = DATA(svd->singular_values);
+    struct vector* uty = matrix_vector_multiply_Mtv(svd->u, y);
+
+    // The part of y outside the column space of X is never fitted.
+    double rss_outside = 0;
+    struct vector* projection = matrix_vector_multiply(svd->u, uty);
+    for(int i = 0; i < n; i++) {
+        double r = VECTOR_IDX_INTO(y, i) - VECTOR_IDX_INTO(projection, i);
+        rss_outside += r * r;
+    }
+
+    double* c = malloc(sizeof(double) * k);
+    check_memory((void*) c);
+    struct ridge_path* path = ridge_path_new();
+    path->n_lambdas = n_lambdas;
+    path->lambdas = vector_from_array(lambdas, n_lambdas);
+    path->beta = matrix_new(p, n_lambdas);
+    path->df = vector_new(n_lambdas);
+    path->rss = vector_new(n_lambdas);
+    path->gcv = vector_new(n_lambdas);
+    path->best = 0;
+    for(int l = 0; l < n_lambdas; l++) {
+        double lambda = lambdas[l];
+        assert(lambda >= 0);
+        double df = 0, rss = rss_outside;
+        for(int i = 0; i < k; i++) {
+            double s_sq = s[i] * s[i];
+            // A zero singular value is not fitted at any penalty.
+            double shrink = (s_sq + lambda == 0) ? 0 : s_sq / (s_sq + lambda);
+            double coefficient = (s_sq + lambda == 0) ? 0 : s[i] / (s_sq + lambda);
+            c[i] = coefficient * VECTOR_IDX_INTO(uty, i);
+            double r = (1 - shrink) * VECTOR_IDX_INTO(uty, i);
+            rss += r * r;
+            df += shrink;
+        }
+        // beta = V c, by rows of V.
+        for(int j = 0; j < p; j++) {
+            const double* v_j = DATA(svd->v) + (size_t) j * k;
+            double b_j = 0;
+            for(int i = 0; i < k; i++) {
+                b_j += v_j[i] * c[i];
+            }
+            MATRIX_IDX_INTO(path->beta, j, l) = b_j;
+        }
+        VECTOR_IDX_INTO(path->df, l) = df;
+        VECTOR_IDX_INTO(path->rss, l) = rss;
+        VECTOR_IDX_INTO(path->gcv, l) = (n > df) ? n * rss / ((n - df) * (n - df)) : INFINITY;
+        if(VECTOR_IDX_INTO(path->gcv, l) < VECTOR_IDX_INTO(path->gcv, path->best)) {
+            path->best = l;
+        }
+    }
+
+    free(c);
+    vector_free_many(2, uty, projection);
+    svd_free(svd);
+    return path;
+}
+
+/* Fit a single ridge regression, see linreg_ridge_path. */
+struct linreg* linreg_fit_ridge(struct matrix* X, struct vector* y, double lambda) {
+    struct ridge_path* path = linreg_ridge_path(X, y, &lambda, 1);
+    struct linreg* lr = linreg_new();
+    lr->n = X->n_row;
+    lr->p = X->n_col;
+    lr->beta = matrix_column_copy(path->beta, 0);
+    lr->y_hat = matrix_vector_multiply(X, lr->beta);
+    lr->sigma_resid = linreg_sigma_resid(X->n_row, VECTOR_IDX_INTO(path->rss, 0));
+    ridge_path_free(path);
+    return lr;
+}
+
+/* Streaming linear regression.
+
+  The rows of [X y] are folded into the triangular factor R of a QR
+  decomposition of [X y] (its Q is never formed), which has p + 1 rows
+  whatever the number of rows seen.  Writing
+
+      R = | R_X  z |
+          |  0   r |
+
+  the least squares coefficients solve R_X b = z, and the residual sum of
+  squares is r^2, so the fit only needs R.  The result is the same as
+  linreg_fit's on all the rows at once, except that the fitted values are not
+  kept (y_hat is NULL).
+*/
+struct linreg_stream* linreg_stream_begin(int p) {
+    assert(p >= 1);
+    struct linreg_stream* s = malloc(sizeof(struct linreg_stream));
+    check_memory((void*) s);
+    s->n = 0;
+    s->p = p;
+    s->r = matrix_zeros(p + 1, p + 1);
+    return s;
+}
+
+// Rows of a chunk folded together into a per thread factor.
+#define STREAM_BLOCK 256
+
+struct stream_chunk {
+    struct matrix* X;
+    struct vector* y;
+    struct matrix** thread_r;
+    double* thread_x;
+};
+
+static void stream_fold_block(void* arg, int block, int thread_idx) {
+    struct stream_chunk* c = arg;
+    int p = c->X->n_col;
+    struct matrix* r = c->thread_r[thread_idx];
+    double* x = c->thread_x + thread_idx * (p + 1);
+    int end = (block + 1) * STREAM_BLOCK;
+    if(end > c->X->n_row) {
+        end = c->X->n_row;
+    }
+    for(int i = block * STREAM_BLOCK; i < end; i++) {
+        for(int j = 0; j < p; j++) {
+            x[j] = MATRIX_IDX_INTO(c->X, i, j);
+        }
+        x[p] = VECTOR_IDX_INTO(c->y, i);
+        qr_r_add_row(r, x);
+    }
+}
+
+/* Fold a chunk of rows into the fit.  The blocks of the chunk are spread
+   over the threads, each folding its rows into its own factor, and the
+   factors are then folded into the running one, which costs O(p^3) per
+   thread and chunk.
+*/
+void linreg_stream_update(struct linreg_stream* s, struct matrix* X, struct vector* y) {
+    assert(X->n_col == s->p);
+    assert(X->n_row == y->length);
+    int p = s->p;
+    int n_threads = parallel_num_threads();
+    struct matrix** thread_r = malloc(sizeof(struct matrix*) * n_threads);
+    check_memory((void*) thread_r);
+    for(int t = 0; t < n_threads; t++) {
+        thread_r[t] = matrix_zeros(p + 1, p + 1);
+    }
+    double* thread_x = malloc(sizeof(double) * n_threads * (p + 1));
+    check_memory((void*) thread_x);
+
+    struct stream_chunk c = {X, y, thread_r, thread_x};
+    int n_blocks = (X->n_row + STREAM_BLOCK - 1) / STREAM_BLOCK;
+    parallel_for(n_blocks, 1 + 4 * (p + 1) / STREAM_BLOCK, stream_fold_block, &c);
+
+    for(int t = 0; t < n_threads; t++) {
+        for(int i = 0; i <= p; i++) {
+            for(int j = 0; j <= p; j++) {
+                thread_x[j] = MATRIX_IDX_INTO(thread_r[t], i, j);
+            }
+            qr_r_add_row(s->r, thread_x);
+        }
+        matrix_free(thread_r[t]);
+    }
+    free(thread_r);
+    free(thread_x);
+    s->n += X->n_row;
+}
+
+/* Solve for the fit from the folded rows, and free the stream. */
+struct linreg* linreg_stream_finish(struct linreg_stream* s) {
+    assert(s->n >= s->p);
+    int p = s->p;
+    struct matrix* r_x = matrix_new(p, p);
+    struct vector* z = vector_new(p);
+    for(int i = 0; i < p; i++) {
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(r_x, i, j) = MATRIX_IDX_INTO(s->r, i, j);
+        }
+        VECTOR_IDX_INTO(z, i) = MATRIX_IDX_INTO(s->r, i, p);
+    }
+    struct linreg* lr = linreg_new();
+    lr->n = s->n;
+    lr->p = p;
+    lr->beta = linsolve_upper_triangular(r_x, z);
+    lr->y_hat = NULL;
+    double rss = MATRIX_IDX_INTO(s->r, p, p) * MATRIX_IDX_INTO(s->r, p, p);
+    lr->sigma_resid = linreg_sigma_resid(s->n, rss);
+
+    matrix_free_many(2, r_x, s->r); vector_free(z);
+    free(s);
+    return lr;
+}
+
+/* Rolling linear regression.
+
+  The fit over the last `window` rows, advanced one row at a time.  The rows
+  in the window are kept in a ring buffer, and the triangular factor R of
+  [X y] over them (as for the streaming fit) is updated in O(p^2) per step:
+  the newest row is folded in, and the oldest is removed by downdating.
+  Downdating loses accuracy over many steps, so R is refactored from the
+  ring buffer every refactor_every steps, O(window p^2), and whenever a
+  downdate breaks down.  With refactor_every of the order of the window,
+  a step costs O(p^2) amortized.
+*/
+struct linreg_rolling* linreg_rolling_new(int p, int window, int refactor_every) {
+    assert(p >= 1);
+    assert(window >= p);
+    assert(refactor_every >= 1);
+    struct linreg_rolling* s = malloc(sizeof(struct linreg_rolling));
+    check_memory((void*) s);
+    s->p = p;
+    s->window = window;
+    s->refactor_every = refactor_every;
+    s->n = 0;
+    s->n_pushed = 0;
+    s->n_updates = 0;
+    s->rows = matrix_new(window, p + 1);
+    s->r = matrix_zeros(p + 1, p + 1);
+    s->work = malloc(sizeof(double) * 2 * (p + 1));
+    check_memory((void*) s->work);
+    return s;
+}
+
+void linreg_rolling_free(struct linreg_rolling* s) {
+    matrix_free_many(2, s->rows, s->r);
+    free(s->work);
+    free(s);
+}
+
+// Refactor R from the rows in the window.
+static void rolling_refactor(struct linreg_rolling* s) {
+    int p = s->p;
+    double* x = s->work;
+    for(int i = 0; i < (p + 1) * (p + 1); i++) {
+        DATA(s->r)[i] = 0;
+    }
+    for(int i = 0; i < s->n; i++) {
+        for(int j = 0; j <= p; j++) {
+            x[j] = MATRIX_IDX_INTO(s->rows, i, j);
+        }
+        qr_r_add_row(s->r, x);
+    }
+    s->n_updates = 0;
+}
+
+/* Add the row (x, y), dropping the oldest one once the window is full. */
+void linreg_rolling_push(struct linreg_rolling* s, struct vector* x, double y) {
+    assert(x->length == s->p);
+    int p = s->p;
+    double* slot = DATA(s->rows) + (s->n_pushed % s->window) * (p + 1);
+    double* row = s->work;
+    bool refactor = false;
+    if(s->n == s->window) {
+        for(int j = 0; j <= p; j++) {
+            row[j] = slot[j];
+        }
+        refactor = !qr_r_delete_row(s->r, row, s->work + (p + 1));
+    } else {
+        s->n++;
+    }
+    for(int j = 0; j < p; j++) {
+        slot[j] = VECTOR_IDX_INTO(x, j);
+    }
+    slot[p] = y;
+    s->n_pushed++;
+    s->n_updates++;
+    if(refactor || s->n_updates >= s->refactor_every) {
+        rolling_refactor(s);
+    } else {
+        for(int j = 0; j <= p; j++) {
+            row[j] = slot[j];
+        }
+        qr_r_add_row(s->r, row);
+    }
+}
+
+/* The coefficients of the fit over the current window, into beta, and its
+   sigma_resid (normalized as linreg_fit's).  Does not allocate.
+*/
+void linreg_rolling_coefficients(struct linreg_rolling* s, struct vector* beta,
+                                 double* sigma_resid) {
+    assert(s->n >= s->p);
+    assert(beta->length == s->p);
+    int p = s->p;
+    // Back substitution, R_X b = z.
+    for(int i = p - 1; i >= 0; i--) {
+        double sum = MATRIX_IDX_INTO(s->r, i, p);
+        for(int j = i + 1; j < p; j++) {
+            sum -= MATRIX_IDX_INTO(s->r, i, j) * VECTOR_IDX_INTO(beta, j);
+        }
+        VECTOR_IDX_INTO(beta, i) = sum / MATRIX_IDX_INTO(s->r, i, i);
+    }
+    double rss = MATRIX_IDX_INTO(s->r, p, p) * MATRIX_IDX_INTO(s->r, p, p);
+    *sigma_resid = linreg_sigma_resid(s->n, rss);
+}
+
+/* The rolling fits over all the windows of `window` consecutive rows of X.
+   Row i of beta and entry i of sigma_resid are for the rows i to
+   i + window - 1, so both have X->n_row - window + 1 rows.
+*/
+void linreg_fit_rolling_into(struct matrix* beta, struct vector* sigma_resid,
+                             struct matrix* X, struct vector* y,
+                             int window, int refactor_every) {
+    assert(X->n_row == y->length);
+    assert(X->n_row >= window);
+    assert(beta->n_row == X->n_row - window + 1 && beta->n_col == X->n_col);
+    assert(sigma_resid->length == beta->n_row);
+    struct linreg_rolling* s = linreg_rolling_new(X->n_col, window, refactor_every);
+    for(int i = 0; i < X->n_row; i++) {
+        struct vector* x = matrix_row_view(X, i);
+        linreg_rolling_push(s, x, VECTOR_IDX_INTO(y, i));
+        vector_free(x);
+        if(i >= window - 1) {
+            struct vector* b = matrix_row_view(beta, i - window + 1);
+            linreg_rolling_coefficients(s, b, &VECTOR_IDX_INTO(sigma_resid, i - window + 1));
+            vector_free(b);
+        }
+    }
+    linreg_rolling_free(s);
+}
+
+/* K-fold cross validation.
+
+  The rows are split in k contiguous folds of nearly equal size (shuffle the
+  rows beforehand for random folds).  The fit without fold f solves the
+  normal equations of the other rows,
+
+      (G - G_f) b_f = c - c_f,    G_f = X_f^t X_f,  c_f = X_f^t y_f,
+
+  where G and c, the Gram matrix and X^t y of all the rows, are the sums of
+  the per fold ones.  So one pass over X forms every G_f, and each fold only
+  adds an O(p^3) Cholesky solve and a pass over its own rows to measure its
+  error: the whole costs about one fit, not k.  The folds are spread over
+  the threads, and only X itself is kept in memory besides the k Gram
+  matrices.
+*/
+struct linreg_cv* linreg_cv_new(void) {
+    struct linreg_cv* cv = malloc(sizeof(struct linreg_cv));
+    check_memory((void*) cv);
+    return cv;
+}
+
+void linreg_cv_free(struct linreg_cv* cv) {
+    matrix_free(cv->beta);
+    vector_free(cv->fold_mse);
+    free(cv);
+}
+
+struct cv_folds {
+    struct matrix* X;
+    struct vector* y;
+    int k;
+    // Per fold G_f (upper triangle) and c_f, then the fits without the fold.
+    double* gram;
+    double* rhs;
+    struct linreg_cv* cv;
+};
+
+static int fold_begin(struct cv_folds* folds, int f) {
+    return (int) ((long) f * folds->X->n_row / folds->k);
+}
+
+static void cv_fold_gram(void* arg, int f, int thread_idx) {
+    (void) thread_idx;
+    struct cv_folds* folds = arg;
+    int p = folds->X->n_col;
+    double* gram = folds->gram + (size_t) f * p * p;
+    double* rhs = folds->rhs + (size_t) f * p;
+    for(int a = 0; a < p * p; a++) {
+        gram[a] = 0;
+    }
+    for(int a = 0; a < p; a++) {
+        rhs[a] = 0;
+    }
+    for(int i = fold_begin(folds, f); i < fold_begin(folds, f + 1); i++) {
+        const double* x = DATA(folds->X) + (size_t) i * p;
+        double y = VECTOR_IDX_INTO(folds->y, i);
+        for(int a = 0; a < p; a++) {
+            rhs[a] += y * x[a];
+            double* gram_a = gram + a * p;
+            for(int b = a; b < p; b++) {
+                gram_a[b] += x[a] * x[b];
+            }
+        }
+    }
+}
+
+/* Overwrite G_f with G - G_f and solve for the fit without fold f, then
+   score it on the fold.  The totals G and c are in the slot past the last
+   fold.
+*/
+static void cv_fold_fit(void* arg, int f, int thread_idx) {
+    (void) thread_idx;
+    struct cv_folds* folds = arg;
+    int p = folds->X->n_col;
+    double* gram = folds->gram + (size_t) f * p * p;
+    double* rhs = folds->rhs + (size_t) f * p;
+    const double* gram_total = folds->gram + (size_t) folds->k * p * p;
+    const double* rhs_total = folds->rhs + (size_t) folds->k * p;
+    for(int a = 0; a < p; a++) {
+        for(int b = a; b < p; b++) {
+            gram[a * p + b] = gram_total[a * p + b] - gram[a * p + b];
+        }
+        rhs[a] = rhs_total[a] - rhs[a];
+    }
+    double* beta = DATA(folds->cv->beta) + (size_t) f * p;
+    if(!linsolve_cholesky_in_place(gram, rhs, p)) {
+        // The other folds do not determine the coefficients.
+        for(int a = 0; a < p; a++) {
+            beta[a] = NAN;
+        }
+        VECTOR_IDX_INTO(folds->cv->fold_mse, f) = NAN;
+        return;
+    }
+    for(int a = 0; a < p; a++) {
+        beta[a] = rhs[a];
+    }
+    double sse = 0;
+    int begin = fold_begin(folds, f), end = fold_begin(folds, f + 1);
+    for(int i = begin; i < end; i++) {
+        double r = VECTOR_IDX_INTO(folds->y, i)
+                   - score_row(DATA(folds->X) + (size_t) i * p, beta, p);
+        sse += r * r;
+    }
+    VECTOR_IDX_INTO(folds->cv->fold_mse, f) = sse / (end - begin);
+}
+
+struct linreg_cv* linreg_cross_validate(struct matrix* X, struct vector* y, int k) {
+    assert(X->n_row == y->length);
+    assert(2 <= k && k <= X->n_row);
+    int p = X->n_col;
+    struct cv_folds folds;
+    folds.X = X;
+    folds.y = y;
+    folds.k = k;
+    folds.gram = malloc(sizeof(double) * (size_t) (k + 1) * (p * p + p));
+    check_memory((void*) folds.gram);
+    folds.rhs = folds.gram + (size_t) (k + 1) * p * p;
+    struct linreg_cv* cv = linreg_cv_new();
+    cv->k = k;
+    cv->beta = matrix_new(k, p);
+    cv->fold_mse = vector_new(k);
+    folds.cv = cv;
+
+    parallel_for(k, 1, cv_fold_gram, &folds);
+    double* gram_total = folds.gram + (size_t) k * p * p;
+    double* rhs_total = folds.rhs + (size_t) k * p;
+    for(int a = 0; a < p * p; a++) {
+        gram_total[a] = 0;
+    }
+    for(int a = 0; a < p; a++) {
+        rhs_total[a] = 0;
+    }
+    for(int f = 0; f < k; f++) {
+        for(int a = 0; a < p * p; a++) {
+            gram_total[a] += folds.gram[(size_t) f * p * p + a];
+        }
+        for(int a = 0; a < p; a++) {
+            rhs_total[a] += folds.rhs[(size_t) f * p + a];
+        }
+    }
+    parallel_for(k, 1, cv_fold_fit, &folds);
+
+    double sse = 0;
+    for(int f = 0; f < k; f++) {
+        sse += VECTOR_IDX_INTO(cv->fold_mse, f) * (fold_begin(&folds, f + 1) - fold_begin(&folds, f));
+    }
+    cv->mse = sse / X->n_row;
+    free(folds.gram);
+    return cv;
+}
+
+/* Batches of independent regressions.
+
+  Each model is fit by a Householder QR decomposition of [X y], done in a
+  workspace of the thread (a column major copy of [X y], allocated once for
+  the largest model of the batch), so a fit allocates nothing.  Q is never
+  formed: after the reflections, the upper triangle of the copy is the
+  factor R, and the rest of the last column the residual.  The models are
+  spread over the threads.  Their coefficients and fitted values are views
+  into a single block of storage, and the models themselves are contiguous.
+*/
+struct batch_fit {
+    struct matrix** X;
+    struct vector** y;
+    struct linreg* models;
+    double* work;
+    size_t stride;
+};
+
+static void batch_fit_model(void* arg, int m, int thread_idx) {
+    struct batch_fit* batch = arg;
+    struct matrix* X = batch->X[m];
+    struct vector* y = batch->y[m];
+    struct linreg* lr = &batch->models[m];
+    int n = X->n_row, p = X->n_col;
+    // Column j of [X y] is a + j * n, and the diagonal of R goes to diag.
+    double* a = batch->work + thread_idx * batch->stride;
+    double* diag = a + (size_t) n * (p + 1);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < p; j++) {
+            a[(size_t) j * n + i] = MATRIX_IDX_INTO(X, i, j);
+        }
+        a[(size_t) p * n + i] = VECTOR_IDX_INTO(y, i);
+    }
+
+    for(int k = 0; k < p; k++) {
+        double* v = a + (size_t) k * n;
+        double norm_sq = 0;
+        for(int i = k; i < n; i++) {
+            norm_sq += v[i] * v[i];
+        }
+        double norm = sqrt(norm_sq);
+        diag[k] = (v[k] > 0) ? -norm : norm;
+        if(norm == 0) {
+            continue;
+        }
+        // v = x - diag e_k, so v^t v = 2 norm (norm + |x_k|).
+        double vtv = 2 * norm * (norm + fabs(v[k]));
+        v[k] -= diag[k];
+        for(int j = k + 1; j <= p; j++) {
+            double* col = a + (size_t) j * n;
+            double d = 0;
+            for(int i = k; i < n; i++) {
+                d += v[i] * col[i];
+            }
+            double f = 2 * d / vtv;
+            for(int i = k; i < n; i++) {
+                col[i] -= f * v[i];
+            }
+        }
+    }
+
+    double* beta = DATA(lr->beta);
+    const double* z = a + (size_t) p * n;
+    for(int i = p - 1; i >= 0; i--) {
+        double sum = z[i];
+        for(int j = i + 1; j < p; j++) {
+            sum -= a[(size_t) j * n + i] * beta[j];
+        }
+        beta[i] = sum / diag[i];
+    }
+    for(int i = 0; i < n; i++) {
+        VECTOR_IDX_INTO(lr->y_hat, i) = score_row(DATA(X) + (size_t) i * p, beta, p);
+    }
+    double rss = 0;
+    for(int i = p; i < n; i++) {
+        rss += z[i] * z[i];
+    }
+    lr->sigma_resid = linreg_sigma_resid(n, rss);
+}
+
+struct linreg_batch* linreg_fit_batch(struct matrix** X, struct vector** y, int n_models) {
+    assert(n_models >= 1);
+    struct linreg_batch* batch = malloc(sizeof(struct linreg_batch));
+    check_memory((void*) batch);
+    batch->n_models = n_models;
+    batch->models = malloc(sizeof(struct linreg) * n_models);
+    check_memory((void*) batch->models);
+
+    size_t size = 0, stride = 0;
+    for(int m = 0; m < n_models; m++) {
+        assert(X[m]->n_row == y[m]->length);
+        assert(X[m]->n_row >= X[m]->n_col);
+        size += X[m]->n_col + X[m]->n_row;
+        size_t work = (size_t) X[m]->n_row * (X[m]->n_col + 1) + X[m]->n_col;
+        if(work > stride) {
+            stride = work;
+        }
+    }
+    assert(size <= INT_MAX);
+    batch->storage = vector_new((int) size);
+    double* data = DATA(batch->storage);
+    for(int m = 0; m < n_models; m++) {
+        struct linreg* lr = &batch->models[m];
+        lr->n = X[m]->n_row;
+        lr->p = X[m]->n_col;
+        lr->beta = vector_new_view((struct linalg_obj*) batch->storage, data, lr->p);
+        data += lr->p;
+        lr->y_hat = vector_new_view((struct linalg_obj*) batch->storage, data, lr->n);
+        data += lr->n;
+    }
+
+    struct batch_fit fit = {X, y, batch->models, NULL, stride};
+    fit.work = malloc(sizeof(double) * parallel_num_threads() * stride);
+    check_memory((void*) fit.work);
+    parallel_for(n_models, 1, batch_fit_model, &fit);
+    free(fit.work);
+    return batch;
+}
+
+void linreg_batch_free(struct linreg_batch* batch) {
+    for(int m = 0; m < batch->n_models; m++) {
+        vector_free_many(2, batch->models[m].beta, batch->models[m].y_hat);
+    }
+    free(batch->models);
+    vector_free(batch->storage);
+    free(batch);
+}
+
+/* Sketched least squares.
+
+  With a sketch S of the rows (see sketch.h), the coefficients of the small
+  problem min |S X b - S y| approximate those of the full one, at the cost
+  of the sketch plus a fit on s rows.  When tol > 0 they are refined into
+  the exact least squares solution by LSQR, started from them and
+  preconditioned by R^-1, for the R of S X = Q R: X R^-1 is then well
+  conditioned, so the iterations needed depend on tol, not on X.  y_hat and
+  sigma_resid are always those of the returned coefficients on all of X.
+*/
+struct linreg* linreg_fit_sketched(struct matrix* X, struct vector* y,
+                                   struct sketch* S, double tol, int max_iter,
+                                   struct krylov_stats* stats) {
+    assert(X->n_row == y->length);
+    assert(S->n == X->n_row && S->s >= X->n_col);
+    struct linreg* lr = linreg_new();
+    lr->n = X->n_row;
+    lr->p = X->n_col;
+
+    // S X is factored once, its R also makes the preconditioner.
+    struct matrix* SX = sketch_apply(S, X);
+    struct vector* Sy = sketch_apply_vector(S, y);
+    struct qr_decomp* qr = matrix_qr_decomposition(SX);
+    struct vector* qtv = matrix_vector_multiply_Mtv(qr->q, Sy);
+    lr->beta = linsolve_upper_triangular(qr->r, qtv);
+    matrix_free_many(2, SX, qr->q); vector_free_many(2, Sy, qtv);
+
+    if(tol > 0) {
+        struct linop* A = linop_from_matrix(X);
+        struct linop* P = precond_from_r(qr->r);
+        linsolve_lsqr_into(lr->beta, A, y, P, tol, max_iter, stats);
+        linop_free(A); linop_free(P);
+    } else {
+        matrix_free(qr->r);
+    }
+    free(qr);
+
+    lr->y_hat = linreg_predict(lr, X);
+    double rss = 0;
+    for(int i = 0; i < y->length; i++) {
+        double resid = VECTOR_IDX_INTO(y, i) - VECTOR_IDX_INTO(lr->y_hat, i);
+        rss += resid * resid;
+    }
+    lr->sigma_resid = linreg_sigma_resid(y->length, rss);
+    if(tol <= 0 && stats != NULL) {
+        double y_norm = vector_norm(y);
+        stats->n_iter = 0;
+        stats->residual = (y_norm == 0) ? 0 : sqrt(rss) / y_norm;
+        stats->converged = false;
+    }
+    return lr;
+}
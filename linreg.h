@@ -1,11 +1,14 @@
 /* linreg.h
   (c) Matthew Drury, 2016
 */
+#pragma once
 #include "vector.h"
 #include "matrix.h"
+#include "sketch.h"
+#include "linsolve_krylov.h"
 
 struct linreg {
-    int n;
+    long n;
     int p;
     struct vector* beta;
     struct vector* y_hat;
@@ -17,3 +20,115 @@ void           linreg_free(struct linreg* lr);
 
 struct linreg* linreg_fit(struct matrix* X, struct vector* y);
 struct vector* linreg_predict(struct linreg* lr, struct matrix* X);
+void           linreg_score_into(struct linreg* lr, struct matrix* X, struct vector* out);
+
+/* Regressions of the k columns of a response matrix on the same X. */
+struct linreg_multi {
+    long n;
+    int p;
+    int k;
+    struct matrix* beta;
+    struct matrix* y_hat;
+    struct vector* sigma_resid;
+};
+
+struct linreg_multi* linreg_multi_new(void);
+void                 linreg_multi_free(struct linreg_multi* lr);
+
+struct linreg_multi* linreg_fit_multi(struct matrix* X, struct matrix* Y);
+
+/* Ridge regression over a grid of penalties, from one decomposition of X.
+   Column l of beta holds the coefficients for lambdas[l], with their
+   effective degrees of freedom, residual sum of squares and generalized
+   cross validation score.  best is the index of the smallest score.
+*/
+struct ridge_path {
+    int n_lambdas;
+    struct vector* lambdas;
+    struct matrix* beta;
+    struct vector* df;
+    struct vector* rss;
+    struct vector* gcv;
+    int best;
+};
+
+struct ridge_path* ridge_path_new(void);
+void               ridge_path_free(struct ridge_path* path);
+
+struct ridge_path* linreg_ridge_path(struct matrix* X, struct vector* y,
+                                     double* lambdas, int n_lambdas);
+struct linreg*     linreg_fit_ridge(struct matrix* X, struct vector* y, double lambda);
+
+/* Fit over rows given in chunks, in O(p^2) memory. */
+struct linreg_stream {
+    long n;
+    int p;
+    struct matrix* r;
+};
+
+struct linreg_stream* linreg_stream_begin(int p);
+void                  linreg_stream_update(struct linreg_stream* s,
+                                           struct matrix* X, struct vector* y);
+struct linreg*        linreg_stream_finish(struct linreg_stream* s);
+
+/* Fit over a sliding window of the last rows, updated in O(p^2) per row. */
+struct linreg_rolling {
+    int p;
+    int window;
+    int refactor_every;
+    int n;
+    long n_pushed;
+    int n_updates;
+    struct matrix* rows;
+    struct matrix* r;
+    double* work;
+};
+
+struct linreg_rolling* linreg_rolling_new(int p, int window, int refactor_every);
+void                   linreg_rolling_free(struct linreg_rolling* s);
+
+void linreg_rolling_push(struct linreg_rolling* s, struct vector* x, double y);
+void linreg_rolling_coefficients(struct linreg_rolling* s, struct vector* beta,
+                                 double* sigma_resid);
+void linreg_fit_rolling_into(struct matrix* beta, struct vector* sigma_resid,
+                             struct matrix* X, struct vector* y,
+                             int window, int refactor_every);
+
+/* K-fold cross validation from per fold Gram matrices.  Row f of beta is
+   the fit without fold f, fold_mse[f] its mean squared error on fold f, and
+   mse the mean squared error over all the rows.
+*/
+struct linreg_cv {
+    int k;
+    struct matrix* beta;
+    struct vector* fold_mse;
+    double mse;
+};
+
+struct linreg_cv* linreg_cv_new(void);
+void              linreg_cv_free(struct linreg_cv* cv);
+
+struct linreg_cv* linreg_cross_validate(struct matrix* X, struct vector* y, int k);
+
+/* Independent regressions of y[m] on X[m], fit together.  The models are
+   contiguous, and their vectors are views into one block of storage, so
+   they are freed all at once by linreg_batch_free.
+*/
+struct linreg_batch {
+    int n_models;
+    struct linreg* models;
+    struct vector* storage;
+};
+
+struct linreg_batch* linreg_fit_batch(struct matrix** X, struct vector** y, int n_models);
+void                 linreg_batch_free(struct linreg_batch* batch);
+
+/* Fit from a sketch of the rows of X, refined by preconditioned LSQR to
+   tolerance tol, in at most max_iter iterations, when tol > 0.  When stats
+   is not NULL, it receives those of LSQR (with stats->converged false if the
+   coefficients are not refined to tol), or, when tol is 0, zero iterations
+   and the relative residual of the sketched fit.
+*/
+struct linreg* linreg_fit_sketched(struct matrix* X, struct vector* y,
+                                   struct sketch* S, double tol, int max_iter,
+                                   struct krylov_stats* stats);
@@ -2,8 +2,14 @@
   (c) Matthew Drury, 2017
 */
 #include <assert.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <float.h>
 #include "vector.h"
 #include "matrix.h"
+#include "util.h"
+#include "parallel.h"
 #include "linsolve.h"
 
 /* Solve a general linear equation Mx = v using the QR decomposition of M.
@@ -62,7 +68,7 @@ struct vector* linsolve_upper_triangular(struct matrix* R, struct vector* v) {
        Tracks the part of the current equation (row) that reduces to a constant
        after substituting in the values for the already solved for varaiables.
     */
-    float back_substitute;
+    double back_substitute;
 
     for(int i = n_eq - 1; i >= 0; i--) {
         back_substitute = 0;
@@ -74,3 +80,375 @@ struct vector* linsolve_upper_triangular(struct matrix* R, struct vector* v) {
     }
     return solution;
 }
+
+
+/* Solve RX = V for a matrix of right hand sides, where R is upper triangular.
+
+   The back substitution is done on whole rows of X at once,
+
+     x_i = (v_i - sum_{l > i} r_{i,l} x_l) / r_{i,i}
+
+   so all the right hand sides are solved together, with contiguous row
+   operations.
+*/
+struct matrix* linsolve_upper_triangular_matrix(struct matrix* R, struct matrix* V) {
+    assert(R->n_row == R->n_col);
+    assert(R->n_col == V->n_row);
+    int n_eq = V->n_row, k = V->n_col;
+    struct matrix* X = matrix_copy(V);
+    for(int i = n_eq - 1; i >= 0; i--) {
+        double* x_i = DATA(X) + (size_t) i * k;
+        for(int l = i + 1; l < n_eq; l++) {
+            double r = MATRIX_IDX_INTO(R, i, l);
+            const double* x_l = DATA(X) + (size_t) l * k;
+            for(int j = 0; j < k; j++) {
+                x_i[j] -= r * x_l[j];
+            }
+        }
+        double r_ii = MATRIX_IDX_INTO(R, i, i);
+        for(int j = 0; j < k; j++) {
+            x_i[j] /= r_ii;
+        }
+    }
+    return X;
+}
+
+/* Solve G x = b in place by the Cholesky factorization G = U^t U, from the
+   upper triangle of G.  b is overwritten with x.  Returns false if G is not
+   positive definite.  G and b are raw row major arrays, for callers
+   accumulating normal equations in their own buffers.
+*/
+bool linsolve_cholesky_in_place(double* G, double* b, int p) {
+    for(int i = 0; i < p; i++) {
+        double d = G[i * p + i];
+        for(int k = 0; k < i; k++) {
+            d -= G[k * p + i] * G[k * p + i];
+        }
+        if(!(d > 0)) {
+            return false;
+        }
+        G[i * p + i] = sqrt(d);
+        for(int j = i + 1; j < p; j++) {
+            double s = G[i * p + j];
+            for(int k = 0; k < i; k++) {
+                s -= G[k * p + i] * G[k * p + j];
+            }
+            G[i * p + j] = s / G[i * p + i];
+        }
+    }
+    for(int i = 0; i < p; i++) {
+        for(int k = 0; k < i; k++) {
+            b[i] -= G[k * p + i] * b[k];
+        }
+        b[i] /= G[i * p + i];
+    }
+    for(int i = p - 1; i >= 0; i--) {
+        for(int k = i + 1; k < p; k++) {
+            b[i] -= G[i * p + k] * b[k];
+        }
+        b[i] /= G[i * p + i];
+    }
+    return true;
+}
+
+/************************************
+ * Mixed precision.
+ ************************************/
+
+/* An LU factorization with partial pivoting, in single precision: rows
+   pivot[0], pivot[1], ... of M are the rows of L U, L (with a unit diagonal)
+   below the diagonal of lu and U on and above it.
+*/
+struct lu_float {
+    int n;
+    float* lu;
+    int* pivot;
+};
+
+struct lu_float_update {
+    float* lu;
+    int n;
+    int k;
+};
+
+// Eliminate column k from row k + 1 + i.
+static void lu_float_update_row(void* arg, int i, int thread_idx) {
+    (void) thread_idx;
+    struct lu_float_update* u = arg;
+    int n = u->n, k = u->k;
+    float* row_k = u->lu + (size_t) k * n;
+    float* row_i = u->lu + (size_t) (k + 1 + i) * n;
+    float l = row_i[k] / row_k[k];
+    row_i[k] = l;
+    for(int j = k + 1; j < n; j++) {
+        row_i[j] -= l * row_k[j];
+    }
+}
+
+/* Factor M rounded to single precision.  Returns false if M does not fit in
+   single precision, or if a pivot is zero.
+*/
+static bool lu_float_factor(struct lu_float* f, struct matrix* M) {
+    int n = f->n;
+    for(size_t i = 0; i < (size_t) n * n; i++) {
+        if(fabs(DATA(M)[i]) > FLT_MAX) {
+            return false;
+        }
+        f->lu[i] = (float) DATA(M)[i];
+    }
+    for(int i = 0; i < n; i++) {
+        f->pivot[i] = i;
+    }
+    for(int k = 0; k < n; k++) {
+        int p = k;
+        for(int i = k + 1; i < n; i++) {
+            if(fabsf(f->lu[(size_t) i * n + k]) > fabsf(f->lu[(size_t) p * n + k])) {
+                p = i;
+            }
+        }
+        if(f->lu[(size_t) p * n + k] == 0) {
+            return false;
+        }
+        if(p != k) {
+            for(int j = 0; j < n; j++) {
+                float tmp = f->lu[(size_t) k * n + j];
+                f->lu[(size_t) k * n + j] = f->lu[(size_t) p * n + j];
+                f->lu[(size_t) p * n + j] = tmp;
+            }
+            int tmp = f->pivot[k]; f->pivot[k] = f->pivot[p]; f->pivot[p] = tmp;
+        }
+        // The rows below are updated independently, by rows for contiguous
+        // access.
+        struct lu_float_update u = {f->lu, n, k};
+        parallel_for(n - k - 1, 1 + 16384 / (n - k), lu_float_update_row, &u);
+    }
+    return true;
+}
+
+/* Solve L U y = P x (or its transpose (L U)^t y = P x in the original row
+   order of M, when transpose is true), in single precision.  x is
+   overwritten, work has length n.
+*/
+static void lu_float_solve(struct lu_float* f, double* x, float* work, bool transpose) {
+    int n = f->n;
+    const float* lu = f->lu;
+    if(!transpose) {
+        for(int i = 0; i < n; i++) {
+            float s = (float) x[f->pivot[i]];
+            for(int j = 0; j < i; j++) {
+                s -= lu[(size_t) i * n + j] * work[j];
+            }
+            work[i] = s;
+        }
+        for(int i = n - 1; i >= 0; i--) {
+            float s = work[i];
+            for(int j = i + 1; j < n; j++) {
+                s -= lu[(size_t) i * n + j] * work[j];
+            }
+            work[i] = s / lu[(size_t) i * n + i];
+        }
+        for(int i = 0; i < n; i++) {
+            x[i] = work[i];
+        }
+    } else {
+        // U^t then L^t, column oriented so that lu is read by rows.
+        for(int i = 0; i < n; i++) {
+            work[i] = (float) x[i];
+        }
+        for(int i = 0; i < n; i++) {
+            work[i] /= lu[(size_t) i * n + i];
+            for(int j = i + 1; j < n; j++) {
+                work[j] -= lu[(size_t) i * n + j] * work[i];
+            }
+        }
+        for(int i = n - 1; i >= 0; i--) {
+            for(int j = 0; j < i; j++) {
+                work[j] -= lu[(size_t) i * n + j] * work[i];
+            }
+        }
+        for(int i = 0; i < n; i++) {
+            x[f->pivot[i]] = work[i];
+        }
+    }
+}
+
+/* An estimate of |M^-1|_1 from its factorization, by Hager's method: the
+   maximum of |M^-1 x|_1 over |x|_1 = 1 is reached at a unit vector, which is
+   searched for by a few steps of gradient ascent, each costing two solves.
+*/
+static double lu_float_inverse_norm(struct lu_float* f, float* work) {
+    int n = f->n;
+    double* x = malloc(sizeof(double) * 2 * n);
+    check_memory((void*) x);
+    double* z = x + n;
+    for(int i = 0; i < n; i++) {
+        x[i] = 1.0 / n;
+    }
+    double estimate = 0;
+    int j_previous = -1;
+    for(int iter = 0; iter < 5; iter++) {
+        lu_float_solve(f, x, work, false);
+        estimate = 0;
+        for(int i = 0; i < n; i++) {
+            estimate += fabs(x[i]);
+            z[i] = (x[i] >= 0) ? 1 : -1;
+        }
+        lu_float_solve(f, z, work, true);
+        // Stop when no unit vector improves on the current x.
+        double z_x = 0;
+        for(int i = 0; i < n; i++) {
+            z_x += (j_previous < 0) ? z[i] / n : 0;
+        }
+        if(j_previous >= 0) {
+            z_x = z[j_previous];
+        }
+        int j = 0;
+        for(int i = 1; i < n; i++) {
+            if(fabs(z[i]) > fabs(z[j])) {
+                j = i;
+            }
+        }
+        if(fabs(z[j]) <= z_x || j == j_previous) {
+            break;
+        }
+        for(int i = 0; i < n; i++) {
+            x[i] = (i == j) ? 1 : 0;
+        }
+        j_previous = j;
+    }
+    free(x);
+    return estimate;
+}
+
+struct lu_float_correction {
+    struct lu_float* f;
+    float* work;
+};
+
+static void lu_float_correction(void* ctx, struct vector* r) {
+    struct lu_float_correction* c = ctx;
+    lu_float_solve(c->f, DATA(r), c->work, false);
+}
+
+static void qr_correction(void* ctx, struct vector* r) {
+    struct vector* d = linsolve_from_qr((struct qr_decomp*) ctx, r);
+    vector_copy_into(r, d);
+    vector_free(d);
+}
+
+/* Iterative refinement of x, a solution of Mx = v: r = v - Mx is computed
+   in double precision, the correction d solving Md = r is computed by
+   correct (which overwrites r with d), and x <- x + d.  Stops when the
+   residual is at the level of its own rounding errors, |r| <= limit |x|
+   (as in LAPACK's dsgesv), and returns whether that happened.  x is left at
+   the iterate of smallest residual.
+*/
+static bool refine(struct matrix* M, struct vector* v, struct vector* x, double limit,
+                   void (*correct)(void* ctx, struct vector* r), void* ctx, int* n_iter) {
+    int n = x->length;
+    struct vector* best = vector_copy(x);
+    double best_r_norm = INFINITY;
+    bool converged = false;
+    int iter;
+    for(iter = 0; iter <= LINSOLVE_MIXED_MAX_ITER; iter++) {
+        struct vector* r = matrix_vector_multiply(M, x);
+        double r_norm = 0, x_norm = 0;
+        for(int i = 0; i < n; i++) {
+            VECTOR_IDX_INTO(r, i) = VECTOR_IDX_INTO(v, i) - VECTOR_IDX_INTO(r, i);
+            r_norm = fmax(r_norm, fabs(VECTOR_IDX_INTO(r, i)));
+            x_norm = fmax(x_norm, fabs(VECTOR_IDX_INTO(x, i)));
+        }
+        if(r_norm < best_r_norm) {
+            best_r_norm = r_norm;
+            vector_copy_into(best, x);
+        }
+        converged = r_norm <= limit * x_norm;
+        if(converged || iter == LINSOLVE_MIXED_MAX_ITER) {
+            vector_free(r);
+            break;
+        }
+        correct(ctx, r);
+        for(int i = 0; i < n; i++) {
+            VECTOR_IDX_INTO(x, i) += VECTOR_IDX_INTO(r, i);
+        }
+        vector_free(r);
+    }
+    vector_copy_into(x, best);
+    vector_free(best);
+    *n_iter = iter;
+    return converged;
+}
+
+/* Solve Mx = v by factoring M in single precision and refining the solution
+   in double precision.
+
+   Each refinement step computes the residual r = v - Mx in double
+   precision, solves M d = r with the single precision factors, and
+   corrects x <- x + d.  While the condition number of M is well below the
+   inverse of the single precision unit roundoff, each step gains about
+   seven digits, and x reaches double precision accuracy in two or three
+   steps.  The factorization, which is most of the cost, runs on data of
+   half the size.
+
+   When the condition number estimate is above LINSOLVE_MIXED_MAX_CONDITION,
+   M does not fit in single precision, or the refinement does not converge,
+   M is factored in double precision (by QR) instead, the solution being
+   refined in the same way.  stats, when not NULL, records which path was
+   taken.
+*/
+struct vector* linsolve_mixed_precision(struct matrix* M, struct vector* v,
+                                        struct refinement_stats* stats) {
+    assert(M->n_row == M->n_col);
+    assert(M->n_row == v->length);
+    int n = M->n_row;
+    struct lu_float f;
+    f.n = n;
+    f.lu = malloc(sizeof(float) * ((size_t) n * n + n));
+    check_memory((void*) f.lu);
+    float* work = f.lu + (size_t) n * n;
+    f.pivot = malloc(sizeof(int) * n);
+    check_memory((void*) f.pivot);
+
+    double norm_M = 0, norm_M_inf = 0;
+    for(int j = 0; j < n; j++) {
+        double column_sum = 0;
+        for(int i = 0; i < n; i++) {
+            column_sum += fabs(MATRIX_IDX_INTO(M, i, j));
+        }
+        norm_M = fmax(norm_M, column_sum);
+    }
+    for(int i = 0; i < n; i++) {
+        double row_sum = 0;
+        for(int j = 0; j < n; j++) {
+            row_sum += fabs(MATRIX_IDX_INTO(M, i, j));
+        }
+        norm_M_inf = fmax(norm_M_inf, row_sum);
+    }
+    double limit = sqrt((double) n) * DBL_EPSILON * norm_M_inf;
+
+    bool factored = lu_float_factor(&f, M);
+    double condition = factored ? norm_M * lu_float_inverse_norm(&f, work) : INFINITY;
+    bool converged = false;
+    int iter = 0;
+    struct vector* x = vector_copy(v);
+    if(condition <= LINSOLVE_MIXED_MAX_CONDITION) {
+        lu_float_solve(&f, DATA(x), work, false);
+        struct lu_float_correction c = {&f, work};
+        converged = refine(M, v, x, limit, lu_float_correction, &c, &iter);
+    }
+    free(f.lu); free(f.pivot);
+    if(!converged) {
+        vector_free(x);
+        struct qr_decomp* qr = matrix_qr_decomposition(M);
+        x = linsolve_from_qr(qr, v);
+        refine(M, v, x, limit, qr_correction, qr, &iter);
+        qr_decomp_free(qr);
+    }
+
+    if(stats != NULL) {
+        stats->n_iter = iter;
+        stats->condition = condition;
+        stats->fallback = !converged;
+    }
+    return x;
+}
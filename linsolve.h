@@ -2,9 +2,27 @@
   (c) Matthew Drury, 2017
 */
 #pragma once
+#include <stdbool.h>
 #include "vector.h"
 #include "matrix.h"
 
 struct vector* linsolve_qr(struct matrix* M, struct vector* v);
 struct vector* linsolve_from_qr(struct qr_decomp* qr, struct vector* v);
 struct vector* linsolve_upper_triangular(struct matrix* M, struct vector* v);
+struct matrix* linsolve_upper_triangular_matrix(struct matrix* R, struct matrix* V);
+bool           linsolve_cholesky_in_place(double* G, double* b, int p);
+
+/* Factor in single precision, refine in double precision.  See
+   linsolve_mixed_precision.
+*/
+#define LINSOLVE_MIXED_MAX_CONDITION 1e6
+#define LINSOLVE_MIXED_MAX_ITER 30
+
+struct refinement_stats {
+    int n_iter;
+    double condition;
+    bool fallback;
+};
+
+struct vector* linsolve_mixed_precision(struct matrix* M, struct vector* v,
+                                        struct refinement_stats* stats);
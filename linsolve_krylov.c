@@ -0,0 +1,690 @@
+/* linsolve_krylov.c
+  (c) Alexis Rigaud, 2024
+
+  Conjugate gradients, MINRES, restarted GMRES and LSQR, with preconditioners.
+*/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include "vector.h"
+#include "matrix.h"
+#include "util.h"
+#include "linop.h"
+#include "linsolve_krylov.h"
+
+
+static double dot(const double* x, const double* y, int n) {
+    double s = 0;
+    for(int i = 0; i < n; i++) {
+        s += x[i] * y[i];
+    }
+    return s;
+}
+
+// r <- b - A x.
+static void residual_into(double* r, struct linop* A, const double* b, const double* x) {
+    A->apply(A->ctx, x, r);
+    for(int i = 0; i < A->n_row; i++) {
+        r[i] = b[i] - r[i];
+    }
+}
+
+// Fill stats with the true relative residual of x, using work (length n).
+static void finish_stats(struct krylov_stats* stats, int n_iter, bool converged,
+                         struct linop* A, const double* b, const double* x,
+                         double b_norm, double* work) {
+    if(stats == NULL) {
+        return;
+    }
+    residual_into(work, A, b, x);
+    stats->n_iter = n_iter;
+    stats->residual = (b_norm == 0) ? 0 : sqrt(dot(work, work, A->n_row)) / b_norm;
+    stats->converged = converged;
+}
+
+static void check_arguments(struct vector* x, struct linop* A, struct vector* b,
+                            struct linop* P) {
+    assert(A->n_row == A->n_col);
+    assert(b->length == A->n_row);
+    assert(x->length == A->n_col);
+    assert(P == NULL || (P->n_row == A->n_row && P->n_col == A->n_row));
+}
+
+
+/************************************
+ * Conjugate gradients.
+ ************************************/
+
+/* Preconditioned conjugate gradients.
+
+   Each step minimizes the A-norm of the error over the Krylov space
+   x_0 + span(z_0, A z_0, ...), through the short recurrences
+
+     alpha = (r, z) / (p, A p),   x <- x + alpha p,   r <- r - alpha A p,
+     z = P r,   p <- z + (r, z)_new / (r, z)_old p,
+
+   so only four vectors are kept.
+*/
+void linsolve_cg_into(struct vector* x, struct linop* A, struct vector* b,
+                      struct linop* P, double tol, int max_iter,
+                      struct krylov_stats* stats) {
+    check_arguments(x, A, b, P);
+    int n = A->n_row;
+    double* X = DATA(x);
+    const double* B = DATA(b);
+    double* work = malloc(sizeof(double) * 4 * n);
+    check_memory((void*) work);
+    double* r = work;
+    double* z = work + n;
+    double* p = work + 2 * n;
+    double* q = work + 3 * n;
+    if(P == NULL) {
+        z = r;
+    }
+
+    double b_norm = sqrt(dot(B, B, n));
+    residual_into(r, A, B, X);
+    double r_norm = sqrt(dot(r, r, n));
+    if(P != NULL) {
+        P->apply(P->ctx, r, z);
+    }
+    memcpy(p, z, sizeof(double) * n);
+    double rho = dot(r, z, n);
+
+    int iter = 0;
+    while(r_norm > tol * b_norm && iter < max_iter) {
+        A->apply(A->ctx, p, q);
+        double alpha = rho / dot(p, q, n);
+        for(int i = 0; i < n; i++) {
+            X[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+        iter++;
+        r_norm = sqrt(dot(r, r, n));
+        if(P != NULL) {
+            P->apply(P->ctx, r, z);
+        }
+        double rho_new = dot(r, z, n);
+        double beta = rho_new / rho;
+        rho = rho_new;
+        for(int i = 0; i < n; i++) {
+            p[i] = z[i] + beta * p[i];
+        }
+    }
+
+    finish_stats(stats, iter, r_norm <= tol * b_norm, A, B, X, b_norm, q);
+    free(work);
+}
+
+struct vector* linsolve_cg(struct linop* A, struct vector* b, struct linop* P,
+                           double tol, int max_iter, struct krylov_stats* stats) {
+    struct vector* x = vector_zeros(A->n_col);
+    linsolve_cg_into(x, A, b, P, tol, max_iter, stats);
+    return x;
+}
+
+
+/************************************
+ * MINRES.
+ ************************************/
+
+/* MINRES (Paige and Saunders), for symmetric, possibly indefinite, A.
+
+   The Lanczos process tridiagonalizes A (or P A, with P symmetric positive
+   definite), and x minimizes the residual over the Krylov space, which is
+   kept up to date by Givens rotations of the tridiagonal matrix.  The
+   residual norm comes for free, as phibar.  With a preconditioner, that is
+   the norm |r|_P = sqrt(r^t P r), and the stopping test is
+   |r|_P <= tol |b|_P.
+*/
+void linsolve_minres_into(struct vector* x, struct linop* A, struct vector* b,
+                          struct linop* P, double tol, int max_iter,
+                          struct krylov_stats* stats) {
+    check_arguments(x, A, b, P);
+    int n = A->n_row;
+    double* X = DATA(x);
+    const double* B = DATA(b);
+    double* work = malloc(sizeof(double) * 7 * n);
+    check_memory((void*) work);
+    double* r1 = work;
+    double* r2 = work + n;
+    double* y = work + 2 * n;
+    double* v = work + 3 * n;
+    double* w = work + 4 * n;
+    double* w1 = work + 5 * n;
+    double* w2 = work + 6 * n;
+
+    // The norm of b, in the norm the residual is measured in.
+    double b_norm = sqrt(dot(B, B, n));
+    double b_norm_P = b_norm;
+    if(P != NULL) {
+        P->apply(P->ctx, B, y);
+        b_norm_P = sqrt(dot(B, y, n));
+    }
+
+    residual_into(r1, A, B, X);
+    if(P != NULL) {
+        P->apply(P->ctx, r1, y);
+    } else {
+        memcpy(y, r1, sizeof(double) * n);
+    }
+    double beta1 = sqrt(dot(r1, y, n));
+    memcpy(r2, r1, sizeof(double) * n);
+    memset(w, 0, sizeof(double) * n);
+    memset(w2, 0, sizeof(double) * n);
+
+    double beta = beta1, old_beta = 0;
+    double dbar = 0, epsilon = 0, phibar = beta1;
+    double cs = -1, sn = 0;
+    int iter = 0;
+    while(phibar > tol * b_norm_P && iter < max_iter) {
+        for(int i = 0; i < n; i++) {
+            v[i] = y[i] / beta;
+        }
+        A->apply(A->ctx, v, y);
+        if(iter > 0) {
+            for(int i = 0; i < n; i++) {
+                y[i] -= (beta / old_beta) * r1[i];
+            }
+        }
+        double alpha = dot(v, y, n);
+        for(int i = 0; i < n; i++) {
+            y[i] -= (alpha / beta) * r2[i];
+        }
+        double* tmp = r1; r1 = r2; r2 = tmp;
+        memcpy(r2, y, sizeof(double) * n);
+        if(P != NULL) {
+            P->apply(P->ctx, r2, y);
+        }
+        old_beta = beta;
+        beta = sqrt(dot(r2, y, n));
+
+        // Apply the previous rotation, then eliminate beta by a new one.
+        double old_epsilon = epsilon;
+        double delta = cs * dbar + sn * alpha;
+        double gbar = sn * dbar - cs * alpha;
+        epsilon = sn * beta;
+        dbar = -cs * beta;
+        double gamma = hypot(gbar, beta);
+        if(gamma == 0) {
+            gamma = DBL_EPSILON;
+        }
+        cs = gbar / gamma;
+        sn = beta / gamma;
+        double phi = cs * phibar;
+        phibar = sn * phibar;
+
+        // Update the search direction and the solution.
+        tmp = w1; w1 = w2; w2 = w; w = tmp;
+        for(int i = 0; i < n; i++) {
+            w[i] = (v[i] - old_epsilon * w1[i] - delta * w2[i]) / gamma;
+            X[i] += phi * w[i];
+        }
+        iter++;
+        if(beta == 0) {
+            // The Krylov space is invariant, x is exact.
+            phibar = 0;
+        }
+    }
+
+    finish_stats(stats, iter, phibar <= tol * b_norm_P, A, B, X, b_norm, v);
+    free(work);
+}
+
+struct vector* linsolve_minres(struct linop* A, struct vector* b, struct linop* P,
+                               double tol, int max_iter, struct krylov_stats* stats) {
+    struct vector* x = vector_zeros(A->n_col);
+    linsolve_minres_into(x, A, b, P, tol, max_iter, stats);
+    return x;
+}
+
+
+/************************************
+ * GMRES.
+ ************************************/
+
+/* Restarted GMRES(m), right preconditioned.
+
+   Each cycle builds an orthonormal basis v_0, ..., v_m of the Krylov space
+   of A P from the current residual (Arnoldi, with modified Gram-Schmidt done
+   twice), and picks the x in x + P span(v_0, ..., v_{m-1}) of smallest
+   residual, a small least squares problem with the Hessenberg matrix H that
+   is reduced to triangular form by Givens rotations as it grows.  The last
+   entry of the rotated right hand side is the residual norm.  The basis is
+   then discarded and the iterations restart from the new residual.
+*/
+void linsolve_gmres_into(struct vector* x, struct linop* A, struct vector* b,
+                         struct linop* P, int restart, double tol, int max_iter,
+                         struct krylov_stats* stats) {
+    check_arguments(x, A, b, P);
+    assert(restart >= 1);
+    int n = A->n_row;
+    int m = (restart < n) ? restart : n;
+    double* X = DATA(x);
+    const double* B = DATA(b);
+    double* V = malloc(sizeof(double) * (size_t) (m + 1) * n);
+    check_memory((void*) V);
+    double* w = malloc(sizeof(double) * 2 * n);
+    check_memory((void*) w);
+    double* z = w + n;
+    double* H = malloc(sizeof(double) * ((m + 1) * m + 4 * (m + 1)));
+    check_memory((void*) H);
+    double* cs = H + (m + 1) * m;
+    double* sn = cs + (m + 1);
+    double* g = sn + (m + 1);
+    double* y = g + (m + 1);
+
+    double b_norm = sqrt(dot(B, B, n));
+    int iter = 0;
+    bool converged = false;
+    for(;;) {
+        residual_into(V, A, B, X);
+        double beta = sqrt(dot(V, V, n));
+        converged = beta <= tol * b_norm;
+        if(converged || iter >= max_iter) {
+            break;
+        }
+        for(int i = 0; i < n; i++) {
+            V[i] /= beta;
+        }
+        for(int i = 0; i <= m; i++) {
+            g[i] = 0;
+        }
+        g[0] = beta;
+
+        int j = 0;
+        while(j < m && iter < max_iter) {
+            double* vj = V + (size_t) j * n;
+            if(P != NULL) {
+                P->apply(P->ctx, vj, z);
+                A->apply(A->ctx, z, w);
+            } else {
+                A->apply(A->ctx, vj, w);
+            }
+            for(int i = 0; i <= j; i++) {
+                H[i * m + j] = 0;
+            }
+            for(int pass = 0; pass < 2; pass++) {
+                for(int i = 0; i <= j; i++) {
+                    const double* vi = V + (size_t) i * n;
+                    double h = dot(vi, w, n);
+                    H[i * m + j] += h;
+                    for(int r = 0; r < n; r++) {
+                        w[r] -= h * vi[r];
+                    }
+                }
+            }
+            double h_next = sqrt(dot(w, w, n));
+            if(h_next > 0) {
+                double* v_next = V + (size_t) (j + 1) * n;
+                for(int r = 0; r < n; r++) {
+                    v_next[r] = w[r] / h_next;
+                }
+            }
+
+            // Rotate the new column of H with the previous rotations, then
+            // zero its subdiagonal entry h_next.
+            for(int i = 0; i < j; i++) {
+                double t = cs[i] * H[i * m + j] + sn[i] * H[(i + 1) * m + j];
+                H[(i + 1) * m + j] = -sn[i] * H[i * m + j] + cs[i] * H[(i + 1) * m + j];
+                H[i * m + j] = t;
+            }
+            double rr = hypot(H[j * m + j], h_next);
+            cs[j] = (rr == 0) ? 1 : H[j * m + j] / rr;
+            sn[j] = (rr == 0) ? 0 : h_next / rr;
+            H[j * m + j] = rr;
+            g[j + 1] = -sn[j] * g[j];
+            g[j] = cs[j] * g[j];
+            iter++;
+            j++;
+            if(fabs(g[j]) <= tol * b_norm || h_next == 0) {
+                break;
+            }
+        }
+
+        // Solve the triangular system H y = g, then x <- x + P V^t y.
+        for(int i = j - 1; i >= 0; i--) {
+            double s = g[i];
+            for(int l = i + 1; l < j; l++) {
+                s -= H[i * m + l] * y[l];
+            }
+            y[i] = s / H[i * m + i];
+        }
+        memset(w, 0, sizeof(double) * n);
+        for(int i = 0; i < j; i++) {
+            const double* vi = V + (size_t) i * n;
+            for(int r = 0; r < n; r++) {
+                w[r] += y[i] * vi[r];
+            }
+        }
+        const double* dx = w;
+        if(P != NULL) {
+            P->apply(P->ctx, w, z);
+            dx = z;
+        }
+        for(int r = 0; r < n; r++) {
+            X[r] += dx[r];
+        }
+    }
+
+    finish_stats(stats, iter, converged, A, B, X, b_norm, w);
+    free(V); free(w); free(H);
+}
+
+struct vector* linsolve_gmres(struct linop* A, struct vector* b, struct linop* P,
+                              int restart, double tol, int max_iter,
+                              struct krylov_stats* stats) {
+    struct vector* x = vector_zeros(A->n_col);
+    linsolve_gmres_into(x, A, b, P, restart, tol, max_iter, stats);
+    return x;
+}
+
+
+/************************************
+ * LSQR.
+ ************************************/
+
+/* LSQR (Paige and Saunders), for the least squares problem min |A x - b|
+   with any A, given products with A and A^t.
+
+   Golub-Kahan bidiagonalization of B = A P builds orthonormal bases u of
+   the range and v of the domain, and z minimizes |B z - r_0| over the
+   Krylov space, kept up to date by Givens rotations of the bidiagonal
+   matrix; x = x_0 + P z.  Both |r| (phibar) and |B^t r| come for free, and
+   the iterations stop when
+
+     |r| <= tol |b|   or   |B^t r| <= tol |B| |r|,
+
+   where |B| is estimated by the Frobenius norm of the bidiagonal matrix so
+   far.  The second test is the one met by inconsistent systems.  P is a
+   right preconditioner, which must have apply_transpose: with P = R^-1 for
+   the R of a QR decomposition of a sketch S A, B is well conditioned and a
+   few iterations are enough, whatever the conditioning of A.
+*/
+void linsolve_lsqr_into(struct vector* x, struct linop* A, struct vector* b,
+                        struct linop* P, double tol, int max_iter,
+                        struct krylov_stats* stats) {
+    assert(b->length == A->n_row);
+    assert(x->length == A->n_col);
+    assert(A->apply_transpose != NULL);
+    assert(P == NULL || (P->n_row == A->n_col && P->n_col == A->n_col
+                         && P->apply_transpose != NULL));
+    int m = A->n_row, n = A->n_col;
+    double* X = DATA(x);
+    const double* B = DATA(b);
+    double* work = malloc(sizeof(double) * (2 * m + 5 * n));
+    check_memory((void*) work);
+    double* u = work;
+    double* q = work + m;
+    double* v = work + 2 * m;
+    double* w = v + n;
+    double* z = v + 2 * n;
+    double* t = v + 3 * n;
+    double* Pt = v + 4 * n;
+
+    double b_norm = sqrt(dot(B, B, m));
+    residual_into(u, A, B, X);
+    double beta = sqrt(dot(u, u, m));
+    double alpha = 0;
+    if(beta > 0) {
+        for(int i = 0; i < m; i++) {
+            u[i] /= beta;
+        }
+        // v = B^t u = P^t A^t u.
+        A->apply_transpose(A->ctx, u, t);
+        if(P != NULL) {
+            P->apply_transpose(P->ctx, t, v);
+        } else {
+            memcpy(v, t, sizeof(double) * n);
+        }
+        alpha = sqrt(dot(v, v, n));
+    }
+    if(alpha > 0) {
+        for(int j = 0; j < n; j++) {
+            v[j] /= alpha;
+        }
+    }
+    memcpy(w, v, sizeof(double) * n);
+    memset(z, 0, sizeof(double) * n);
+    double phibar = beta, rhobar = alpha, B_norm = 0;
+    double r_norm = beta, Btr_norm = alpha * beta;
+
+    int iter = 0;
+    bool converged = r_norm <= tol * b_norm || Btr_norm == 0;
+    while(!converged && iter < max_iter) {
+        // u = B v - alpha u.
+        if(P != NULL) {
+            P->apply(P->ctx, v, t);
+            A->apply(A->ctx, t, q);
+        } else {
+            A->apply(A->ctx, v, q);
+        }
+        for(int i = 0; i < m; i++) {
+            u[i] = q[i] - alpha * u[i];
+        }
+        beta = sqrt(dot(u, u, m));
+        B_norm = sqrt(B_norm * B_norm + alpha * alpha + beta * beta);
+        if(beta > 0) {
+            for(int i = 0; i < m; i++) {
+                u[i] /= beta;
+            }
+            // v = B^t u - beta v.
+            A->apply_transpose(A->ctx, u, t);
+            if(P != NULL) {
+                P->apply_transpose(P->ctx, t, Pt);
+            } else {
+                memcpy(Pt, t, sizeof(double) * n);
+            }
+            for(int j = 0; j < n; j++) {
+                v[j] = Pt[j] - beta * v[j];
+            }
+            alpha = sqrt(dot(v, v, n));
+            if(alpha > 0) {
+                for(int j = 0; j < n; j++) {
+                    v[j] /= alpha;
+                }
+            }
+        } else {
+            alpha = 0;
+        }
+
+        double rho = hypot(rhobar, beta);
+        double c = rhobar / rho, s = beta / rho;
+        double theta = s * alpha;
+        rhobar = -c * alpha;
+        double phi = c * phibar;
+        phibar = s * phibar;
+        for(int j = 0; j < n; j++) {
+            z[j] += (phi / rho) * w[j];
+            w[j] = v[j] - (theta / rho) * w[j];
+        }
+        iter++;
+        r_norm = phibar;
+        Btr_norm = phibar * alpha * fabs(c);
+        converged = r_norm <= tol * b_norm || Btr_norm <= tol * B_norm * r_norm;
+    }
+
+    // x = x_0 + P z.
+    if(P != NULL) {
+        P->apply(P->ctx, z, t);
+    } else {
+        memcpy(t, z, sizeof(double) * n);
+    }
+    for(int j = 0; j < n; j++) {
+        X[j] += t[j];
+    }
+    finish_stats(stats, iter, converged, A, B, X, b_norm, q);
+    free(work);
+}
+
+struct vector* linsolve_lsqr(struct linop* A, struct vector* b, struct linop* P,
+                             double tol, int max_iter, struct krylov_stats* stats) {
+    struct vector* x = vector_zeros(A->n_col);
+    linsolve_lsqr_into(x, A, b, P, tol, max_iter, stats);
+    return x;
+}
+
+
+/************************************
+ * Preconditioners.
+ ************************************/
+
+struct jacobi {
+    int n;
+    double* inverse_diagonal;
+};
+
+static void jacobi_apply(void* ctx, const double* x, double* y) {
+    struct jacobi* jac = ctx;
+    for(int i = 0; i < jac->n; i++) {
+        y[i] = jac->inverse_diagonal[i] * x[i];
+    }
+}
+
+static void jacobi_free(void* ctx) {
+    struct jacobi* jac = ctx;
+    free(jac->inverse_diagonal);
+    free(jac);
+}
+
+struct linop* precond_jacobi(struct vector* diagonal) {
+    int n = diagonal->length;
+    struct jacobi* jac = malloc(sizeof(struct jacobi));
+    check_memory((void*) jac);
+    jac->n = n;
+    jac->inverse_diagonal = malloc(sizeof(double) * n);
+    check_memory((void*) jac->inverse_diagonal);
+    for(int i = 0; i < n; i++) {
+        assert(VECTOR_IDX_INTO(diagonal, i) != 0);
+        jac->inverse_diagonal[i] = 1 / VECTOR_IDX_INTO(diagonal, i);
+    }
+    struct linop* P = linop_new(n, n, jacobi_apply, jacobi_apply, (void*) jac);
+    P->free_ctx = jacobi_free;
+    return P;
+}
+
+/* The factor L of an incomplete Cholesky factorization, stored by rows: the
+   entries of row i are value[start[i]..start[i+1]), in increasing column
+   order, the diagonal entry last.
+*/
+struct incomplete_cholesky {
+    int n;
+    int* start;
+    int* column;
+    double* value;
+};
+
+/* Fill value with L for the matrix M + alpha diag(M) restricted to the
+   pattern.  Entry (i, k) is
+
+     L_ik = (M_ik - sum_{j < k} L_ij L_kj) / L_kk
+
+   where the sum runs over the common pattern of rows i and k.  Returns false
+   if a pivot is not positive.
+*/
+static bool incomplete_cholesky_factor(struct incomplete_cholesky* ic,
+                                       struct matrix* M, double alpha) {
+    for(int i = 0; i < ic->n; i++) {
+        int diag = ic->start[i + 1] - 1;
+        double d = MATRIX_IDX_INTO(M, i, i) * (1 + alpha);
+        for(int idx = ic->start[i]; idx < diag; idx++) {
+            int k = ic->column[idx];
+            double s = MATRIX_IDX_INTO(M, i, k);
+            // Both rows are sorted, so their common columns below k are
+            // found by merging.
+            int a = ic->start[i], b = ic->start[k], b_end = ic->start[k + 1] - 1;
+            while(a < idx && b < b_end) {
+                if(ic->column[a] < ic->column[b]) {
+                    a++;
+                } else if(ic->column[a] > ic->column[b]) {
+                    b++;
+                } else {
+                    s -= ic->value[a++] * ic->value[b++];
+                }
+            }
+            ic->value[idx] = s / ic->value[b_end];
+            d -= ic->value[idx] * ic->value[idx];
+        }
+        if(!(d > 0)) {
+            return false;
+        }
+        ic->value[diag] = sqrt(d);
+    }
+    return true;
+}
+
+// y = (L L^t)^{-1} x, by forward then backward substitution.
+static void incomplete_cholesky_apply(void* ctx, const double* x, double* y) {
+    struct incomplete_cholesky* ic = ctx;
+    for(int i = 0; i < ic->n; i++) {
+        int diag = ic->start[i + 1] - 1;
+        double s = x[i];
+        for(int idx = ic->start[i]; idx < diag; idx++) {
+            s -= ic->value[idx] * y[ic->column[idx]];
+        }
+        y[i] = s / ic->value[diag];
+    }
+    // L^t is stored by columns, so its solve goes column by column.
+    for(int i = ic->n - 1; i >= 0; i--) {
+        int diag = ic->start[i + 1] - 1;
+        y[i] /= ic->value[diag];
+        for(int idx = ic->start[i]; idx < diag; idx++) {
+            y[ic->column[idx]] -= ic->value[idx] * y[i];
+        }
+    }
+}
+
+static void incomplete_cholesky_free(void* ctx) {
+    struct incomplete_cholesky* ic = ctx;
+    free(ic->start); free(ic->column); free(ic->value);
+    free(ic);
+}
+
+struct linop* precond_incomplete_cholesky(struct matrix* M) {
+    assert(M->n_row == M->n_col);
+    int n = M->n_row;
+    struct incomplete_cholesky* ic = malloc(sizeof(struct incomplete_cholesky));
+    check_memory((void*) ic);
+    ic->n = n;
+    ic->start = malloc(sizeof(int) * (n + 1));
+    check_memory((void*) ic->start);
+
+    // The pattern: nonzero entries of the lower triangle, and the diagonal.
+    int nnz = 0;
+    for(int i = 0; i < n; i++) {
+        assert(MATRIX_IDX_INTO(M, i, i) > 0);
+        ic->start[i] = nnz;
+        for(int j = 0; j < i; j++) {
+            nnz += (MATRIX_IDX_INTO(M, i, j) != 0);
+        }
+        nnz++;
+    }
+    ic->start[n] = nnz;
+    ic->column = malloc(sizeof(int) * nnz);
+    check_memory((void*) ic->column);
+    ic->value = malloc(sizeof(double) * nnz);
+    check_memory((void*) ic->value);
+    for(int i = 0; i < n; i++) {
+        int idx = ic->start[i];
+        for(int j = 0; j < i; j++) {
+            if(MATRIX_IDX_INTO(M, i, j) != 0) {
+                ic->column[idx++] = j;
+            }
+        }
+        ic->column[idx] = i;
+    }
+
+    // The diagonal shift of Manteuffel when the factorization breaks down.
+    double alpha = 0;
+    while(!incomplete_cholesky_factor(ic, M, alpha)) {
+        alpha = (alpha == 0) ? 0.001 : 2 * alpha;
+    }
+
+    struct linop* P = linop_new(n, n, incomplete_cholesky_apply, incomplete_cholesky_apply,
+                                (void*) ic);
+    P->free_ctx = incomplete_cholesky_free;
+    return P;
+}
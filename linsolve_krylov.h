@@ -0,0 +1,72 @@
+/* linsolve_krylov.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+#include "linop.h"
+
+/* Iterative solvers for A x = b, needing only products with A.
+
+   A is a struct linop, so it may be a dense matrix (linop_from_matrix) or a
+   sparse or implicit operator, and the memory used is O(n) besides A (O(n m)
+   for GMRES restarted every m steps).
+
+   linsolve_cg is for symmetric positive definite A, linsolve_minres for
+   symmetric (possibly indefinite) A, and linsolve_gmres for any square A.
+   The iterations stop when |b - A x| <= tol |b| (in the norm given by P for
+   preconditioned MINRES), or after max_iter products with A.  P is a
+   preconditioner, an operator approximating the inverse of A, or NULL.  It
+   must be symmetric positive definite for CG and MINRES, and is applied on
+   the right for GMRES.
+
+   The _into versions start from the initial guess in x, and leave the
+   solution there.  When stats is not NULL, it receives the number of
+   iterations and the final relative residual |b - A x| / |b|.
+*/
+struct krylov_stats {
+    int n_iter;
+    double residual;
+    bool converged;
+};
+
+struct vector* linsolve_cg(struct linop* A, struct vector* b, struct linop* P,
+                           double tol, int max_iter, struct krylov_stats* stats);
+void           linsolve_cg_into(struct vector* x, struct linop* A, struct vector* b,
+                                struct linop* P, double tol, int max_iter,
+                                struct krylov_stats* stats);
+struct vector* linsolve_minres(struct linop* A, struct vector* b, struct linop* P,
+                               double tol, int max_iter, struct krylov_stats* stats);
+void           linsolve_minres_into(struct vector* x, struct linop* A, struct vector* b,
+                                    struct linop* P, double tol, int max_iter,
+                                    struct krylov_stats* stats);
+struct vector* linsolve_gmres(struct linop* A, struct vector* b, struct linop* P,
+                              int restart, double tol, int max_iter,
+                              struct krylov_stats* stats);
+void           linsolve_gmres_into(struct vector* x, struct linop* A, struct vector* b,
+                                   struct linop* P, int restart, double tol, int max_iter,
+                                   struct krylov_stats* stats);
+
+/* Least squares, min |A x - b| for a rectangular A (with apply_transpose),
+   by LSQR.  P, when not NULL, is a right preconditioner (n_col square, with
+   apply_transpose).  It stops when |b - A x| <= tol |b|, or when
+   |(A P)^t r| <= tol |A P| |r| at the least squares solution.
+*/
+struct vector* linsolve_lsqr(struct linop* A, struct vector* b, struct linop* P,
+                             double tol, int max_iter, struct krylov_stats* stats);
+void           linsolve_lsqr_into(struct vector* x, struct linop* A, struct vector* b,
+                                  struct linop* P, double tol, int max_iter,
+                                  struct krylov_stats* stats);
+
+/* Preconditioners, freed by linop_free.
+
+   precond_jacobi divides by the diagonal of A.  precond_incomplete_cholesky
+   is the incomplete Cholesky factorization L L^t of a symmetric positive
+   definite matrix with no fill (IC(0)): L keeps the nonzero pattern of the
+   lower triangle of M, and applying it costs two sparse triangular solves.
+   If the factorization breaks down, it is retried on M + alpha diag(M) for
+   growing alpha.
+*/
+struct linop* precond_jacobi(struct vector* diagonal);
+struct linop* precond_incomplete_cholesky(struct matrix* M);
@@ -8,6 +8,7 @@
 #include "vector.h"
 #include "matrix.h"
 #include "rand.h"
+#include "svd.h"
 #include "kernel.h"
 
 /*
@@ -46,6 +47,22 @@ void time_qr_decomp() {
     );
 }
 
+/* The completion of U to a square matrix is O(n^2 p), a full SVD of a tall
+   matrix should take a small fraction of a second.
+*/
+void time_svd_full() {
+    clock_t start = clock(), diff;
+    struct matrix* M = matrix_random_uniform(2000, 5, 0, 1);
+    struct svd* svd = matrix_svd(M, SVD_FULL, 1e-12, 50);
+    matrix_free(M); svd_free(svd);
+    diff = clock() - start;
+
+    int msec = diff * 1000 / CLOCKS_PER_SEC;
+    printf("Full svd took  %d seconds and %d milliseconds.\n",
+            msec / 1000, msec % 1000
+    );
+}
+
 int main(int argc, char** argv) {
 
 #if OCL_KERNELS_SUPPORTED
@@ -53,6 +70,7 @@ int main(int argc, char** argv) {
 #endif
     init_random();
     run_all();
+    opencl_shutdown();
 
     return 0;
 }
@@ -27,6 +27,7 @@ struct matrix* matrix_new(int n_row, int n_col) {
 
     new_matrix->n_row = n_row;
     new_matrix->n_col = n_col;
+    new_matrix->device = NULL;
     OWNS_MEMORY(new_matrix) = true;
     MEMORY_OWNER(new_matrix) = NULL;
     REF_COUNT(new_matrix) = 0;
@@ -34,6 +35,27 @@ struct matrix* matrix_new(int n_row, int n_col) {
     return new_matrix;
 }
 
+/* Create a new matrix which is a *view* into memory owned by parent, as
+   vector_new_view does for vectors.
+*/
+struct matrix* matrix_new_view(struct linalg_obj* parent, double* view,
+                               int n_row, int n_col) {
+    assert(n_row >= 1 && n_col >= 1);
+    struct matrix* new_matrix = malloc(sizeof(struct matrix));
+    check_memory((void*) new_matrix);
+
+    DATA(new_matrix) = view;
+    new_matrix->n_row = n_row;
+    new_matrix->n_col = n_col;
+    new_matrix->device = NULL;
+    OWNS_MEMORY(new_matrix) = false;
+    MEMORY_OWNER(new_matrix) = parent;
+    REF_COUNT(new_matrix) = 0;
+    REF_COUNT(parent) += 1;
+
+    return new_matrix;
+}
+
 struct matrix* matrix_from_array(double* data, int n_row, int n_col) {
     assert(n_row >= 1 && n_col >= 1);
     struct matrix* M = matrix_new(n_row, n_col);
@@ -69,6 +91,9 @@ void matrix_to_matlab(double* data, struct matrix* M) {
 
 void matrix_free(struct matrix* M) {
     struct linalg_obj* mem_owner;
+    if(M->device != NULL) {
+        matrix_device_free(M);
+    }
     if(OWNS_MEMORY(M)) {
         if(REF_COUNT(M) == 0) {
             free(DATA(M));
@@ -433,7 +458,10 @@ struct qr_decomp* qr_decomp_new(struct matrix* M) {
 }
 
 void qr_decomp_free(struct qr_decomp* qr) {
-    matrix_free(qr->q);
+    // Q-less decompositions (see qr_update.h) only carry R.
+    if(qr->q != NULL) {
+        matrix_free(qr->q);
+    }
     matrix_free(qr->r);
     free(qr);
 }
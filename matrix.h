@@ -11,6 +11,8 @@ struct matrix {
     struct linalg_obj la_obj;
     int n_row;
     int n_col;
+    // The copy on an OpenCL device, or NULL (see kernel.h).
+    struct device_copy* device;
 };
 
 
@@ -24,6 +26,8 @@ struct matrix {
 
 
 struct matrix* matrix_new(int n_row, int n_col);
+struct matrix* matrix_new_view(struct linalg_obj* parent, double* view,
+                               int n_row, int n_col);
 struct matrix* matrix_from_array(double* data, int n_row, int n_col);
 
 struct matrix* matrix_from_matlab(double* data, int n_row, int n_col);
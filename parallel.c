@@ -0,0 +1,198 @@
+/* parallel.c
+  (c) Alexis Rigaud, 2024
+
+  Thread pool behind parallel_for.
+*/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "util.h"
+#include "parallel.h"
+
+/* The pool state.  Workers sleep on `wake` until a new job generation is
+   posted, then pull chunks of task indices from `next` until the job is
+   exhausted.  The thread posting the job works on it too, as thread 0.
+*/
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done = PTHREAD_COND_INITIALIZER;
+
+static int        n_threads = 0;
+static pthread_t* workers = NULL;
+static int        n_workers = 0;
+static bool       stopping = false;
+static bool       busy = false;
+
+static struct {
+    void (*task)(void* arg, int i, int thread_idx);
+    void* arg;
+    int n_tasks;
+    int chunk;
+    int next;
+    int n_participants;
+    int n_running;
+    unsigned long generation;
+} job;
+
+static int default_num_threads(void) {
+    char* env = getenv("LINALG_NUM_THREADS");
+    if(env != NULL && atoi(env) > 0) {
+        return atoi(env);
+    }
+    long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n_cpu > 0) ? (int) n_cpu : 1;
+}
+
+int parallel_num_threads(void) {
+    pthread_mutex_lock(&pool_lock);
+    if(n_threads == 0) {
+        n_threads = default_num_threads();
+    }
+    int n = n_threads;
+    pthread_mutex_unlock(&pool_lock);
+    return n;
+}
+
+/* Run chunks of the current job until none are left.  Called with the lock
+   held, returns with the lock held.
+*/
+static void run_chunks(int thread_idx) {
+    while(job.next < job.n_tasks) {
+        int begin = job.next;
+        int end = begin + job.chunk < job.n_tasks ? begin + job.chunk : job.n_tasks;
+        job.next = end;
+        pthread_mutex_unlock(&pool_lock);
+        for(int i = begin; i < end; i++) {
+            job.task(job.arg, i, thread_idx);
+        }
+        pthread_mutex_lock(&pool_lock);
+    }
+}
+
+static void* worker_main(void* arg) {
+    int thread_idx = (int) (long) arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool_lock);
+    while(true) {
+        while(!stopping && (job.generation == seen || thread_idx >= job.n_participants)) {
+            if(job.generation != seen) {
+                // Not needed for this job.
+                seen = job.generation;
+            }
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        if(stopping) {
+            break;
+        }
+        seen = job.generation;
+        job.n_running++;
+        run_chunks(thread_idx);
+        job.n_running--;
+        if(job.n_running == 0) {
+            pthread_cond_signal(&pool_done);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+/* Start the worker threads, called with the lock held. */
+static void start_workers(void) {
+    if(n_threads == 0) {
+        n_threads = default_num_threads();
+    }
+    n_workers = n_threads - 1;
+    if(n_workers == 0) {
+        return;
+    }
+    workers = malloc(sizeof(pthread_t) * n_workers);
+    check_memory((void*) workers);
+    for(int t = 0; t < n_workers; t++) {
+        pthread_create(&workers[t], NULL, worker_main, (void*) (long) (t + 1));
+    }
+}
+
+/* Stop and join the worker threads.  They are restarted on the next call to
+   parallel_for.
+*/
+void parallel_shutdown(void) {
+    pthread_mutex_lock(&pool_lock);
+    assert(!busy);
+    stopping = true;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+    for(int t = 0; t < n_workers; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    pthread_mutex_lock(&pool_lock);
+    free(workers);
+    workers = NULL;
+    n_workers = 0;
+    stopping = false;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void parallel_set_num_threads(int new_n_threads) {
+    assert(new_n_threads >= 1);
+    parallel_shutdown();
+    pthread_mutex_lock(&pool_lock);
+    n_threads = new_n_threads;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void parallel_for(int n_tasks, int grain,
+                  void (*task)(void* arg, int i, int thread_idx), void* arg) {
+    assert(grain >= 1);
+    if(n_tasks <= 0) {
+        return;
+    }
+    int n_wanted = n_tasks / grain;
+
+    pthread_mutex_lock(&pool_lock);
+    if(busy || n_wanted <= 1) {
+        pthread_mutex_unlock(&pool_lock);
+        for(int i = 0; i < n_tasks; i++) {
+            task(arg, i, 0);
+        }
+        return;
+    }
+    if(workers == NULL && n_workers == 0) {
+        start_workers();
+    }
+    int n_participants = n_workers + 1;
+    if(n_wanted < n_participants) {
+        n_participants = n_wanted;
+    }
+    if(n_participants <= 1) {
+        pthread_mutex_unlock(&pool_lock);
+        for(int i = 0; i < n_tasks; i++) {
+            task(arg, i, 0);
+        }
+        return;
+    }
+
+    busy = true;
+    job.task = task;
+    job.arg = arg;
+    job.n_tasks = n_tasks;
+    // A few chunks per thread, so uneven tasks still balance.
+    job.chunk = n_tasks / (4 * n_participants);
+    if(job.chunk < 1) {
+        job.chunk = 1;
+    }
+    job.next = 0;
+    job.n_participants = n_participants;
+    job.n_running = 1;
+    job.generation++;
+    pthread_cond_broadcast(&pool_wake);
+
+    run_chunks(0);
+    job.n_running--;
+    while(job.n_running > 0 || job.next < job.n_tasks) {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    busy = false;
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,23 @@
+/* parallel.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+
+/* A small pool of worker threads, shared by the whole library.
+
+   parallel_for(n_tasks, grain, task, arg) calls task(arg, i, thread_idx) for
+   every i in [0, n_tasks), spreading the calls over the pool.  thread_idx is
+   in [0, parallel_num_threads()) and identifies the calling thread, so tasks
+   can use per thread workspaces.  At most n_tasks / grain threads are used,
+   grain being the smallest number of tasks worth handing to a thread.
+
+   The number of threads defaults to the number of online processors, or to
+   the LINALG_NUM_THREADS environment variable when it is set.  A parallel_for
+   called from inside a task (or while another one is running) runs serially
+   in the calling thread.
+*/
+int  parallel_num_threads(void);
+void parallel_set_num_threads(int n_threads);
+void parallel_for(int n_tasks, int grain,
+                  void (*task)(void* arg, int i, int thread_idx), void* arg);
+void parallel_shutdown(void);
@@ -0,0 +1,492 @@
+/* qr_update.c
+  (c) Alexis Rigaud, 2024
+
+  Givens rotation updates of a QR decomposition.
+*/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include "vector.h"
+#include "matrix.h"
+#include "util.h"
+#include "qr_update.h"
+
+/* Compute a Givens rotation G = [c s; -s c] such that G [a; b] = [r; 0], with
+   r = sqrt(a^2 + b^2) >= 0.
+*/
+static void givens(double a, double b, double* c, double* s) {
+    double r = hypot(a, b);
+    if(r == 0) {
+        *c = 1; *s = 0;
+    } else {
+        *c = a / r; *s = b / r;
+    }
+}
+
+/* Apply a Givens rotation to rows i and k of M, starting at column col_begin
+   (the entries to the left are known to be zero in both rows).
+*/
+static void rotate_rows(struct matrix* M, int i, int k, double c, double s,
+                        int col_begin) {
+    double* row_i = DATA(M) + i * M->n_col;
+    double* row_k = DATA(M) + k * M->n_col;
+    double t_i, t_k;
+    for(int j = col_begin; j < M->n_col; j++) {
+        t_i = row_i[j]; t_k = row_k[j];
+        row_i[j] = c * t_i + s * t_k;
+        row_k[j] = -s * t_i + c * t_k;
+    }
+}
+
+/* Apply the transpose of a Givens rotation to columns i and k of M, so that
+   if R' = G R then Q' = Q G^t keeps the product Q R unchanged.
+*/
+static void rotate_columns(struct matrix* M, int i, int k, double c, double s) {
+    double t_i, t_k;
+    for(int r = 0; r < M->n_row; r++) {
+        t_i = MATRIX_IDX_INTO(M, r, i); t_k = MATRIX_IDX_INTO(M, r, k);
+        MATRIX_IDX_INTO(M, r, i) = c * t_i + s * t_k;
+        MATRIX_IDX_INTO(M, r, k) = -s * t_i + c * t_k;
+    }
+}
+
+/* Copy the top left n_row x n_col block of M into a new matrix. */
+static struct matrix* leading_block(struct matrix* M, int n_row, int n_col) {
+    struct matrix* B = matrix_new(n_row, n_col);
+    for(int i = 0; i < n_row; i++) {
+        for(int j = 0; j < n_col; j++) {
+            MATRIX_IDX_INTO(B, i, j) = MATRIX_IDX_INTO(M, i, j);
+        }
+    }
+    return B;
+}
+
+/* Orthogonalize w against the columns of Q, storing the projection
+   coefficients in coef, and return the norm of what is left of w.
+
+   Two passes of Gram-Schmidt are done, the second one removes the rounding
+   error left by the first when w is nearly in the span of Q.  If w is in the
+   span of Q (to working precision) it is set to zero.
+*/
+static double orthogonalize(struct matrix* q, struct vector* w, double* coef) {
+    double scale = vector_norm(w);
+    double dp;
+    for(int j = 0; j < q->n_col; j++) {
+        coef[j] = 0;
+    }
+    for(int pass = 0; pass < 2; pass++) {
+        for(int j = 0; j < q->n_col; j++) {
+            dp = 0;
+            for(int i = 0; i < q->n_row; i++) {
+                dp += MATRIX_IDX_INTO(q, i, j) * VECTOR_IDX_INTO(w, i);
+            }
+            for(int i = 0; i < q->n_row; i++) {
+                VECTOR_IDX_INTO(w, i) -= dp * MATRIX_IDX_INTO(q, i, j);
+            }
+            coef[j] += dp;
+        }
+    }
+    double norm = vector_norm(w);
+    if(norm <= 16 * DBL_EPSILON * scale) {
+        for(int i = 0; i < w->length; i++) {
+            VECTOR_IDX_INTO(w, i) = 0;
+        }
+        return 0;
+    }
+    for(int i = 0; i < w->length; i++) {
+        VECTOR_IDX_INTO(w, i) /= norm;
+    }
+    return norm;
+}
+
+/* Flip the sign of any row of R with a negative diagonal entry (and of the
+   matching column of Q), so updated decompositions keep the same positive
+   diagonal convention as matrix_qr_decomposition.
+*/
+static void fix_signs(struct qr_decomp* qr) {
+    struct matrix* r = qr->r;
+    for(int i = 0; i < r->n_row; i++) {
+        if(MATRIX_IDX_INTO(r, i, i) < 0) {
+            for(int j = i; j < r->n_col; j++) {
+                MATRIX_IDX_INTO(r, i, j) = -MATRIX_IDX_INTO(r, i, j);
+            }
+            if(qr->q != NULL) {
+                for(int k = 0; k < qr->q->n_row; k++) {
+                    MATRIX_IDX_INTO(qr->q, k, i) = -MATRIX_IDX_INTO(qr->q, k, i);
+                }
+            }
+        }
+    }
+}
+
+/* Create the (Q-less) decomposition of a matrix with n_col columns and no
+   rows yet, R is zero.  Rows can then be folded in with qr_decomp_add_row.
+*/
+struct qr_decomp* qr_decomp_empty(int n_col) {
+    assert(n_col >= 1);
+    struct qr_decomp* qr = qr_decomp_new(NULL);
+    qr->q = NULL;
+    qr->r = matrix_zeros(n_col, n_col);
+    return qr;
+}
+
+/* Fold a new row x into the triangular factor R, in place.
+
+   The rows of [R; x^t] are rotated pairwise, (0, p), (1, p), ..., each
+   rotation zeroing one more entry of x.  The array x is destroyed.
+*/
+void qr_r_add_row(struct matrix* r, double* x) {
+    int p = r->n_col;
+    double c, s, t_j, t_x;
+    for(int j = 0; j < p; j++) {
+        if(x[j] == 0) {
+            continue;
+        }
+        double* row_j = DATA(r) + j * p;
+        givens(row_j[j], x[j], &c, &s);
+        for(int k = j; k < p; k++) {
+            t_j = row_j[k]; t_x = x[k];
+            row_j[k] = c * t_j + s * t_x;
+            x[k] = -s * t_j + c * t_x;
+        }
+    }
+}
+
+/* Remove a row x from the triangular factor R, in place, so that afterwards
+   R^t R equals the old R^t R - x x^t.
+
+   This is the LINPACK downdating algorithm: solve R^t a = x, and rotate the
+   vector [a; sqrt(1 - a^t a)] into the last unit vector.  The same rotations
+   applied to [R; 0] leave [R'; x^t].  Returns false (and leaves R untouched)
+   if the downdated matrix would not be positive definite.  The array x is
+   destroyed, work must have room for n_col doubles.
+*/
+bool qr_r_delete_row(struct matrix* r, double* x, double* work) {
+    int p = r->n_col;
+    // Forward substitution, R^t a = x, a is stored in x.
+    double alpha_sq = 1;
+    for(int i = 0; i < p; i++) {
+        double sum = x[i];
+        for(int k = 0; k < i; k++) {
+            sum -= MATRIX_IDX_INTO(r, k, i) * x[k];
+        }
+        if(MATRIX_IDX_INTO(r, i, i) == 0) {
+            return false;
+        }
+        x[i] = sum / MATRIX_IDX_INTO(r, i, i);
+        alpha_sq -= x[i] * x[i];
+    }
+    if(alpha_sq <= 0) {
+        return false;
+    }
+    double alpha = sqrt(alpha_sq);
+    double c, s, t, t_i, t_w;
+    for(int j = 0; j < p; j++) {
+        work[j] = 0;
+    }
+    for(int i = p - 1; i >= 0; i--) {
+        t = hypot(alpha, x[i]);
+        c = alpha / t; s = x[i] / t;
+        alpha = t;
+        double* row_i = DATA(r) + i * p;
+        for(int j = i; j < p; j++) {
+            t_i = row_i[j]; t_w = work[j];
+            row_i[j] = c * t_i - s * t_w;
+            work[j] = s * t_i + c * t_w;
+        }
+    }
+    return true;
+}
+
+/* Append a row to the decomposed matrix. */
+void qr_decomp_add_row(struct qr_decomp* qr, struct vector* row) {
+    struct matrix* r = qr->r;
+    int p = r->n_col;
+    assert(row->length == p);
+
+    if(qr->q == NULL) {
+        struct vector* x = vector_copy(row);
+        qr_r_add_row(r, DATA(x));
+        vector_free(x);
+        return;
+    }
+
+    // Work with the extended factors [Q 0; 0 1] and [R; x^t].
+    int n = qr->q->n_row;
+    struct matrix* qa = matrix_zeros(n + 1, p + 1);
+    struct matrix* ra = matrix_new(p + 1, p);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(qa, i, j) = MATRIX_IDX_INTO(qr->q, i, j);
+        }
+    }
+    MATRIX_IDX_INTO(qa, n, p) = 1;
+    for(int i = 0; i < p; i++) {
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(ra, i, j) = MATRIX_IDX_INTO(r, i, j);
+        }
+    }
+    matrix_copy_vector_into_row(ra, row, p);
+
+    double c, s;
+    for(int j = 0; j < p; j++) {
+        givens(MATRIX_IDX_INTO(ra, j, j), MATRIX_IDX_INTO(ra, p, j), &c, &s);
+        rotate_rows(ra, j, p, c, s, j);
+        rotate_columns(qa, j, p, c, s);
+    }
+
+    matrix_free(qr->q); matrix_free(qr->r);
+    qr->q = leading_block(qa, n + 1, p);
+    qr->r = leading_block(ra, p, p);
+    matrix_free_many(2, qa, ra);
+    fix_signs(qr);
+}
+
+/* Remove a row from the decomposed matrix, Q is needed to locate the row.
+
+   Let q be the row of Q to delete, completed by a unit vector w orthogonal to
+   Q, so that the row of [Q w] has unit norm.  Rotating it into the first unit
+   vector turns [R; 0] into an upper Hessenberg matrix whose first row is the
+   deleted row and whose remaining rows are the new R.
+*/
+void qr_decomp_delete_row(struct qr_decomp* qr, int row) {
+    assert(qr->q != NULL);
+    struct matrix* q = qr->q;
+    int n = q->n_row;
+    int p = q->n_col;
+    assert(0 <= row && row < n);
+    assert(n > p);
+
+    struct vector* w = vector_zeros(n);
+    VECTOR_IDX_INTO(w, row) = 1;
+    double* coef = malloc(sizeof(double) * p);
+    check_memory((void*) coef);
+    orthogonalize(q, w, coef);
+    free(coef);
+
+    struct matrix* qa = matrix_new(n, p + 1);
+    struct matrix* ra = matrix_zeros(p + 1, p);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(qa, i, j) = MATRIX_IDX_INTO(q, i, j);
+        }
+        MATRIX_IDX_INTO(qa, i, p) = VECTOR_IDX_INTO(w, i);
+    }
+    for(int i = 0; i < p; i++) {
+        for(int j = i; j < p; j++) {
+            MATRIX_IDX_INTO(ra, i, j) = MATRIX_IDX_INTO(qr->r, i, j);
+        }
+    }
+
+    double c, s;
+    for(int j = p - 1; j >= 0; j--) {
+        givens(MATRIX_IDX_INTO(qa, row, j), MATRIX_IDX_INTO(qa, row, j + 1), &c, &s);
+        rotate_columns(qa, j, j + 1, c, s);
+        rotate_rows(ra, j, j + 1, c, s, (j > 0) ? j - 1 : 0);
+    }
+
+    struct matrix* new_q = matrix_new(n - 1, p);
+    struct matrix* new_r = matrix_zeros(p, p);
+    for(int i = 0, k = 0; i < n; i++) {
+        if(i == row) {
+            continue;
+        }
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(new_q, k, j) = MATRIX_IDX_INTO(qa, i, j + 1);
+        }
+        k++;
+    }
+    for(int i = 0; i < p; i++) {
+        for(int j = i; j < p; j++) {
+            MATRIX_IDX_INTO(new_r, i, j) = MATRIX_IDX_INTO(ra, i + 1, j);
+        }
+    }
+
+    matrix_free(qr->q); matrix_free(qr->r);
+    qr->q = new_q;
+    qr->r = new_r;
+    matrix_free_many(2, qa, ra); vector_free(w);
+    fix_signs(qr);
+}
+
+/* Remove a row from a Q-less decomposition, the row itself must be given.
+   Returns false if the decomposition could not be downdated.
+*/
+bool qr_decomp_downdate_row(struct qr_decomp* qr, struct vector* row) {
+    assert(qr->q == NULL);
+    assert(row->length == qr->r->n_col);
+    struct vector* x = vector_copy(row);
+    struct vector* work = vector_new(row->length);
+    bool success = qr_r_delete_row(qr->r, DATA(x), DATA(work));
+    vector_free_many(2, x, work);
+    return success;
+}
+
+/* Insert a column into the decomposed matrix, at index col.
+
+   The component of the new column orthogonal to Q becomes a new column of Q,
+   and its coordinates are inserted into R.  This leaves a spike below the
+   diagonal in column col of R, which is rotated away from the bottom up.
+
+   Returns false, and leaves the decomposition unchanged, if the column is in
+   the span of Q: when what is left of it after orthogonalization is at most
+   n * DBL_EPSILON times its norm.
+*/
+bool qr_decomp_add_column(struct qr_decomp* qr, int col, struct vector* column) {
+    assert(qr->q != NULL);
+    struct matrix* q = qr->q;
+    int n = q->n_row;
+    int p = q->n_col;
+    assert(0 <= col && col <= p);
+    assert(column->length == n);
+    assert(n > p);
+
+    struct vector* w = vector_copy(column);
+    double* z = malloc(sizeof(double) * (p + 1));
+    check_memory((void*) z);
+    z[p] = orthogonalize(q, w, z);
+    if(z[p] <= n * DBL_EPSILON * vector_norm(column)) {
+        vector_free(w); free(z);
+        return false;
+    }
+
+    struct matrix* qa = matrix_new(n, p + 1);
+    struct matrix* ra = matrix_zeros(p + 1, p + 1);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(qa, i, j) = MATRIX_IDX_INTO(q, i, j);
+        }
+        MATRIX_IDX_INTO(qa, i, p) = VECTOR_IDX_INTO(w, i);
+    }
+    for(int j = 0; j <= p; j++) {
+        for(int i = 0; i <= p; i++) {
+            if(j < col) {
+                MATRIX_IDX_INTO(ra, i, j) = (i < p) ? MATRIX_IDX_INTO(qr->r, i, j) : 0;
+            } else if(j == col) {
+                MATRIX_IDX_INTO(ra, i, j) = z[i];
+            } else {
+                MATRIX_IDX_INTO(ra, i, j) = (i < p) ? MATRIX_IDX_INTO(qr->r, i, j - 1) : 0;
+            }
+        }
+    }
+
+    double c, s;
+    for(int i = p; i > col; i--) {
+        givens(MATRIX_IDX_INTO(ra, i - 1, col), MATRIX_IDX_INTO(ra, i, col), &c, &s);
+        rotate_rows(ra, i - 1, i, c, s, col);
+        rotate_columns(qa, i - 1, i, c, s);
+    }
+
+    matrix_free(qr->q); matrix_free(qr->r);
+    qr->q = qa;
+    qr->r = ra;
+    vector_free(w); free(z);
+    fix_signs(qr);
+    return true;
+}
+
+/* Remove column col from the decomposed matrix.
+
+   Deleting the column from R leaves an upper Hessenberg block to the right of
+   col, the subdiagonal is rotated away, and the last row of R (and column of
+   Q) dropped.  This works with or without Q.
+*/
+void qr_decomp_delete_column(struct qr_decomp* qr, int col) {
+    struct matrix* r = qr->r;
+    int p = r->n_col;
+    assert(0 <= col && col < p);
+    assert(p > 1);
+
+    struct matrix* ra = matrix_new(p, p - 1);
+    for(int i = 0; i < p; i++) {
+        for(int j = 0, k = 0; j < p; j++) {
+            if(j != col) {
+                MATRIX_IDX_INTO(ra, i, k++) = MATRIX_IDX_INTO(r, i, j);
+            }
+        }
+    }
+
+    double c, s;
+    for(int i = col; i < p - 1; i++) {
+        givens(MATRIX_IDX_INTO(ra, i, i), MATRIX_IDX_INTO(ra, i + 1, i), &c, &s);
+        rotate_rows(ra, i, i + 1, c, s, i);
+        if(qr->q != NULL) {
+            rotate_columns(qr->q, i, i + 1, c, s);
+        }
+    }
+
+    if(qr->q != NULL) {
+        struct matrix* new_q = leading_block(qr->q, qr->q->n_row, p - 1);
+        matrix_free(qr->q);
+        qr->q = new_q;
+    }
+    matrix_free(qr->r);
+    qr->r = leading_block(ra, p - 1, p - 1);
+    matrix_free(ra);
+    fix_signs(qr);
+}
+
+/* Update the decomposition of M into the decomposition of M + u v^t.
+
+   Write u = Q w + rho q, with q a unit vector orthogonal to Q.  Then
+
+     M + u v^t = [Q q] ([R; 0] + [w; rho] v^t)
+
+   The vector [w; rho] is rotated into a multiple of the first unit vector
+   from the bottom up, which makes [R; 0] upper Hessenberg, the rank one term
+   is then added to the first row only, and a second sweep of rotations
+   restores the triangular shape.
+*/
+void qr_decomp_rank_one_update(struct qr_decomp* qr, struct vector* u, struct vector* v) {
+    assert(qr->q != NULL);
+    struct matrix* q = qr->q;
+    int n = q->n_row;
+    int p = q->n_col;
+    assert(u->length == n);
+    assert(v->length == p);
+
+    struct vector* w = vector_copy(u);
+    double* t = malloc(sizeof(double) * (p + 1));
+    check_memory((void*) t);
+    t[p] = orthogonalize(q, w, t);
+
+    struct matrix* qa = matrix_new(n, p + 1);
+    struct matrix* ra = matrix_zeros(p + 1, p);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(qa, i, j) = MATRIX_IDX_INTO(q, i, j);
+        }
+        MATRIX_IDX_INTO(qa, i, p) = VECTOR_IDX_INTO(w, i);
+    }
+    for(int i = 0; i < p; i++) {
+        for(int j = i; j < p; j++) {
+            MATRIX_IDX_INTO(ra, i, j) = MATRIX_IDX_INTO(qr->r, i, j);
+        }
+    }
+
+    double c, s, t_i;
+    for(int i = p - 1; i >= 0; i--) {
+        givens(t[i], t[i + 1], &c, &s);
+        t_i = t[i];
+        t[i] = c * t_i + s * t[i + 1];
+        t[i + 1] = 0;
+        rotate_rows(ra, i, i + 1, c, s, (i > 0) ? i - 1 : 0);
+        rotate_columns(qa, i, i + 1, c, s);
+    }
+    for(int j = 0; j < p; j++) {
+        MATRIX_IDX_INTO(ra, 0, j) += t[0] * VECTOR_IDX_INTO(v, j);
+    }
+    for(int i = 0; i < p; i++) {
+        givens(MATRIX_IDX_INTO(ra, i, i), MATRIX_IDX_INTO(ra, i + 1, i), &c, &s);
+        rotate_rows(ra, i, i + 1, c, s, i);
+        rotate_columns(qa, i, i + 1, c, s);
+    }
+
+    matrix_free(qr->q); matrix_free(qr->r);
+    qr->q = leading_block(qa, n, p);
+    qr->r = leading_block(ra, p, p);
+    matrix_free_many(2, qa, ra); vector_free(w); free(t);
+    fix_signs(qr);
+}
@@ -0,0 +1,27 @@
+/* qr_update.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+
+/* Updating a QR decomposition after a small change to the decomposed matrix.
+
+   Each update costs O(p^2) work on the p x p factor R, plus O(n * p) when the
+   thin n x p factor Q is also maintained.  A decomposition with q == NULL only
+   tracks R (R^t R = M^t M), this is enough to solve least squares problems
+   and keeps every row update in O(p^2).
+*/
+struct qr_decomp* qr_decomp_empty(int n_col);
+
+void qr_decomp_add_row(struct qr_decomp* qr, struct vector* row);
+void qr_decomp_delete_row(struct qr_decomp* qr, int row);
+bool qr_decomp_downdate_row(struct qr_decomp* qr, struct vector* row);
+bool qr_decomp_add_column(struct qr_decomp* qr, int col, struct vector* column);
+void qr_decomp_delete_column(struct qr_decomp* qr, int col);
+void qr_decomp_rank_one_update(struct qr_decomp* qr, struct vector* u, struct vector* v);
+
+/* In place row updates of a bare triangular factor, these do not allocate. */
+void qr_r_add_row(struct matrix* r, double* x);
+bool qr_r_delete_row(struct matrix* r, double* x, double* work);
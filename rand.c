@@ -1,17 +1,185 @@
 /* rand.c
   (c) Matthew Drury, 2016
+  (c) Alexis Rigaud, 2024
 */
 #include <assert.h>
 #include <time.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include "vector.h"
 #include "matrix.h"
+#include "util.h"
+#include "parallel.h"
+#include "rand.h"
 
 
+/***********************
+ * Streams
+ ***********************/
+
+static uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// splitmix64, to spread a seed over the state.
+static uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+struct rng* rng_new(uint64_t seed) {
+    struct rng* rng = malloc(sizeof(struct rng));
+    check_memory((void*) rng);
+    rng_seed(rng, seed);
+    return rng;
+}
+
+void rng_free(struct rng* rng) {
+    free(rng);
+}
+
+void rng_seed(struct rng* rng, uint64_t seed) {
+    for(int i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&seed);
+    }
+}
+
+/* xoshiro256**, by Blackman and Vigna. */
+uint64_t rng_next(struct rng* rng) {
+    uint64_t* s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/* Advance the stream by 2^128 draws. */
+void rng_jump(struct rng* rng) {
+    static const uint64_t jump[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                    0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+    uint64_t s[4] = {0, 0, 0, 0};
+    for(int i = 0; i < 4; i++) {
+        for(int b = 0; b < 64; b++) {
+            if(jump[i] & ((uint64_t) 1 << b)) {
+                for(int k = 0; k < 4; k++) {
+                    s[k] ^= rng->s[k];
+                }
+            }
+            rng_next(rng);
+        }
+    }
+    for(int k = 0; k < 4; k++) {
+        rng->s[k] = s[k];
+    }
+}
+
+/* Uniform in [0, 1), from the top 53 bits of a draw. */
+double rng_uniform(struct rng* rng) {
+    return (rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+/* The default streams of the threads. */
+static pthread_key_t thread_stream_key;
+static pthread_once_t thread_stream_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t thread_stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t thread_stream_seed = 0x853c49e6748fea9b;
+static int thread_stream_count = 0;
+
+static void make_thread_stream_key(void) {
+    pthread_key_create(&thread_stream_key, free);
+}
+
+static void seed_thread_stream(struct rng* rng, uint64_t seed, int index) {
+    rng_seed(rng, seed);
+    for(int i = 0; i < index; i++) {
+        rng_jump(rng);
+    }
+}
+
+static struct rng* thread_stream(void) {
+    pthread_once(&thread_stream_once, make_thread_stream_key);
+    struct rng* rng = pthread_getspecific(thread_stream_key);
+    if(rng == NULL) {
+        rng = malloc(sizeof(struct rng));
+        check_memory((void*) rng);
+        pthread_mutex_lock(&thread_stream_lock);
+        uint64_t seed = thread_stream_seed;
+        int index = thread_stream_count++;
+        pthread_mutex_unlock(&thread_stream_lock);
+        seed_thread_stream(rng, seed, index);
+        pthread_setspecific(thread_stream_key, rng);
+    }
+    return rng;
+}
+
+void rand_seed(uint64_t seed) {
+    pthread_once(&thread_stream_once, make_thread_stream_key);
+    struct rng* rng = pthread_getspecific(thread_stream_key);
+    pthread_mutex_lock(&thread_stream_lock);
+    thread_stream_seed = seed;
+    thread_stream_count = (rng == NULL) ? 0 : 1;
+    pthread_mutex_unlock(&thread_stream_lock);
+    if(rng != NULL) {
+        seed_thread_stream(rng, seed, 0);
+    }
+}
+
 void init_random() {
-    srand(time(NULL));
+    rand_seed((uint64_t) time(NULL));
+}
+
+
+/***********************
+ * Filling in parallel
+ ***********************/
+
+/* Vectors and matrices are filled in blocks of RAND_BLOCK entries spread
+   over the threads.  Block b draws from its own stream, seeded from b and
+   from one draw of the caller's stream, so the values only depend on that
+   stream, and not on the number of threads.
+*/
+#define RAND_BLOCK 4096
+
+struct random_fill {
+    double* out;
+    size_t n;
+    uint64_t seed;
+    bool gaussian;
+    double a;
+    double b;
+};
+
+static void random_fill_block(void* arg, int block, int thread_idx) {
+    (void) thread_idx;
+    struct random_fill* fill = arg;
+    struct rng rng;
+    rng_seed(&rng, fill->seed ^ ((uint64_t) block * 0x9e3779b97f4a7c15));
+    size_t begin = (size_t) block * RAND_BLOCK;
+    size_t n = (fill->n - begin < RAND_BLOCK) ? fill->n - begin : RAND_BLOCK;
+    if(fill->gaussian) {
+        rng_fill_gaussian(&rng, fill->out + begin, n, fill->a, fill->b);
+    } else {
+        rng_fill_uniform(&rng, fill->out + begin, n, fill->a, fill->b);
+    }
+}
+
+static void random_fill(double* out, size_t n, struct rng* rng, bool gaussian,
+                        double a, double b) {
+    struct random_fill fill = {out, n, rng_next(rng ? rng : thread_stream()), gaussian, a, b};
+    size_t n_blocks = (n + RAND_BLOCK - 1) / RAND_BLOCK;
+    assert(n_blocks <= INT_MAX);
+    parallel_for((int) n_blocks, 4, random_fill_block, &fill);
 }
 
 
@@ -19,29 +187,39 @@ void init_random() {
  * Uniform Distribution
  ***********************/
 
-double _random_uniform(double low, double high) {
+void rng_fill_uniform(struct rng* rng, double* out, size_t n, double low, double high) {
+    assert(low < high);
+    double width = high - low;
+    for(size_t i = 0; i < n; i++) {
+        out[i] = low + width * rng_uniform(rng);
+    }
+}
+
+void vector_random_uniform_into(struct vector* reciever, struct rng* rng,
+                                double low, double high) {
     assert(low < high);
-    return (high - low) * ((double) rand() / (double) RAND_MAX) - low;
+    random_fill(DATA(reciever), reciever->length, rng, false, low, high);
 }
 
 struct vector* vector_random_uniform(int length, double low, double high) {
     assert(length > 0);
     struct vector* v = vector_new(length);
-    for(int i = 0; i < length; i++) {
-        VECTOR_IDX_INTO(v, i) = _random_uniform(low, high);
-    }
+    vector_random_uniform_into(v, NULL, low, high);
     return v;
 }
 
+void matrix_random_uniform_into(struct matrix* reciever, struct rng* rng,
+                                double low, double high) {
+    assert(low < high);
+    random_fill(DATA(reciever), (size_t) reciever->n_row * reciever->n_col, rng, false,
+                low, high);
+}
+
 struct matrix* matrix_random_uniform(int n_row, int n_col, double low, double high) {
     assert(n_row > 0);
     assert(n_col >0);
     struct matrix* M = matrix_new(n_row, n_col);
-    for(int i = 0; i < n_row; i++) {
-        for(int j = 0; j < n_col; j++) {
-            MATRIX_IDX_INTO(M, i, j) = _random_uniform(low, high);
-        }
-    }
+    matrix_random_uniform_into(M, NULL, low, high);
     return M;
 }
 
@@ -50,38 +228,97 @@ struct matrix* matrix_random_uniform(int n_row, int n_col, double low, double hi
  * Gaussian Dristribution
  *************************/
 
-/* Generate a number distributed as random gaussian noise using the Box-Muller
- * method.
-   The trick of using the static keyword to remember pairs of values is taken
-   from wikipedia.
+/* Gaussian values by the ziggurat method of Marsaglia and Tsang, in the
+   form given by Doornik.  The density is covered by ZIGGURAT_N strips of
+   equal area, of which zig_x holds the edges (zig_x[1] = ZIGGURAT_R, the
+   start of the tail, down to zig_x[ZIGGURAT_N] = 0) and zig_ratio the ratio
+   of consecutive edges.  One draw picks a strip (its low 8 bits) and a
+   signed position in it (its top 53 bits); when the position is inside the
+   next strip up, the value is returned at once, which happens about 99% of
+   the time.  Otherwise it is accepted against the density, or drawn from
+   the tail for the base strip.
 */
-double _random_gaussian(double mu, double sigma) {
-    const double two_pi = 2.0 * 3.14159265358979323846;
-
-    static double z0, z1;
-    double u0, u1;
-
-    // Since the strategy employed generates pairs of random values, we can,
-    // on each other call, simply remember the leftover value and return it.
-    static bool generate_new_values = false;
-    generate_new_values = !generate_new_values;
-    if (!generate_new_values) {
-        return z1 * sigma + mu;
+#define ZIGGURAT_N 256
+#define ZIGGURAT_R 3.6541528853610088
+#define ZIGGURAT_V 0.00492867323399
+
+static double zig_x[ZIGGURAT_N + 1];
+static double zig_ratio[ZIGGURAT_N];
+static pthread_once_t zig_once = PTHREAD_ONCE_INIT;
+
+static void ziggurat_tables(void) {
+    double f = exp(-0.5 * ZIGGURAT_R * ZIGGURAT_R);
+    zig_x[0] = ZIGGURAT_V / f;
+    zig_x[1] = ZIGGURAT_R;
+    zig_x[ZIGGURAT_N] = 0;
+    for(int i = 2; i < ZIGGURAT_N; i++) {
+        zig_x[i] = sqrt(-2 * log(ZIGGURAT_V / zig_x[i - 1] + f));
+        f = exp(-0.5 * zig_x[i] * zig_x[i]);
+    }
+    for(int i = 0; i < ZIGGURAT_N; i++) {
+        zig_ratio[i] = zig_x[i + 1] / zig_x[i];
     }
+}
+
+// The tail beyond ZIGGURAT_R, by Marsaglia's method.
+static double ziggurat_tail(struct rng* rng, bool negative) {
+    double x, y;
+    do {
+        x = log(1 - rng_uniform(rng)) / ZIGGURAT_R;
+        y = log(1 - rng_uniform(rng));
+    } while(-2 * y < x * x);
+    return negative ? x - ZIGGURAT_R : ZIGGURAT_R - x;
+}
 
-    u0 = _random_uniform(0, 1);
-    u1 = _random_uniform(0, 1);
-    z0 = sqrt(-2.0 * log(u0)) * cos(two_pi * u1);
-    z1 = sqrt(-2.0 * log(u0)) * sin(two_pi * u1);
+static double ziggurat(struct rng* rng) {
+    for(;;) {
+        uint64_t bits = rng_next(rng);
+        int i = bits & 0xff;
+        double u = 2 * ((bits >> 11) * 0x1.0p-53) - 1;
+        if(fabs(u) < zig_ratio[i]) {
+            return u * zig_x[i];
+        }
+        if(i == 0) {
+            return ziggurat_tail(rng, u < 0);
+        }
+        double x = u * zig_x[i];
+        double f0 = exp(-0.5 * (zig_x[i] * zig_x[i] - x * x));
+        double f1 = exp(-0.5 * (zig_x[i + 1] * zig_x[i + 1] - x * x));
+        if(f1 + rng_uniform(rng) * (f0 - f1) < 1.0) {
+            return x;
+        }
+    }
+}
 
-    return z0 * sigma + mu;
+void rng_fill_gaussian(struct rng* rng, double* out, size_t n, double mu, double sigma) {
+    pthread_once(&zig_once, ziggurat_tables);
+    for(size_t i = 0; i < n; i++) {
+        out[i] = ziggurat(rng) * sigma + mu;
+    }
+}
+
+void vector_random_gaussian_into(struct vector* reciever, struct rng* rng,
+                                 double mu, double sigma) {
+    random_fill(DATA(reciever), reciever->length, rng, true, mu, sigma);
 }
 
 struct vector* vector_random_gaussian(int length, double mu, double sigma) {
     assert(length > 0);
     struct vector* v = vector_new(length);
-    for(int i = 0; i < length; i++) {
-        VECTOR_IDX_INTO(v, i) = _random_gaussian(mu, sigma);
-    }
+    vector_random_gaussian_into(v, NULL, mu, sigma);
     return v;
 }
+
+void matrix_random_gaussian_into(struct matrix* reciever, struct rng* rng,
+                                 double mu, double sigma) {
+    random_fill(DATA(reciever), (size_t) reciever->n_row * reciever->n_col, rng, true,
+                mu, sigma);
+}
+
+struct matrix* matrix_random_gaussian(int n_row, int n_col, double mu, double sigma) {
+    assert(n_row > 0);
+    assert(n_col > 0);
+    struct matrix* M = matrix_new(n_row, n_col);
+    matrix_random_gaussian_into(M, NULL, mu, sigma);
+    return M;
+}
@@ -1,13 +1,60 @@
 /* rand.h
   (c) Matthew Drury, 2016
+  (c) Alexis Rigaud, 2024
 */
 #pragma once
+#include <stdint.h>
+#include <stddef.h>
 #include "vector.h"
 #include "matrix.h"
 
+/* Random streams.
+
+   A struct rng is the state of a xoshiro256** generator, so independent
+   streams are independent objects and need no locking.  rng_jump advances
+   a stream by 2^128 draws: jumping copies of one seeded stream 0, 1, 2, ...
+   times gives non overlapping streams for parallel work.  The rng_fill_
+   functions draw in bulk into an array.
+
+   Vectors and matrices are filled in parallel: one value is drawn from the
+   stream, and each block of entries is drawn from a substream derived from
+   it and from the block's position, so the result is the same whatever the
+   number of threads.  Gaussian values are drawn by the ziggurat method.
+
+   The functions without a stream argument (and the _into functions given a
+   NULL stream) draw from a default stream of the calling thread.  These are
+   the streams of one seed (set by rand_seed, or from the clock by
+   init_random) jumped once more for each new thread, so threads do not
+   share state.  rand_seed reseeds the calling thread's stream, and those of
+   the threads that have not drawn yet.
+*/
+struct rng {
+    uint64_t s[4];
+};
+
+struct rng* rng_new(uint64_t seed);
+void        rng_free(struct rng* rng);
+void        rng_seed(struct rng* rng, uint64_t seed);
+void        rng_jump(struct rng* rng);
+
+uint64_t rng_next(struct rng* rng);
+double   rng_uniform(struct rng* rng);
+void     rng_fill_uniform(struct rng* rng, double* out, size_t n, double low, double high);
+void     rng_fill_gaussian(struct rng* rng, double* out, size_t n, double mu, double sigma);
 
 void init_random();
+void rand_seed(uint64_t seed);
+
 struct vector* vector_random_uniform(int length, double low, double high);
+void           vector_random_uniform_into(struct vector* reciever, struct rng* rng,
+                                          double low, double high);
 struct matrix* matrix_random_uniform(int n_row, int n_col, double low, double high);
+void           matrix_random_uniform_into(struct matrix* reciever, struct rng* rng,
+                                          double low, double high);
 
 struct vector* vector_random_gaussian(int length, double mu, double sigma);
+void           vector_random_gaussian_into(struct vector* reciever, struct rng* rng,
+                                           double mu, double sigma);
+struct matrix* matrix_random_gaussian(int n_row, int n_col, double mu, double sigma);
+void           matrix_random_gaussian_into(struct matrix* reciever, struct rng* rng,
+                                           double mu, double sigma);
@@ -0,0 +1,302 @@
+/* serialize.c
+  (c) Alexis Rigaud, 2024
+
+  Binary files of fitted objects, loaded by mapping them into memory.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "util.h"
+#include "errors.h"
+#include "vector.h"
+#include "matrix.h"
+#include "linreg.h"
+#include "eigen.h"
+#include "serialize.h"
+
+#define SERIALIZE_MAGIC "linalg\0"
+#define SERIALIZE_MAX_ARRAYS 3
+
+enum serialized_kind {
+    SERIALIZED_LINREG = 1,
+    SERIALIZED_EIGEN,
+    SERIALIZED_QR
+};
+
+/* The header of a file, followed by its arrays in order.  Its size is a
+   multiple of 8, so the arrays of a mapping are aligned.  A vector has one
+   column, and an absent array (a NULL member) has shape (-1, -1).  The
+   version is also the byte order mark: read on a machine of the other
+   byte order, it is not SERIALIZE_VERSION.
+*/
+struct file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t checksum;
+    int64_t n;
+    double scalar;
+    int64_t shape[SERIALIZE_MAX_ARRAYS][2];
+};
+
+/* A hash of size bytes (a multiple of 8), continued from h.  Each step is a
+   bijection of the running hash for a given word, so any change of a single
+   word changes the result.
+*/
+static uint64_t checksum_update(uint64_t h, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    for(size_t i = 0; i < size; i += 8) {
+        uint64_t w;
+        memcpy(&w, bytes + i, 8);
+        h = (h ^ w) * 0x100000001b3;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+static uint64_t checksum_file(const struct file_header* header, const double* data,
+                              size_t size) {
+    struct file_header h = *header;
+    h.checksum = 0;
+    uint64_t sum = checksum_update(0xcbf29ce484222325, &h, sizeof(h));
+    return checksum_update(sum, data, size);
+}
+
+static size_t array_size(const int64_t shape[2]) {
+    return (shape[0] < 0) ? 0 : (size_t) shape[0] * (size_t) shape[1];
+}
+
+static void set_vector_shape(int64_t shape[2], struct vector* v) {
+    shape[0] = (v == NULL) ? -1 : v->length;
+    shape[1] = (v == NULL) ? -1 : 1;
+}
+
+static void set_matrix_shape(int64_t shape[2], struct matrix* M) {
+    shape[0] = (M == NULL) ? -1 : M->n_row;
+    shape[1] = (M == NULL) ? -1 : M->n_col;
+}
+
+/* Write the header and the arrays (NULL for the absent ones). */
+static bool write_file(const char* path, struct file_header* header,
+                       double* arrays[SERIALIZE_MAX_ARRAYS]) {
+    memcpy(header->magic, SERIALIZE_MAGIC, 8);
+    header->version = SERIALIZE_VERSION;
+    header->checksum = 0;
+    uint64_t sum = checksum_update(0xcbf29ce484222325, header, sizeof(*header));
+    for(int i = 0; i < SERIALIZE_MAX_ARRAYS; i++) {
+        sum = checksum_update(sum, arrays[i], sizeof(double) * array_size(header->shape[i]));
+    }
+    header->checksum = sum;
+
+    FILE* file = fopen(path, "wb");
+    if(file == NULL) {
+        return false;
+    }
+    bool ok = fwrite(header, sizeof(*header), 1, file) == 1;
+    for(int i = 0; ok && i < SERIALIZE_MAX_ARRAYS; i++) {
+        size_t size = array_size(header->shape[i]);
+        ok = size == 0 || fwrite(arrays[i], sizeof(double), size, file) == size;
+    }
+    return (fclose(file) == 0) && ok;
+}
+
+bool linreg_save(struct linreg* lr, const char* path) {
+    struct file_header header = {0};
+    header.kind = SERIALIZED_LINREG;
+    header.n = lr->n;
+    header.scalar = lr->sigma_resid;
+    set_vector_shape(header.shape[0], lr->beta);
+    set_vector_shape(header.shape[1], lr->y_hat);
+    set_vector_shape(header.shape[2], NULL);
+    double* arrays[] = {DATA(lr->beta), lr->y_hat ? DATA(lr->y_hat) : NULL, NULL};
+    return write_file(path, &header, arrays);
+}
+
+bool eigen_save(struct eigen* e, const char* path) {
+    struct file_header header = {0};
+    header.kind = SERIALIZED_EIGEN;
+    header.n = e->n;
+    set_vector_shape(header.shape[0], e->eigenvalues);
+    set_vector_shape(header.shape[1], e->eigenvalues_imag);
+    set_matrix_shape(header.shape[2], e->eigenvectors);
+    double* arrays[] = {DATA(e->eigenvalues),
+                        e->eigenvalues_imag ? DATA(e->eigenvalues_imag) : NULL,
+                        DATA(e->eigenvectors)};
+    return write_file(path, &header, arrays);
+}
+
+bool qr_decomp_save(struct qr_decomp* qr, const char* path) {
+    struct file_header header = {0};
+    header.kind = SERIALIZED_QR;
+    set_matrix_shape(header.shape[0], qr->q);
+    set_matrix_shape(header.shape[1], qr->r);
+    set_matrix_shape(header.shape[2], NULL);
+    double* arrays[] = {qr->q ? DATA(qr->q) : NULL, DATA(qr->r), NULL};
+    return write_file(path, &header, arrays);
+}
+
+struct mapped_file* mapped_file_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct file_header)) {
+        close(fd);
+        return NULL;
+    }
+    // Private and writable: pages are shared until a loaded object is modified.
+    void* addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct mapped_file* f = malloc(sizeof(struct mapped_file));
+    check_memory((void*) f);
+    f->addr = addr;
+    f->size = st.st_size;
+    DATA(f) = (double*) ((char*) addr + sizeof(struct file_header));
+    OWNS_MEMORY(f) = true;
+    MEMORY_OWNER(f) = NULL;
+    REF_COUNT(f) = 0;
+    return f;
+}
+
+void mapped_file_close(struct mapped_file* f) {
+    if(REF_COUNT(f) != 0) {
+        raise_non_zero_reference_free_error();
+    }
+    munmap(f->addr, f->size);
+    free(f);
+}
+
+/* The header of f if it holds a valid object of the given kind, else NULL.
+   The required arrays are those that may not be absent.
+*/
+static const struct file_header* valid_header(struct mapped_file* f,
+                                              enum serialized_kind kind,
+                                              const bool required[SERIALIZE_MAX_ARRAYS]) {
+    const struct file_header* header = f->addr;
+    if(memcmp(header->magic, SERIALIZE_MAGIC, 8) != 0
+       || header->version != SERIALIZE_VERSION || header->kind != kind) {
+        return NULL;
+    }
+    size_t size = 0;
+    for(int i = 0; i < SERIALIZE_MAX_ARRAYS; i++) {
+        const int64_t* shape = header->shape[i];
+        bool absent = shape[0] == -1 && shape[1] == -1;
+        bool valid = 1 <= shape[0] && shape[0] <= INT_MAX && 1 <= shape[1] && shape[1] <= INT_MAX;
+        if(!(valid || (absent && !required[i]))) {
+            return NULL;
+        }
+        size += array_size(shape);
+    }
+    if(size != (f->size - sizeof(struct file_header)) / sizeof(double)
+       || f->size % sizeof(double) != 0) {
+        return NULL;
+    }
+    if(checksum_file(header, DATA(f), sizeof(double) * size) != header->checksum) {
+        return NULL;
+    }
+    return header;
+}
+
+/* Views of the arrays of f, in order, advancing *data past each. */
+static struct vector* next_vector(struct mapped_file* f, const int64_t shape[2], double** data) {
+    if(shape[0] < 0) {
+        return NULL;
+    }
+    struct vector* v = vector_new_view((struct linalg_obj*) f, *data, shape[0]);
+    *data += array_size(shape);
+    return v;
+}
+
+static struct matrix* next_matrix(struct mapped_file* f, const int64_t shape[2], double** data) {
+    if(shape[0] < 0) {
+        return NULL;
+    }
+    struct matrix* M = matrix_new_view((struct linalg_obj*) f, *data, shape[0], shape[1]);
+    *data += array_size(shape);
+    return M;
+}
+
+/* The shapes of the arrays must also agree with each other, a file with a
+   valid checksum could otherwise give views that are indexed out of bounds.
+*/
+static bool is_absent(const int64_t shape[2]) {
+    return shape[0] == -1 && shape[1] == -1;
+}
+
+static bool is_vector(const int64_t shape[2], int64_t length) {
+    return shape[0] == length && shape[1] == 1;
+}
+
+struct linreg* linreg_from_mapped(struct mapped_file* f) {
+    const bool required[] = {true, false, false};
+    const struct file_header* header = valid_header(f, SERIALIZED_LINREG, required);
+    if(header == NULL || header->shape[0][1] != 1
+       || !(is_absent(header->shape[1]) || is_vector(header->shape[1], header->n))) {
+        return NULL;
+    }
+    double* data = DATA(f);
+    struct linreg* lr = linreg_new();
+    lr->n = header->n;
+    lr->p = header->shape[0][0];
+    lr->sigma_resid = header->scalar;
+    lr->beta = next_vector(f, header->shape[0], &data);
+    lr->y_hat = next_vector(f, header->shape[1], &data);
+    return lr;
+}
+
+struct eigen* eigen_from_mapped(struct mapped_file* f) {
+    const bool required[] = {true, false, true};
+    const struct file_header* header = valid_header(f, SERIALIZED_EIGEN, required);
+    if(header == NULL) {
+        return NULL;
+    }
+    // n eigenvalues, and as many eigenvectors, of length n for a full
+    // decomposition, or of the dimension of the matrix for a few pairs.
+    const int64_t n = header->n;
+    if(!is_vector(header->shape[0], n)
+       || !(is_absent(header->shape[1]) || is_vector(header->shape[1], n))
+       || header->shape[2][0] < n || header->shape[2][1] != n) {
+        return NULL;
+    }
+    double* data = DATA(f);
+    struct eigen* e = eigen_new();
+    e->n = header->n;
+    e->eigenvalues = next_vector(f, header->shape[0], &data);
+    e->eigenvalues_imag = next_vector(f, header->shape[1], &data);
+    e->eigenvectors = next_matrix(f, header->shape[2], &data);
+    return e;
+}
+
+struct qr_decomp* qr_decomp_from_mapped(struct mapped_file* f) {
+    const bool required[] = {false, true, false};
+    const struct file_header* header = valid_header(f, SERIALIZED_QR, required);
+    if(header == NULL) {
+        return NULL;
+    }
+    // A square R, and Q with a column per row of R.
+    const int64_t p = header->shape[1][0];
+    if(header->shape[1][1] != p
+       || !(is_absent(header->shape[0]) || header->shape[0][1] == p)) {
+        return NULL;
+    }
+    double* data = DATA(f);
+    struct qr_decomp* qr = malloc(sizeof(struct qr_decomp));
+    check_memory((void*) qr);
+    qr->q = next_matrix(f, header->shape[0], &data);
+    qr->r = next_matrix(f, header->shape[1], &data);
+    return qr;
+}
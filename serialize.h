@@ -0,0 +1,49 @@
+/* serialize.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "linalg_obj.h"
+#include "vector.h"
+#include "matrix.h"
+#include "linreg.h"
+#include "eigen.h"
+
+/* Binary files holding one fitted object.
+
+   A file is a fixed header (format version, kind of object, shapes of its
+   arrays and a checksum of the whole file) followed by the arrays as raw
+   doubles, in the byte order of the machine that wrote it.  Loading maps
+   the file into memory and checks the header and checksum; the vectors and
+   matrices of the loaded object are then views into the mapping, so no
+   element is parsed or copied.
+
+   The _save functions return false if the file could not be written.
+   mapped_file_open returns NULL if the file cannot be mapped, and the
+   _from_mapped functions return NULL if it does not hold a valid object of
+   their kind (wrong version or byte order, truncated, corrupted).  Pages of
+   the mapping are copied on write, so modifying a loaded object never
+   changes the file.
+
+   The loaded objects are freed as usual, before mapped_file_close.
+*/
+#define SERIALIZE_VERSION 1
+
+struct mapped_file {
+    // DATA is the first array; views into the mapping hold a reference.
+    struct linalg_obj la_obj;
+    void* addr;
+    size_t size;
+};
+
+struct mapped_file* mapped_file_open(const char* path);
+void                mapped_file_close(struct mapped_file* f);
+
+bool linreg_save(struct linreg* lr, const char* path);
+bool eigen_save(struct eigen* e, const char* path);
+bool qr_decomp_save(struct qr_decomp* qr, const char* path);
+
+struct linreg*    linreg_from_mapped(struct mapped_file* f);
+struct eigen*     eigen_from_mapped(struct mapped_file* f);
+struct qr_decomp* qr_decomp_from_mapped(struct mapped_file* f);
@@ -0,0 +1,286 @@
+/* sketch.c
+  (c) Alexis Rigaud, 2024
+
+  Random sketching operators.
+*/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "vector.h"
+#include "matrix.h"
+#include "util.h"
+#include "parallel.h"
+#include "rand.h"
+#include "linop.h"
+#include "sketch.h"
+
+// Rows of A handled together by a thread, each block with its own stream.
+#define SKETCH_BLOCK 64
+
+static void block_stream(struct rng* rng, uint64_t seed, int block) {
+    rng_seed(rng, seed ^ ((uint64_t) block * 0x9e3779b97f4a7c15));
+}
+
+struct sketch* sketch_new(enum sketch_kind kind, int n, int s, uint64_t seed) {
+    assert(n >= 1 && s >= 1);
+    struct sketch* S = malloc(sizeof(struct sketch));
+    check_memory((void*) S);
+    S->kind = kind;
+    S->n = n;
+    S->s = s;
+    S->seed = seed;
+    S->m = 0;
+    S->signs = NULL;
+    S->sample = NULL;
+    if(kind == SKETCH_SRHT) {
+        S->m = 1;
+        while(S->m < n) {
+            S->m *= 2;
+        }
+        assert(s <= S->m);
+        S->signs = malloc(sizeof(double) * n);
+        check_memory((void*) S->signs);
+        struct rng rng;
+        for(int i = 0; i < n; i++) {
+            if(i % SKETCH_BLOCK == 0) {
+                block_stream(&rng, seed, i / SKETCH_BLOCK);
+            }
+            S->signs[i] = (rng_next(&rng) >> 63) ? 1.0 : -1.0;
+        }
+        // The first s entries of a random permutation of the m rows.
+        int* rows = malloc(sizeof(int) * S->m);
+        check_memory((void*) rows);
+        for(int i = 0; i < S->m; i++) {
+            rows[i] = i;
+        }
+        rng_seed(&rng, ~seed);
+        for(int i = 0; i < s; i++) {
+            int j = i + (int) (rng_uniform(&rng) * (S->m - i));
+            int t = rows[i]; rows[i] = rows[j]; rows[j] = t;
+        }
+        S->sample = realloc(rows, sizeof(int) * s);
+        check_memory((void*) S->sample);
+    }
+    return S;
+}
+
+void sketch_free(struct sketch* S) {
+    free(S->signs);
+    free(S->sample);
+    free(S);
+}
+
+/* The Gaussian and sparse sign sketches are sums over the rows a_i of A,
+
+     S A = sum_i S e_i a_i^t,
+
+   so the blocks of rows are spread over the threads, each adding into its
+   own s x p accumulator.
+*/
+struct sketch_sum {
+    struct sketch* S;
+    struct matrix* A;
+    double* acc;
+    double* work;
+};
+
+static void gaussian_block(void* arg, int block, int thread_idx) {
+    struct sketch_sum* sum = arg;
+    int s = sum->S->s, p = sum->A->n_col;
+    double* acc = sum->acc + (size_t) thread_idx * s * p;
+    double* g = sum->work + (size_t) thread_idx * SKETCH_BLOCK;
+    int begin = block * SKETCH_BLOCK;
+    int n_rows = (sum->A->n_row - begin < SKETCH_BLOCK) ? sum->A->n_row - begin : SKETCH_BLOCK;
+    const double* a = DATA(sum->A) + (size_t) begin * p;
+    struct rng rng;
+    block_stream(&rng, sum->S->seed, block);
+    // Row k of the block of S, then its product with the block of A.
+    double scale = 1 / sqrt((double) s);
+    for(int k = 0; k < s; k++) {
+        rng_fill_gaussian(&rng, g, n_rows, 0, scale);
+        double* acc_k = acc + (size_t) k * p;
+        for(int i = 0; i < n_rows; i++) {
+            const double* a_i = a + (size_t) i * p;
+            for(int j = 0; j < p; j++) {
+                acc_k[j] += g[i] * a_i[j];
+            }
+        }
+    }
+}
+
+static void sparse_sign_block(void* arg, int block, int thread_idx) {
+    struct sketch_sum* sum = arg;
+    int s = sum->S->s, p = sum->A->n_col;
+    int nnz = (s < SKETCH_SPARSE_NNZ) ? s : SKETCH_SPARSE_NNZ;
+    double scale = 1 / sqrt((double) nnz);
+    double* acc = sum->acc + (size_t) thread_idx * s * p;
+    int begin = block * SKETCH_BLOCK;
+    int end = (begin + SKETCH_BLOCK < sum->A->n_row) ? begin + SKETCH_BLOCK : sum->A->n_row;
+    struct rng rng;
+    block_stream(&rng, sum->S->seed, block);
+    int rows[SKETCH_SPARSE_NNZ];
+    for(int i = begin; i < end; i++) {
+        const double* a_i = DATA(sum->A) + (size_t) i * p;
+        for(int l = 0; l < nnz; l++) {
+            // One draw gives the row (low bits) and the sign (top bit), rows
+            // already taken by this column are drawn again.
+            uint64_t bits;
+            bool repeat;
+            do {
+                bits = rng_next(&rng);
+                rows[l] = (int) ((bits & 0xffffffff) % s);
+                repeat = false;
+                for(int m = 0; m < l; m++) {
+                    repeat = repeat || rows[m] == rows[l];
+                }
+            } while(repeat);
+            double* acc_k = acc + (size_t) rows[l] * p;
+            double sign = (bits >> 63) ? scale : -scale;
+            for(int j = 0; j < p; j++) {
+                acc_k[j] += sign * a_i[j];
+            }
+        }
+    }
+}
+
+static void sketch_sum_into(struct matrix* reciever, struct sketch* S, struct matrix* A) {
+    int s = S->s, p = A->n_col;
+    int n_threads = parallel_num_threads();
+    struct sketch_sum sum = {S, A, NULL, NULL};
+    sum.acc = calloc((size_t) n_threads * s * p, sizeof(double));
+    check_memory((void*) sum.acc);
+    sum.work = malloc(sizeof(double) * n_threads * SKETCH_BLOCK);
+    check_memory((void*) sum.work);
+    int n_blocks = (A->n_row + SKETCH_BLOCK - 1) / SKETCH_BLOCK;
+    parallel_for(n_blocks, 1, (S->kind == SKETCH_GAUSSIAN) ? gaussian_block : sparse_sign_block,
+                 &sum);
+    for(size_t k = 0; k < (size_t) s * p; k++) {
+        double total = 0;
+        for(int t = 0; t < n_threads; t++) {
+            total += sum.acc[(size_t) t * s * p + k];
+        }
+        DATA(reciever)[k] = total;
+    }
+    free(sum.acc);
+    free(sum.work);
+}
+
+/* The SRHT transforms each column of A on its own, in a thread's buffer of
+   length m.
+*/
+struct srht {
+    struct sketch* S;
+    struct matrix* A;
+    struct matrix* out;
+    double* work;
+};
+
+// The (unnormalized) fast Walsh-Hadamard transform, in place.
+static void walsh_hadamard(double* x, int m) {
+    for(int len = 1; len < m; len *= 2) {
+        for(int i = 0; i < m; i += 2 * len) {
+            for(int j = i; j < i + len; j++) {
+                double a = x[j], b = x[j + len];
+                x[j] = a + b;
+                x[j + len] = a - b;
+            }
+        }
+    }
+}
+
+static void srht_column(void* arg, int col, int thread_idx) {
+    struct srht* srht = arg;
+    struct sketch* S = srht->S;
+    double* x = srht->work + (size_t) thread_idx * S->m;
+    for(int i = 0; i < S->n; i++) {
+        x[i] = S->signs[i] * MATRIX_IDX_INTO(srht->A, i, col);
+    }
+    for(int i = S->n; i < S->m; i++) {
+        x[i] = 0;
+    }
+    walsh_hadamard(x, S->m);
+    double scale = 1 / sqrt((double) S->s);
+    for(int k = 0; k < S->s; k++) {
+        MATRIX_IDX_INTO(srht->out, k, col) = scale * x[S->sample[k]];
+    }
+}
+
+void sketch_apply_into(struct matrix* reciever, struct sketch* S, struct matrix* A) {
+    assert(A->n_row == S->n);
+    assert(reciever->n_row == S->s && reciever->n_col == A->n_col);
+    if(S->kind == SKETCH_SRHT) {
+        struct srht srht = {S, A, reciever, NULL};
+        srht.work = malloc(sizeof(double) * parallel_num_threads() * S->m);
+        check_memory((void*) srht.work);
+        parallel_for(A->n_col, 1, srht_column, &srht);
+        free(srht.work);
+    } else {
+        sketch_sum_into(reciever, S, A);
+    }
+}
+
+struct matrix* sketch_apply(struct sketch* S, struct matrix* A) {
+    struct matrix* SA = matrix_new(S->s, A->n_col);
+    sketch_apply_into(SA, S, A);
+    return SA;
+}
+
+struct vector* sketch_apply_vector(struct sketch* S, struct vector* v) {
+    // v as a one column matrix.
+    struct matrix* V = matrix_new_view((struct linalg_obj*) v, DATA(v), v->length, 1);
+    struct vector* Sv = vector_new(S->s);
+    struct matrix* SV = matrix_new_view((struct linalg_obj*) Sv, DATA(Sv), S->s, 1);
+    sketch_apply_into(SV, S, V);
+    matrix_free_many(2, V, SV);
+    return Sv;
+}
+
+/* Products with R^-1 and R^-t, by back and forward substitution. */
+static void sketch_qr_apply(void* ctx, const double* x, double* y) {
+    struct matrix* R = ctx;
+    int p = R->n_col;
+    for(int i = p - 1; i >= 0; i--) {
+        double sum = x[i];
+        for(int j = i + 1; j < p; j++) {
+            sum -= MATRIX_IDX_INTO(R, i, j) * y[j];
+        }
+        y[i] = sum / MATRIX_IDX_INTO(R, i, i);
+    }
+}
+
+static void sketch_qr_apply_transpose(void* ctx, const double* x, double* y) {
+    struct matrix* R = ctx;
+    int p = R->n_col;
+    for(int i = 0; i < p; i++) {
+        double sum = x[i];
+        for(int j = 0; j < i; j++) {
+            sum -= MATRIX_IDX_INTO(R, j, i) * y[j];
+        }
+        y[i] = sum / MATRIX_IDX_INTO(R, i, i);
+    }
+}
+
+static void sketch_qr_free(void* ctx) {
+    matrix_free((struct matrix*) ctx);
+}
+
+struct linop* precond_from_r(struct matrix* R) {
+    assert(R->n_row == R->n_col);
+    struct linop* P = linop_new(R->n_col, R->n_col, sketch_qr_apply,
+                                sketch_qr_apply_transpose, R);
+    P->free_ctx = sketch_qr_free;
+    return P;
+}
+
+struct linop* precond_sketch_qr(struct sketch* S, struct matrix* A) {
+    assert(S->s >= A->n_col);
+    struct matrix* SA = sketch_apply(S, A);
+    struct qr_decomp* qr = matrix_qr_decomposition(SA);
+    struct matrix* R = qr->r;
+    matrix_free_many(2, SA, qr->q);
+    free(qr);
+    return precond_from_r(R);
+}
@@ -0,0 +1,63 @@
+/* sketch.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include <stdint.h>
+#include "vector.h"
+#include "matrix.h"
+#include "linop.h"
+
+/* Random sketching operators: an s x n matrix S, with s much smaller than
+   n, such that |S x| is close to |x| for all x in a fixed subspace (the
+   range of a tall matrix A) when s is a few times its dimension.  S A is
+   then a small stand in for A in least squares problems.
+
+     - SKETCH_GAUSSIAN: independent N(0, 1 / s) entries.  The most accurate
+       and the most expensive, O(s n p) to apply to an n x p matrix.
+     - SKETCH_SPARSE_SIGN: SKETCH_SPARSE_NNZ entries of +-1 / sqrt(nnz) in
+       each column, in distinct random rows (OSNAP; CountSketch when nnz is
+       1).  O(nnz n p) to apply.
+     - SKETCH_SRHT: subsampled randomized Hadamard transform, the random
+       signs D, then the Walsh-Hadamard transform H (n padded to a power of
+       two m), then s random rows, S = P H D / sqrt(s).  O(m log(m) p).
+
+   S is never formed, its entries are drawn again from seed on each
+   application, so S applied to A and to b is the same operator.
+*/
+enum sketch_kind {
+    SKETCH_GAUSSIAN,
+    SKETCH_SPARSE_SIGN,
+    SKETCH_SRHT
+};
+
+#define SKETCH_SPARSE_NNZ 8
+
+struct sketch {
+    enum sketch_kind kind;
+    int n;
+    int s;
+    uint64_t seed;
+    // SRHT only: the padded size, the signs of D, and the rows kept.
+    int m;
+    double* signs;
+    int* sample;
+};
+
+struct sketch* sketch_new(enum sketch_kind kind, int n, int s, uint64_t seed);
+void           sketch_free(struct sketch* S);
+
+struct matrix* sketch_apply(struct sketch* S, struct matrix* A);
+void           sketch_apply_into(struct matrix* reciever, struct sketch* S, struct matrix* A);
+struct vector* sketch_apply_vector(struct sketch* S, struct vector* v);
+
+/* R^-1, for the R of a QR decomposition of S A, as a right preconditioner
+   for least squares problems in A (see linsolve_lsqr).  Freed by
+   linop_free.
+*/
+struct linop* precond_sketch_qr(struct sketch* S, struct matrix* A);
+
+/* R^-1 for an upper triangular R already at hand, e.g. from a
+   decomposition of S A made for another use.  The linop takes R over, and
+   frees it in linop_free.
+*/
+struct linop* precond_from_r(struct matrix* R);
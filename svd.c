@@ -0,0 +1,463 @@
+/* svd.c
+  (c) Alexis Rigaud, 2024
+
+  Singular value decomposition by one-sided Jacobi rotations.
+*/
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include "vector.h"
+#include "matrix.h"
+#include "util.h"
+#include "parallel.h"
+#include "rand.h"
+#include "svd.h"
+
+struct svd* svd_new(void) {
+    struct svd* svd = malloc(sizeof(struct svd));
+    check_memory((void*) svd);
+    svd->singular_values = NULL;
+    svd->u = NULL;
+    svd->v = NULL;
+    return svd;
+}
+
+void svd_free(struct svd* svd) {
+    vector_free(svd->singular_values);
+    if(svd->u != NULL) {
+        matrix_free(svd->u);
+    }
+    if(svd->v != NULL) {
+        matrix_free(svd->v);
+    }
+    free(svd);
+}
+
+/* One-sided Jacobi.
+
+   The rows of W (the columns of the decomposed matrix) are rotated in pairs
+   until they are mutually orthogonal.  Rotating rows a and b by
+
+     [w_a w_b] <- [w_a w_b] [c s; -s c]
+
+   with t = s / c the smallest root of t^2 + 2 zeta t - 1 = 0,
+   zeta = (|w_b|^2 - |w_a|^2) / (2 w_a.w_b), makes them orthogonal.  When all
+   rows are orthogonal, W^t = U S and the accumulated rotations are V.
+
+   The pairs are visited in round robin (tournament) order: each round is a
+   set of disjoint pairs, so the rotations of a round are independent and run
+   concurrently, and the p - 1 rounds of a sweep meet every pair exactly once.
+*/
+struct jacobi_round {
+    struct matrix* w;
+    struct matrix* vt;
+    int n_players;
+    int round;
+    double tol;
+    double* off;
+};
+
+/* The i-th pair of a round, for an even number of players.  Player 0 stays
+   put and the others turn around a circle.
+*/
+static void round_robin_pair(int n_players, int round, int i, int* a, int* b) {
+    int n_circle = n_players - 1;
+    if(i == 0) {
+        *a = 0;
+        *b = 1 + round % n_circle;
+    } else {
+        *a = 1 + (round + i) % n_circle;
+        *b = 1 + (round - i + n_circle) % n_circle;
+    }
+}
+
+static void rotate_rows(double* restrict x, double* restrict y, int length,
+                        double c, double s) {
+    double t_x, t_y;
+    for(int k = 0; k < length; k++) {
+        t_x = x[k]; t_y = y[k];
+        x[k] = c * t_x - s * t_y;
+        y[k] = s * t_x + c * t_y;
+    }
+}
+
+static void jacobi_rotate_pair(void* arg, int i, int thread_idx) {
+    (void) thread_idx;
+    struct jacobi_round* jr = arg;
+    struct matrix* w = jr->w;
+    int a, b;
+    round_robin_pair(jr->n_players, jr->round, i, &a, &b);
+    jr->off[i] = 0;
+    // With an odd number of rows, the last player is a dummy.
+    if(a >= w->n_row || b >= w->n_row) {
+        return;
+    }
+
+    int length = w->n_col;
+    double* restrict w_a = DATA(w) + a * length;
+    double* restrict w_b = DATA(w) + b * length;
+    double alpha = 0, beta = 0, gamma = 0;
+    for(int k = 0; k < length; k++) {
+        alpha += w_a[k] * w_a[k];
+        beta  += w_b[k] * w_b[k];
+        gamma += w_a[k] * w_b[k];
+    }
+    if(alpha == 0 || beta == 0) {
+        return;
+    }
+    double off = fabs(gamma) / sqrt(alpha * beta);
+    jr->off[i] = off;
+    if(off <= jr->tol) {
+        return;
+    }
+
+    double zeta = (beta - alpha) / (2 * gamma);
+    double t = ((zeta >= 0) ? 1.0 : -1.0) / (fabs(zeta) + sqrt(1 + zeta * zeta));
+    double c = 1 / sqrt(1 + t * t);
+    double s = c * t;
+    rotate_rows(w_a, w_b, length, c, s);
+    if(jr->vt != NULL) {
+        int n_v = jr->vt->n_col;
+        rotate_rows(DATA(jr->vt) + a * n_v, DATA(jr->vt) + b * n_v, n_v, c, s);
+    }
+}
+
+/* Orthogonalize the rows of w, accumulating the rotations into the rows of
+   vt when it is not NULL.  Returns the number of sweeps done.
+*/
+static int jacobi_orthogonalize(struct matrix* w, struct matrix* vt,
+                                double tol, int max_iter) {
+    struct jacobi_round jr;
+    jr.w = w;
+    jr.vt = vt;
+    jr.n_players = w->n_row + (w->n_row % 2);
+    jr.tol = (tol > DBL_EPSILON) ? tol : DBL_EPSILON;
+    int n_pairs = jr.n_players / 2;
+    jr.off = malloc(sizeof(double) * n_pairs);
+    check_memory((void*) jr.off);
+
+    // Each pair costs a few passes over rows of length n_col, hand out
+    // enough pairs to a thread to be worth waking it.
+    int grain = 1 + 16384 / (w->n_col + ((vt != NULL) ? vt->n_col : 0));
+
+    int sweep = 0;
+    double max_off;
+    do {
+        max_off = 0;
+        for(int round = 0; round < jr.n_players - 1; round++) {
+            jr.round = round;
+            parallel_for(n_pairs, grain, jacobi_rotate_pair, &jr);
+            for(int i = 0; i < n_pairs; i++) {
+                max_off = (jr.off[i] > max_off) ? jr.off[i] : max_off;
+            }
+        }
+        sweep++;
+    } while(max_off > jr.tol && sweep < max_iter);
+
+    free(jr.off);
+    return sweep;
+}
+
+struct sort_item {
+    double value;
+    int idx;
+};
+
+static int compare_decreasing(const void* x, const void* y) {
+    double vx = ((const struct sort_item*) x)->value;
+    double vy = ((const struct sort_item*) y)->value;
+    return (vx < vy) - (vx > vy);
+}
+
+/* Replace columns n_valid, ..., n_col - 1 of M by an orthonormal completion of
+   the first n_valid (orthonormal) columns.  With Q = H_0 ... H_{n_valid - 1}
+   the Householder reflectors of a QR decomposition of those columns, the
+   columns n_valid, ... of Q are orthogonal to them, and are the products of
+   the reflectors with the unit vectors.  O(n n_valid) per column.
+*/
+static void complete_orthonormal_columns(struct matrix* M, int n_valid) {
+    int n = M->n_row;
+    // The valid columns, contiguous, reduced to the (unit) reflector vectors.
+    double* v = malloc(sizeof(double) * n * (n_valid > 0 ? n_valid : 1));
+    check_memory((void*) v);
+    double* x = malloc(sizeof(double) * n);
+    check_memory((void*) x);
+    for(int j = 0; j < n_valid; j++) {
+        for(int i = 0; i < n; i++) {
+            v[j * n + i] = MATRIX_IDX_INTO(M, i, j);
+        }
+    }
+    for(int k = 0; k < n_valid; k++) {
+        double* v_k = v + k * n;
+        double norm_sq = 0;
+        for(int i = k; i < n; i++) {
+            norm_sq += v_k[i] * v_k[i];
+        }
+        double alpha = (v_k[k] >= 0) ? -sqrt(norm_sq) : sqrt(norm_sq);
+        // v = x - alpha e_k, so that H x = alpha e_k.
+        norm_sq -= v_k[k] * v_k[k];
+        v_k[k] -= alpha;
+        norm_sq += v_k[k] * v_k[k];
+        double scale = (norm_sq > 0) ? 1 / sqrt(norm_sq) : 0;
+        for(int i = k; i < n; i++) {
+            v_k[i] *= scale;
+        }
+        for(int j = k + 1; j < n_valid; j++) {
+            double* v_j = v + j * n;
+            double dp = 0;
+            for(int i = k; i < n; i++) {
+                dp += v_k[i] * v_j[i];
+            }
+            for(int i = k; i < n; i++) {
+                v_j[i] -= 2 * dp * v_k[i];
+            }
+        }
+    }
+    for(int col = n_valid; col < M->n_col; col++) {
+        for(int i = 0; i < n; i++) {
+            x[i] = (i == col) ? 1 : 0;
+        }
+        for(int k = n_valid - 1; k >= 0; k--) {
+            double* v_k = v + k * n;
+            double dp = 0;
+            for(int i = k; i < n; i++) {
+                dp += v_k[i] * x[i];
+            }
+            for(int i = k; i < n; i++) {
+                x[i] -= 2 * dp * v_k[i];
+            }
+        }
+        for(int i = 0; i < n; i++) {
+            MATRIX_IDX_INTO(M, i, col) = x[i];
+        }
+    }
+    free(v);
+    free(x);
+}
+
+/* Compute the singular value decomposition of a matrix M.
+
+   The one-sided Jacobi algorithm works on the columns of M when M has at
+   least as many rows as columns, and on its rows otherwise (which is the
+   decomposition of the transpose, with U and V exchanged).  It computes the
+   small singular values to high relative accuracy.
+*/
+struct svd* matrix_svd(struct matrix* M, enum svd_job job, double tol, int max_iter) {
+    bool tall = (M->n_row >= M->n_col);
+    // Rows of w are the columns of the tall one of M, M^t.
+    struct matrix* w = tall ? matrix_transpose(M) : matrix_copy(M);
+    int n_short = w->n_row;
+    int n_long = w->n_col;
+    struct matrix* vt = (job == SVD_VALUES_ONLY) ? NULL : matrix_identity(n_short);
+
+    jacobi_orthogonalize(w, vt, tol, max_iter);
+
+    struct sort_item* order = malloc(sizeof(struct sort_item) * n_short);
+    check_memory((void*) order);
+    for(int i = 0; i < n_short; i++) {
+        double* w_i = DATA(w) + i * n_long;
+        double norm_sq = 0;
+        for(int k = 0; k < n_long; k++) {
+            norm_sq += w_i[k] * w_i[k];
+        }
+        order[i].value = sqrt(norm_sq);
+        order[i].idx = i;
+    }
+    qsort(order, n_short, sizeof(struct sort_item), compare_decreasing);
+
+    struct svd* svd = svd_new();
+    svd->n_row = M->n_row;
+    svd->n_col = M->n_col;
+    svd->k = n_short;
+    svd->singular_values = vector_new(n_short);
+    for(int i = 0; i < n_short; i++) {
+        VECTOR_IDX_INTO(svd->singular_values, i) = order[i].value;
+    }
+
+    if(job != SVD_VALUES_ONLY) {
+        // Singular vectors of the long side are the normalized rows of w,
+        // those of the short side are the rows of vt.
+        int n_long_vectors = (job == SVD_FULL) ? n_long : n_short;
+        struct matrix* long_vectors = matrix_zeros(n_long, n_long_vectors);
+        struct matrix* short_vectors = matrix_new(n_short, n_short);
+        double zero_tol = order[0].value * n_long * DBL_EPSILON;
+        int n_valid = 0;
+        for(int j = 0; j < n_short; j++) {
+            int idx = order[j].idx;
+            double sigma = order[j].value;
+            for(int i = 0; i < n_short; i++) {
+                MATRIX_IDX_INTO(short_vectors, i, j) = MATRIX_IDX_INTO(vt, idx, i);
+            }
+            if(sigma > zero_tol) {
+                for(int i = 0; i < n_long; i++) {
+                    MATRIX_IDX_INTO(long_vectors, i, j) = MATRIX_IDX_INTO(w, idx, i) / sigma;
+                }
+                n_valid++;
+            }
+        }
+        complete_orthonormal_columns(long_vectors, n_valid);
+        svd->u = tall ? long_vectors : short_vectors;
+        svd->v = tall ? short_vectors : long_vectors;
+        matrix_free(vt);
+    }
+
+    free(order);
+    matrix_free(w);
+    return svd;
+}
+
+/* Keep only the k largest singular triplets of the (thin) decomposition. */
+struct svd* matrix_svd_truncated(struct matrix* M, int k, double tol, int max_iter) {
+    struct svd* full = matrix_svd(M, SVD_THIN, tol, max_iter);
+    assert(1 <= k && k <= full->k);
+
+    struct svd* svd = svd_new();
+    svd->n_row = full->n_row;
+    svd->n_col = full->n_col;
+    svd->k = k;
+    svd->singular_values = vector_new(k);
+    svd->u = matrix_new(full->u->n_row, k);
+    svd->v = matrix_new(full->v->n_row, k);
+    for(int j = 0; j < k; j++) {
+        VECTOR_IDX_INTO(svd->singular_values, j) = VECTOR_IDX_INTO(full->singular_values, j);
+    }
+    for(int i = 0; i < svd->u->n_row; i++) {
+        for(int j = 0; j < k; j++) {
+            MATRIX_IDX_INTO(svd->u, i, j) = MATRIX_IDX_INTO(full->u, i, j);
+        }
+    }
+    for(int i = 0; i < svd->v->n_row; i++) {
+        for(int j = 0; j < k; j++) {
+            MATRIX_IDX_INTO(svd->v, i, j) = MATRIX_IDX_INTO(full->v, i, j);
+        }
+    }
+    svd_free(full);
+    return svd;
+}
+
+/* Replace the columns of M by an orthonormal basis of their span.
+
+   Modified Gram-Schmidt, done twice, on the rows of the transpose (so the
+   inner loops are contiguous).  Columns that are (numerically) dependent on
+   the previous ones are set to zero instead of being normalized.
+*/
+static void orthonormalize_columns(struct matrix* M) {
+    struct matrix* Mt = matrix_transpose(M);
+    int n = Mt->n_col;
+    for(int j = 0; j < Mt->n_row; j++) {
+        double* m_j = DATA(Mt) + j * n;
+        double norm_sq = 0, norm_sq_before = 0;
+        for(int k = 0; k < n; k++) {
+            norm_sq_before += m_j[k] * m_j[k];
+        }
+        for(int pass = 0; pass < 2; pass++) {
+            for(int i = 0; i < j; i++) {
+                double* m_i = DATA(Mt) + i * n;
+                double dp = 0;
+                for(int k = 0; k < n; k++) {
+                    dp += m_i[k] * m_j[k];
+                }
+                for(int k = 0; k < n; k++) {
+                    m_j[k] -= dp * m_i[k];
+                }
+            }
+        }
+        for(int k = 0; k < n; k++) {
+            norm_sq += m_j[k] * m_j[k];
+        }
+        double scale = (norm_sq > 1e-20 * norm_sq_before && norm_sq > 0) ? 1 / sqrt(norm_sq) : 0;
+        for(int k = 0; k < n; k++) {
+            m_j[k] *= scale;
+        }
+    }
+    for(int i = 0; i < M->n_row; i++) {
+        for(int j = 0; j < M->n_col; j++) {
+            MATRIX_IDX_INTO(M, i, j) = MATRIX_IDX_INTO(Mt, j, i);
+        }
+    }
+    matrix_free(Mt);
+}
+
+/* Find a matrix Q with n_col orthonormal columns whose span approximately
+   contains the range of M (Halko, Martinsson and Tropp).
+
+   M is multiplied into a gaussian random matrix, and the product
+   orthonormalized.  Each power iteration multiplies by M M^t again, which
+   damps the contribution of the small singular values when the spectrum of M
+   decays slowly.  All the work is in the matrix products.
+*/
+struct matrix* matrix_range_finder(struct matrix* M, int n_col, int n_power_iter) {
+    assert(1 <= n_col && n_col <= M->n_col);
+    assert(n_power_iter >= 0);
+    struct matrix* omega = matrix_random_gaussian(M->n_col, n_col, 0, 1);
+    struct matrix* Q = matrix_multiply(M, omega);
+    orthonormalize_columns(Q);
+    matrix_free(omega);
+
+    for(int i = 0; i < n_power_iter; i++) {
+        // Renormalizing between the products keeps the columns from all
+        // collapsing onto the top singular vector.
+        struct matrix* Z = matrix_multiply_MtN(M, Q);
+        orthonormalize_columns(Z);
+        matrix_free(Q);
+        Q = matrix_multiply(M, Z);
+        orthonormalize_columns(Q);
+        matrix_free(Z);
+    }
+    return Q;
+}
+
+/* Compute the k largest singular triplets of M by a randomized method.
+
+   With Q an orthonormal basis of (approximately) the range of M, from
+   matrix_range_finder with k + n_oversample columns, M ~ Q Q^t M.  The small
+   matrix B = Q^t M is decomposed exactly, B = U' S V^t, and then
+   M ~ (Q U') S V^t.  A few power iterations (say 2) give accurate singular
+   vectors unless the spectrum of M decays very slowly.
+*/
+struct svd* matrix_svd_randomized(struct matrix* M, int k, int n_oversample,
+                                  int n_power_iter) {
+    assert(k >= 1);
+    assert(n_oversample >= 0);
+    int n_sample = k + n_oversample;
+    if(n_sample > M->n_col) {
+        n_sample = M->n_col;
+    }
+    if(n_sample > M->n_row) {
+        n_sample = M->n_row;
+    }
+    assert(k <= n_sample);
+
+    struct matrix* Q = matrix_range_finder(M, n_sample, n_power_iter);
+    // Bt = M^t Q is the transpose of B, and is tall.
+    struct matrix* Bt = matrix_multiply_MtN(M, Q);
+    struct svd* small = matrix_svd(Bt, SVD_THIN, 1e-12, 50);
+
+    struct svd* svd = svd_new();
+    svd->n_row = M->n_row;
+    svd->n_col = M->n_col;
+    svd->k = k;
+    svd->singular_values = vector_new(k);
+    svd->v = matrix_new(M->n_col, k);
+    for(int j = 0; j < k; j++) {
+        VECTOR_IDX_INTO(svd->singular_values, j) = VECTOR_IDX_INTO(small->singular_values, j);
+    }
+    // The right singular vectors of Bt are the left ones of B.
+    struct matrix* Ub = matrix_new(n_sample, k);
+    for(int i = 0; i < n_sample; i++) {
+        for(int j = 0; j < k; j++) {
+            MATRIX_IDX_INTO(Ub, i, j) = MATRIX_IDX_INTO(small->v, i, j);
+        }
+    }
+    svd->u = matrix_multiply(Q, Ub);
+    for(int i = 0; i < M->n_col; i++) {
+        for(int j = 0; j < k; j++) {
+            MATRIX_IDX_INTO(svd->v, i, j) = MATRIX_IDX_INTO(small->u, i, j);
+        }
+    }
+
+    matrix_free_many(3, Q, Bt, Ub); svd_free(small);
+    return svd;
+}
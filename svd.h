@@ -0,0 +1,45 @@
+/* svd.h
+  (c) Alexis Rigaud, 2024
+*/
+#pragma once
+#include "vector.h"
+#include "matrix.h"
+
+/* Singular value decomposition M = U S V^t.
+
+   The singular values are stored in decreasing order, the columns of u and v
+   are the matching left and right singular vectors:
+
+     - SVD_VALUES_ONLY: only the singular values, u and v are NULL.
+     - SVD_THIN: u is n_row x k and v is n_col x k, with k = min(n_row, n_col).
+     - SVD_FULL: u is n_row x n_row and v is n_col x n_col.
+
+   A truncated decomposition keeps only the k largest singular triplets.
+*/
+enum svd_job {
+    SVD_VALUES_ONLY,
+    SVD_THIN,
+    SVD_FULL
+};
+
+struct svd {
+    int n_row;
+    int n_col;
+    int k;
+    struct vector* singular_values;
+    struct matrix* u;
+    struct matrix* v;
+};
+
+struct svd* svd_new(void);
+void        svd_free(struct svd* svd);
+
+struct svd* matrix_svd(struct matrix* M, enum svd_job job, double tol, int max_iter);
+struct svd* matrix_svd_truncated(struct matrix* M, int k, double tol, int max_iter);
+
+/* Randomized low rank approximation, for when only a few of the largest
+   singular triplets of a large matrix are wanted.
+*/
+struct matrix* matrix_range_finder(struct matrix* M, int n_col, int n_power_iter);
+struct svd*    matrix_svd_randomized(struct matrix* M, int k, int n_oversample,
+                                     int n_power_iter);
@@ -10,9 +10,20 @@
 #include "vector.h"
 #include "matrix.h"
 #include "linsolve.h"
+#include "linsolve_krylov.h"
 #include "eigen.h"
+#include "eigen_symmetric.h"
+#include "eigen_krylov.h"
+#include "linop.h"
+#include "parallel.h"
 #include "linreg.h"
+#include "glm.h"
 #include "rand.h"
+#include "qr_update.h"
+#include "svd.h"
+#include "serialize.h"
+#include "sketch.h"
+#include "kernel.h"
 
 
 /**********************************
@@ -530,6 +541,16 @@ bool test_qr_decomp_random() {
     return test;
 }
 
+int _compare_increasing(const void* x, const void* y) {
+    double dx = *(const double*) x, dy = *(const double*) y;
+    return (dx > dy) - (dx < dy);
+}
+
+/* Sort the entries of a (contiguous) vector in increasing order. */
+void _vector_sort(struct vector* v) {
+    qsort(DATA(v), v->length, sizeof(double), _compare_increasing);
+}
+
 bool test_eigenvalues_diagonal() {
     double D[] = {1.0, 2.0, 3.0,
                   0.0, 0.5, 0.0,
@@ -561,13 +582,286 @@ bool test_eigenvalues_simple_3x3() {
                    4.0,  2.0, 5.0};
     struct matrix* M = matrix_from_array(D, 3, 3);
     struct eigen* e = eigen_solve(M, 0.0001, 100);
-    double C[] = {6.0, -5.0, 3};
+    // The order of the eigenvalues depends on the path the QR iterations take.
+    double C[] = {-5.0, 3.0, 6.0};
     struct vector* res = vector_from_array(C, 3);
+    _vector_sort(e->eigenvalues);
     bool test = vector_equal(e->eigenvalues, res, 0.01);
     matrix_free(M); vector_free(res); eigen_free(e);
     return test;
 }
 
+bool test_eigenvalues_complex_pair() {
+    // A rotation by a quarter turn, with eigenvalues +i and -i.
+    double D[] = {0.0, -1.0,
+                  1.0,  0.0};
+    struct matrix* M = matrix_from_array(D, 2, 2);
+    struct vector* real = vector_new(2);
+    struct vector* imag = vector_new(2);
+    eigen_solve_eigenvalues_into(real, imag, M, 0.0, 100);
+    double R[] = {0.0, 0.0};
+    double I[] = {1.0, -1.0};
+    struct vector* real_res = vector_from_array(R, 2);
+    struct vector* imag_res = vector_from_array(I, 2);
+    bool test = vector_equal(real, real_res, 1e-12) && vector_equal(imag, imag_res, 1e-12);
+    matrix_free(M); vector_free_many(4, real, imag, real_res, imag_res);
+    return test;
+}
+
+bool test_eigenvalues_companion() {
+    // Companion matrix of (x - 1)(x - 2)(x^2 + 1) = x^4 - 3x^3 + 3x^2 - 3x + 2,
+    // with eigenvalues 1, 2, i and -i.
+    double D[] = {3.0, -3.0, 3.0, -2.0,
+                  1.0,  0.0, 0.0,  0.0,
+                  0.0,  1.0, 0.0,  0.0,
+                  0.0,  0.0, 1.0,  0.0};
+    struct matrix* M = matrix_from_array(D, 4, 4);
+    struct vector* real = vector_new(4);
+    struct vector* imag = vector_new(4);
+    eigen_solve_eigenvalues_into(real, imag, M, 0.0, 100);
+    int n_real = 0, n_complex = 0;
+    for(int i = 0; i < 4; i++) {
+        double re = VECTOR_IDX_INTO(real, i), im = VECTOR_IDX_INTO(imag, i);
+        if(fabs(im) < 1e-8 && (fabs(re - 1) < 1e-8 || fabs(re - 2) < 1e-8)) {
+            n_real++;
+        } else if(fabs(re) < 1e-8 && fabs(fabs(im) - 1) < 1e-8) {
+            n_complex++;
+        }
+    }
+    bool test = (n_real == 2) && (n_complex == 2)
+             && fabs(VECTOR_IDX_INTO(real, 0) + VECTOR_IDX_INTO(real, 1)
+                     + VECTOR_IDX_INTO(real, 2) + VECTOR_IDX_INTO(real, 3) - 3) < 1e-8;
+    matrix_free(M); vector_free_many(2, real, imag);
+    return test;
+}
+
+bool test_eigenvalues_random() {
+    // The eigenvalues of a random (non symmetric) matrix must sum to its
+    // trace, and the sum of their squares to the trace of M^2.
+    int n = 60;
+    struct matrix* M = matrix_random_uniform(n, n, -1, 1);
+    struct matrix* MM = matrix_multiply(M, M);
+    struct vector* real = vector_new(n);
+    struct vector* imag = vector_new(n);
+    eigen_solve_eigenvalues_into(real, imag, M, 0.0, 100);
+    double trace = 0, trace_sq = 0, sum = 0, sum_sq = 0;
+    for(int i = 0; i < n; i++) {
+        double re = VECTOR_IDX_INTO(real, i), im = VECTOR_IDX_INTO(imag, i);
+        trace += MATRIX_IDX_INTO(M, i, i);
+        trace_sq += MATRIX_IDX_INTO(MM, i, i);
+        sum += re;
+        sum_sq += re * re - im * im;
+    }
+    bool test = fabs(trace - sum) < 1e-8 && fabs(trace_sq - sum_sq) < 1e-8;
+    matrix_free_many(2, M, MM); vector_free_many(2, real, imag);
+    return test;
+}
+
+bool test_hessenberg_random() {
+    int n = 20;
+    struct matrix* M = matrix_random_uniform(n, n, -1, 1);
+    struct matrix* H = matrix_hessenberg(M);
+    bool test = true;
+    double trace_M = 0, trace_H = 0;
+    for(int i = 0; i < n; i++) {
+        trace_M += MATRIX_IDX_INTO(M, i, i);
+        trace_H += MATRIX_IDX_INTO(H, i, i);
+        for(int j = 0; j < i - 1; j++) {
+            test = test && MATRIX_IDX_INTO(H, i, j) == 0;
+        }
+    }
+    test = test && fabs(trace_M - trace_H) < 1e-10;
+    matrix_free_many(2, M, H);
+    return test;
+}
+
+bool test_eigen_symmetric_simple() {
+    double D[] = {2.0, -1.0,  0.0,
+                 -1.0,  2.0, -1.0,
+                  0.0, -1.0,  2.0};
+    struct matrix* M = matrix_from_array(D, 3, 3);
+    struct eigen* e = eigen_solve_symmetric(M);
+    double C[] = {2.0 + sqrt(2.0), 2.0, 2.0 - sqrt(2.0)};
+    struct vector* res = vector_from_array(C, 3);
+    bool test = vector_equal(e->eigenvalues, res, 1e-12);
+    matrix_free(M); vector_free(res); eigen_free(e);
+    return test;
+}
+
+/* M V = V diag(eigenvalues) and V^t V = I, for a symmetric matrix. */
+bool _eigen_symmetric_recovers_matrix(struct eigen* e, struct matrix* M, double tol) {
+    struct matrix* MV = matrix_multiply(M, e->eigenvectors);
+    struct matrix* VL = matrix_copy(e->eigenvectors);
+    for(int i = 0; i < VL->n_row; i++) {
+        for(int j = 0; j < VL->n_col; j++) {
+            MATRIX_IDX_INTO(VL, i, j) *= VECTOR_IDX_INTO(e->eigenvalues, j);
+        }
+    }
+    struct matrix* VtV = matrix_multiply_MtN(e->eigenvectors, e->eigenvectors);
+    struct matrix* I = matrix_identity(M->n_row);
+    bool test = matrix_equal(MV, VL, tol) && matrix_equal(VtV, I, tol);
+    matrix_free_many(4, MV, VL, VtV, I);
+    return test;
+}
+
+bool test_eigen_symmetric_random() {
+    // Large enough to be split by divide and conquer a few times.
+    struct matrix* X = matrix_random_uniform(150, 150, -1, 1);
+    struct matrix* M = matrix_multiply_MtN(X, X);
+    struct eigen* e = eigen_solve_symmetric(M);
+    bool test = _eigen_symmetric_recovers_matrix(e, M, 1e-9);
+    for(int i = 1; i < e->n; i++) {
+        test = test && VECTOR_IDX_INTO(e->eigenvalues, i - 1) >= VECTOR_IDX_INTO(e->eigenvalues, i);
+    }
+    struct vector* values = eigen_solve_symmetric_eigenvalues(M);
+    test = test && vector_equal(values, e->eigenvalues, 1e-9);
+    matrix_free_many(2, X, M); vector_free(values); eigen_free(e);
+    return test;
+}
+
+bool test_eigen_symmetric_repeated() {
+    // Many equal eigenvalues, which are deflated in the merges.
+    int n = 60;
+    struct matrix* M = matrix_zeros(n, n);
+    for(int i = 0; i < n; i++) {
+        MATRIX_IDX_INTO(M, i, i) = i % 3;
+    }
+    struct matrix* X = matrix_random_uniform(n, n, -1, 1);
+    struct qr_decomp* qr = matrix_qr_decomposition(X);
+    struct matrix* Qt = matrix_transpose(qr->q);
+    struct matrix* MQt = matrix_multiply(M, Qt);
+    struct matrix* QMQt = matrix_multiply(qr->q, MQt);
+    struct eigen* e = eigen_solve_symmetric(QMQt);
+    bool test = _eigen_symmetric_recovers_matrix(e, QMQt, 1e-9)
+             && fabs(VECTOR_IDX_INTO(e->eigenvalues, 0) - 2) < 1e-9
+             && fabs(VECTOR_IDX_INTO(e->eigenvalues, n - 1)) < 1e-9;
+    matrix_free_many(5, M, X, Qt, MQt, QMQt); qr_decomp_free(qr); eigen_free(e);
+    return test;
+}
+
+/* |M x - lambda x| for the real eigenpair in column j. */
+double _eigen_pair_residual(struct eigen* e, struct matrix* M, int j) {
+    double residual = 0;
+    for(int i = 0; i < M->n_row; i++) {
+        double s = 0;
+        for(int l = 0; l < M->n_col; l++) {
+            s += MATRIX_IDX_INTO(M, i, l) * MATRIX_IDX_INTO(e->eigenvectors, l, j);
+        }
+        s -= VECTOR_IDX_INTO(e->eigenvalues, j) * MATRIX_IDX_INTO(e->eigenvectors, i, j);
+        residual += s * s;
+    }
+    return sqrt(residual);
+}
+
+bool test_eigen_lanczos_dense() {
+    struct matrix* X = matrix_random_uniform(150, 150, -1, 1);
+    struct matrix* M = matrix_multiply_MtN(X, X);
+    struct linop* A = linop_from_matrix(M);
+    struct vector* values = eigen_solve_symmetric_eigenvalues(M);
+    struct eigen* largest = eigen_solve_lanczos(A, 4, EIGEN_LARGEST, 1e-10, 300);
+    struct eigen* smallest = eigen_solve_lanczos(A, 3, EIGEN_SMALLEST, 1e-10, 300);
+    double scale = VECTOR_IDX_INTO(values, 0);
+    bool test = largest->n == 4 && smallest->n == 3;
+    for(int j = 0; j < 4; j++) {
+        test = test && fabs(VECTOR_IDX_INTO(largest->eigenvalues, j) - VECTOR_IDX_INTO(values, j)) < 1e-8 * scale
+                    && _eigen_pair_residual(largest, M, j) < 1e-7 * scale;
+    }
+    for(int j = 0; j < 3; j++) {
+        test = test && fabs(VECTOR_IDX_INTO(smallest->eigenvalues, j) - VECTOR_IDX_INTO(values, 149 - j)) < 1e-8 * scale
+                    && _eigen_pair_residual(smallest, M, j) < 1e-7 * scale;
+    }
+    matrix_free_many(2, X, M); linop_free(A); vector_free(values);
+    eigen_free(largest); eigen_free(smallest);
+    return test;
+}
+
+// The second difference matrix tridiag(-1, 2, -1), never formed.
+void _laplacian_apply(void* ctx, const double* x, double* y) {
+    int n = *(int*) ctx;
+    for(int i = 0; i < n; i++) {
+        y[i] = 2 * x[i] - ((i > 0) ? x[i - 1] : 0) - ((i < n - 1) ? x[i + 1] : 0);
+    }
+}
+
+bool test_eigen_lanczos_operator() {
+    // The eigenvalues of the second difference matrix are
+    // 2 - 2 cos(j pi / (n + 1)).
+    int n = 200;
+    double pi = 4 * atan(1.0);
+    struct linop* A = linop_new(n, n, _laplacian_apply, NULL, &n);
+    struct eigen* e = eigen_solve_lanczos(A, 3, EIGEN_LARGEST, 1e-10, 500);
+    bool test = true;
+    for(int j = 0; j < 3; j++) {
+        double value = 2 - 2 * cos((n - j) * pi / (n + 1));
+        test = test && fabs(VECTOR_IDX_INTO(e->eigenvalues, j) - value) < 1e-9;
+    }
+    linop_free(A); eigen_free(e);
+    return test;
+}
+
+bool test_eigen_arnoldi_triangular() {
+    // The eigenvalues of a triangular matrix are its diagonal.  The matrix
+    // is far from normal, so they are only as accurate as the residual
+    // times their condition number.
+    int n = 200;
+    struct matrix* M = matrix_random_uniform(n, n, -1, 1);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < i; j++) {
+            MATRIX_IDX_INTO(M, i, j) = 0;
+        }
+        MATRIX_IDX_INTO(M, i, i) = i + 1;
+    }
+    struct linop* A = linop_from_matrix(M);
+    struct eigen* e = eigen_solve_arnoldi(A, 3, EIGEN_LARGEST_MAGNITUDE, 1e-10, 300);
+    bool test = e->n == 3;
+    for(int j = 0; test && j < 3; j++) {
+        test = fabs(VECTOR_IDX_INTO(e->eigenvalues, j) - (n - j)) < 1e-5
+            && VECTOR_IDX_INTO(e->eigenvalues_imag, j) == 0
+            && _eigen_pair_residual(e, M, j) < 1e-6;
+    }
+    matrix_free(M); linop_free(A); eigen_free(e);
+    return test;
+}
+
+bool test_eigen_arnoldi_complex_pair() {
+    // A rotation block with eigenvalues 1 +- 10 i on top of a triangular
+    // matrix with smaller eigenvalues: asking for one eigenvalue returns the
+    // conjugate pair, with eigenvector x + iy in two columns.
+    int n = 100;
+    struct matrix* M = matrix_random_uniform(n, n, -1, 1);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < i; j++) {
+            MATRIX_IDX_INTO(M, i, j) = 0;
+        }
+        MATRIX_IDX_INTO(M, i, i) = 5.0 * i / n;
+    }
+    MATRIX_IDX_INTO(M, 0, 0) = 1;
+    MATRIX_IDX_INTO(M, 0, 1) = -10;
+    MATRIX_IDX_INTO(M, 1, 0) = 10;
+    MATRIX_IDX_INTO(M, 1, 1) = 1;
+    struct linop* A = linop_from_matrix(M);
+    struct eigen* e = eigen_solve_arnoldi(A, 1, EIGEN_LARGEST_MAGNITUDE, 1e-10, 300);
+    bool test = e->n == 2
+             && fabs(VECTOR_IDX_INTO(e->eigenvalues, 0) - 1) < 1e-8
+             && fabs(VECTOR_IDX_INTO(e->eigenvalues_imag, 0) - 10) < 1e-8
+             && fabs(VECTOR_IDX_INTO(e->eigenvalues, 1) - 1) < 1e-8
+             && fabs(VECTOR_IDX_INTO(e->eigenvalues_imag, 1) + 10) < 1e-8;
+    // M (x + iy) = (1 + 10 i)(x + iy).
+    double residual = 0;
+    for(int i = 0; test && i < n; i++) {
+        double mx = 0, my = 0;
+        for(int l = 0; l < n; l++) {
+            mx += MATRIX_IDX_INTO(M, i, l) * MATRIX_IDX_INTO(e->eigenvectors, l, 0);
+            my += MATRIX_IDX_INTO(M, i, l) * MATRIX_IDX_INTO(e->eigenvectors, l, 1);
+        }
+        double x = MATRIX_IDX_INTO(e->eigenvectors, i, 0), y = MATRIX_IDX_INTO(e->eigenvectors, i, 1);
+        residual = fmax(residual, fabs(mx - (x - 10 * y)) + fabs(my - (y + 10 * x)));
+    }
+    test = test && residual < 1e-7;
+    matrix_free(M); linop_free(A); eigen_free(e);
+    return test;
+}
+
 bool test_eigenvectors_random() {
     // M is a random symmetric matrix, it has all real eigenvalues with
     // probability one.
@@ -600,7 +894,65 @@ cleanup:
 }
 
 
-#define N_MATRIX_TESTS 31
+bool test_eigenvectors_threads() {
+    // The eigenvectors are computed concurrently, but must not depend on the
+    // number of threads.
+    struct matrix* X = matrix_random_uniform(30, 30, -1, 1);
+    struct matrix* M = matrix_multiply_MtN(X, X);
+    struct vector* values = eigen_solve_symmetric_eigenvalues(M);
+    int n_threads = parallel_num_threads();
+    parallel_set_num_threads(4);
+    struct matrix* V4 = eigen_solve_eigenvectors(M, values, 1e-10, 100);
+    parallel_set_num_threads(1);
+    struct matrix* V1 = eigen_solve_eigenvectors(M, values, 1e-10, 100);
+    parallel_set_num_threads(n_threads);
+    bool test = matrix_equal(V1, V4, 0.0);
+    struct matrix* MV = matrix_multiply(M, V1);
+    for(int i = 0; i < 30; i++) {
+        for(int j = 0; j < 30; j++) {
+            double lambda_v = VECTOR_IDX_INTO(values, j) * MATRIX_IDX_INTO(V1, i, j);
+            test = test && fabs(MATRIX_IDX_INTO(MV, i, j) - lambda_v) < 1e-6 * VECTOR_IDX_INTO(values, 0);
+        }
+    }
+    matrix_free_many(5, X, M, V1, V4, MV); vector_free(values);
+    return test;
+}
+
+bool test_eigen_qr_save_load() {
+    struct matrix* M = matrix_random_uniform(6, 6, 0, 1);
+    struct eigen* e = eigen_solve(M, 1e-10, 100);
+    struct qr_decomp* qr = matrix_qr_decomposition(M);
+    bool test = eigen_save(e, "test_eigen_save_load.bin")
+             && qr_decomp_save(qr, "test_qr_save_load.bin");
+
+    struct mapped_file* f_e = mapped_file_open("test_eigen_save_load.bin");
+    struct mapped_file* f_qr = mapped_file_open("test_qr_save_load.bin");
+    test = test && f_e != NULL && f_qr != NULL;
+    struct eigen* e_loaded = eigen_from_mapped(f_e);
+    struct qr_decomp* qr_loaded = qr_decomp_from_mapped(f_qr);
+    test = test && e_loaded != NULL && qr_loaded != NULL && e_loaded->n == e->n
+        && vector_equal(e_loaded->eigenvalues, e->eigenvalues, 0.0)
+        && (e->eigenvalues_imag == NULL) == (e_loaded->eigenvalues_imag == NULL)
+        && matrix_equal(e_loaded->eigenvectors, e->eigenvectors, 0.0)
+        && matrix_equal(qr_loaded->q, qr->q, 0.0)
+        && matrix_equal(qr_loaded->r, qr->r, 0.0);
+    eigen_free(e_loaded); qr_decomp_free(qr_loaded);
+    mapped_file_close(f_e); mapped_file_close(f_qr);
+
+    // Eigenvectors that do not match the eigenvalues are rejected.
+    e->n = 5;
+    test = test && eigen_save(e, "test_eigen_save_load.bin");
+    e->n = 6;
+    f_e = mapped_file_open("test_eigen_save_load.bin");
+    test = test && f_e != NULL && eigen_from_mapped(f_e) == NULL;
+    mapped_file_close(f_e);
+    remove("test_eigen_save_load.bin"); remove("test_qr_save_load.bin");
+
+    matrix_free(M); eigen_free(e); qr_decomp_free(qr);
+    return test;
+}
+
+#define N_MATRIX_TESTS 44
 struct test matrix_tests[] = {
     {test_matrix_zeros, "test_matrix_zeros"},
     {test_matrix_identity, "test_matrix_identity"},
@@ -636,6 +988,319 @@ struct test matrix_tests[] = {
     {test_eigenvalues_simple_3x3, "test_eigenvalues_simple_3x3"},
     // 30
     {test_eigenvectors_random, "test_eigenvectors_random"},
+    {test_eigenvectors_threads, "test_eigenvectors_threads"},
+    {test_eigenvalues_complex_pair, "test_eigenvalues_complex_pair"},
+    {test_eigenvalues_companion, "test_eigenvalues_companion"},
+    {test_eigenvalues_random, "test_eigenvalues_random"},
+    {test_hessenberg_random, "test_hessenberg_random"},
+    {test_eigen_symmetric_simple, "test_eigen_symmetric_simple"},
+    {test_eigen_symmetric_random, "test_eigen_symmetric_random"},
+    {test_eigen_symmetric_repeated, "test_eigen_symmetric_repeated"},
+    {test_eigen_lanczos_dense, "test_eigen_lanczos_dense"},
+    {test_eigen_lanczos_operator, "test_eigen_lanczos_operator"},
+    {test_eigen_arnoldi_triangular, "test_eigen_arnoldi_triangular"},
+    {test_eigen_arnoldi_complex_pair, "test_eigen_arnoldi_complex_pair"},
+    {test_eigen_qr_save_load, "test_eigen_qr_save_load"},
+};
+
+
+/************************************
+ * Unit tests for qr update module.
+ ************************************/
+
+/* Copy of M with one row removed. */
+struct matrix* _matrix_drop_row(struct matrix* M, int row) {
+    struct matrix* D = matrix_new(M->n_row - 1, M->n_col);
+    for(int i = 0, k = 0; i < M->n_row; i++) {
+        if(i == row) continue;
+        for(int j = 0; j < M->n_col; j++) {
+            MATRIX_IDX_INTO(D, k, j) = MATRIX_IDX_INTO(M, i, j);
+        }
+        k++;
+    }
+    return D;
+}
+
+/* Copy of M with one column removed. */
+struct matrix* _matrix_drop_column(struct matrix* M, int col) {
+    struct matrix* D = matrix_new(M->n_row, M->n_col - 1);
+    for(int i = 0; i < M->n_row; i++) {
+        for(int j = 0, k = 0; j < M->n_col; j++) {
+            if(j != col) MATRIX_IDX_INTO(D, i, k++) = MATRIX_IDX_INTO(M, i, j);
+        }
+    }
+    return D;
+}
+
+/* Does the updated decomposition agree with a fresh decomposition of M? */
+bool _qr_decomp_matches(struct qr_decomp* qr, struct matrix* M) {
+    struct qr_decomp* fresh = matrix_qr_decomposition(M);
+    bool test = matrix_equal(qr->r, fresh->r, .0001);
+    if(qr->q != NULL) {
+        struct matrix* P = matrix_multiply(qr->q, qr->r);
+        test = test && matrix_equal(P, M, .0001) && matrix_equal(qr->q, fresh->q, .0001);
+        matrix_free(P);
+    }
+    qr_decomp_free(fresh);
+    return test;
+}
+
+bool test_qr_decomp_add_row() {
+    struct matrix* M = matrix_random_uniform(8, 4, 0, 1);
+    struct matrix* top = _matrix_drop_row(M, 7);
+    struct qr_decomp* qr = matrix_qr_decomposition(top);
+    struct vector* row = matrix_row_copy(M, 7);
+    qr_decomp_add_row(qr, row);
+    bool test = _qr_decomp_matches(qr, M);
+    matrix_free_many(2, M, top); vector_free(row); qr_decomp_free(qr);
+    return test;
+}
+
+bool test_qr_decomp_delete_row() {
+    struct matrix* M = matrix_random_uniform(8, 4, 0, 1);
+    struct qr_decomp* qr = matrix_qr_decomposition(M);
+    qr_decomp_delete_row(qr, 3);
+    struct matrix* D = _matrix_drop_row(M, 3);
+    bool test = _qr_decomp_matches(qr, D);
+    matrix_free_many(2, M, D); qr_decomp_free(qr);
+    return test;
+}
+
+bool test_qr_decomp_qless_add_and_downdate() {
+    struct matrix* M = matrix_random_uniform(20, 5, 0, 1);
+    struct qr_decomp* qr = qr_decomp_empty(5);
+    struct vector* row;
+    for(int i = 0; i < M->n_row; i++) {
+        row = matrix_row_copy(M, i);
+        qr_decomp_add_row(qr, row);
+        vector_free(row);
+    }
+    bool test = _qr_decomp_matches(qr, M);
+    row = matrix_row_copy(M, 11);
+    test = test && qr_decomp_downdate_row(qr, row);
+    struct matrix* D = _matrix_drop_row(M, 11);
+    test = test && _qr_decomp_matches(qr, D);
+    matrix_free_many(2, M, D); vector_free(row); qr_decomp_free(qr);
+    return test;
+}
+
+bool test_qr_decomp_add_column() {
+    struct matrix* M = matrix_random_uniform(10, 5, 0, 1);
+    struct matrix* D = _matrix_drop_column(M, 2);
+    struct qr_decomp* qr = matrix_qr_decomposition(D);
+    struct vector* column = matrix_column_copy(M, 2);
+    bool test = qr_decomp_add_column(qr, 2, column);
+    test = test && _qr_decomp_matches(qr, M);
+    matrix_free_many(2, M, D); vector_free(column); qr_decomp_free(qr);
+    return test;
+}
+
+bool test_qr_decomp_add_dependent_column() {
+    struct matrix* M = matrix_random_uniform(10, 4, 0, 1);
+    struct qr_decomp* qr = matrix_qr_decomposition(M);
+    struct matrix* q = matrix_copy(qr->q);
+    struct matrix* r = matrix_copy(qr->r);
+    struct vector* column = vector_new(M->n_row);
+    for(int i = 0; i < M->n_row; i++) {
+        VECTOR_IDX_INTO(column, i) = 2 * MATRIX_IDX_INTO(M, i, 0) - 3 * MATRIX_IDX_INTO(M, i, 3);
+    }
+    bool test = !qr_decomp_add_column(qr, 1, column);
+    test = test && matrix_equal(qr->q, q, 0) && matrix_equal(qr->r, r, 0);
+    test = test && _qr_decomp_matches(qr, M);
+    matrix_free_many(3, M, q, r); vector_free(column); qr_decomp_free(qr);
+    return test;
+}
+
+bool test_qr_decomp_delete_column() {
+    struct matrix* M = matrix_random_uniform(10, 5, 0, 1);
+    struct qr_decomp* qr = matrix_qr_decomposition(M);
+    qr_decomp_delete_column(qr, 1);
+    struct matrix* D = _matrix_drop_column(M, 1);
+    bool test = _qr_decomp_matches(qr, D);
+    matrix_free_many(2, M, D); qr_decomp_free(qr);
+    return test;
+}
+
+bool test_qr_decomp_rank_one_update() {
+    struct matrix* M = matrix_random_uniform(10, 4, 0, 1);
+    struct vector* u = vector_random_uniform(10, 0, 1);
+    struct vector* v = vector_random_uniform(4, 0, 1);
+    struct qr_decomp* qr = matrix_qr_decomposition(M);
+    qr_decomp_rank_one_update(qr, u, v);
+    for(int i = 0; i < M->n_row; i++) {
+        for(int j = 0; j < M->n_col; j++) {
+            MATRIX_IDX_INTO(M, i, j) += VECTOR_IDX_INTO(u, i) * VECTOR_IDX_INTO(v, j);
+        }
+    }
+    bool test = _qr_decomp_matches(qr, M);
+    matrix_free(M); vector_free_many(2, u, v); qr_decomp_free(qr);
+    return test;
+}
+
+
+#define N_QR_UPDATE_TESTS 7
+struct test qr_update_tests[] = {
+    {test_qr_decomp_add_row, "test_qr_decomp_add_row"},
+    {test_qr_decomp_delete_row, "test_qr_decomp_delete_row"},
+    {test_qr_decomp_qless_add_and_downdate, "test_qr_decomp_qless_add_and_downdate"},
+    {test_qr_decomp_add_column, "test_qr_decomp_add_column"},
+    {test_qr_decomp_add_dependent_column, "test_qr_decomp_add_dependent_column"},
+    {test_qr_decomp_delete_column, "test_qr_decomp_delete_column"},
+    {test_qr_decomp_rank_one_update, "test_qr_decomp_rank_one_update"},
+};
+
+
+/*******************************
+ * Unit tests for svd module.
+ *******************************/
+
+/* Is U diag(S) V^t equal to M, and are U and V orthonormal? */
+bool _svd_recovers_matrix(struct svd* svd, struct matrix* M) {
+    struct matrix* US = matrix_zeros(svd->u->n_row, svd->v->n_col);
+    for(int i = 0; i < svd->u->n_row; i++) {
+        for(int j = 0; j < svd->k; j++) {
+            MATRIX_IDX_INTO(US, i, j) =
+                MATRIX_IDX_INTO(svd->u, i, j) * VECTOR_IDX_INTO(svd->singular_values, j);
+        }
+    }
+    struct matrix* Vt = matrix_transpose(svd->v);
+    struct matrix* P = matrix_multiply(US, Vt);
+    struct matrix* UtU = matrix_multiply_MtN(svd->u, svd->u);
+    struct matrix* VtV = matrix_multiply_MtN(svd->v, svd->v);
+    struct matrix* Iu = matrix_identity(UtU->n_row);
+    struct matrix* Iv = matrix_identity(VtV->n_row);
+    bool test = matrix_equal(P, M, .0001)
+             && matrix_equal(UtU, Iu, .0001) && matrix_equal(VtV, Iv, .0001);
+    matrix_free_many(7, US, Vt, P, UtU, VtV, Iu, Iv);
+    return test;
+}
+
+bool test_svd_simple() {
+    double D[] = {3.0, 2.0,  2.0,
+                  2.0, 3.0, -2.0};
+    struct matrix* M = matrix_from_array(D, 2, 3);
+    struct svd* svd = matrix_svd(M, SVD_THIN, 1e-12, 50);
+    double S[] = {5.0, 3.0};
+    struct vector* res = vector_from_array(S, 2);
+    bool test = vector_equal(svd->singular_values, res, .0001)
+             && _svd_recovers_matrix(svd, M);
+    matrix_free(M); vector_free(res); svd_free(svd);
+    return test;
+}
+
+bool test_svd_random_thin() {
+    struct matrix* M = matrix_random_uniform(40, 12, 0, 1);
+    struct svd* svd = matrix_svd(M, SVD_THIN, 1e-12, 50);
+    struct svd* values = matrix_svd(M, SVD_VALUES_ONLY, 1e-12, 50);
+    bool test = _svd_recovers_matrix(svd, M)
+             && vector_equal(svd->singular_values, values->singular_values, .0001)
+             && values->u == NULL && values->v == NULL;
+    matrix_free(M); svd_free(svd); svd_free(values);
+    return test;
+}
+
+bool test_svd_random_full_wide() {
+    struct matrix* M = matrix_random_uniform(5, 9, 0, 1);
+    struct svd* svd = matrix_svd(M, SVD_FULL, 1e-12, 50);
+    bool test = svd->u->n_col == 5 && svd->v->n_col == 9
+             && _svd_recovers_matrix(svd, M);
+    matrix_free(M); svd_free(svd);
+    return test;
+}
+
+bool test_svd_rank_deficient() {
+    double A[] = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+    double B[] = {1.0, -1.0, 2.0, 0.5};
+    struct matrix* M = matrix_new(6, 4);
+    for(int i = 0; i < 6; i++) {
+        for(int j = 0; j < 4; j++) {
+            MATRIX_IDX_INTO(M, i, j) = A[i] * B[j];
+        }
+    }
+    struct svd* svd = matrix_svd(M, SVD_FULL, 1e-12, 50);
+    // The only non zero singular value is |A| |B|.
+    double S[] = {sqrt(91.0) * sqrt(6.25), 0.0, 0.0, 0.0};
+    struct vector* res = vector_from_array(S, 4);
+    bool test = vector_equal(svd->singular_values, res, .0001)
+             && _svd_recovers_matrix(svd, M);
+    matrix_free(M); vector_free(res); svd_free(svd);
+    return test;
+}
+
+bool test_svd_full_tall() {
+    // U is completed to a square matrix (see time_svd_full for the cost).
+    struct matrix* M = matrix_random_uniform(500, 5, 0, 1);
+    struct svd* svd = matrix_svd(M, SVD_FULL, 1e-12, 50);
+    bool test = svd->u->n_row == 500 && svd->u->n_col == 500 && svd->v->n_col == 5
+             && _svd_recovers_matrix(svd, M);
+    matrix_free(M); svd_free(svd);
+    return test;
+}
+
+bool test_svd_truncated() {
+    struct matrix* M = matrix_random_uniform(30, 10, 0, 1);
+    struct svd* full = matrix_svd(M, SVD_THIN, 1e-12, 50);
+    struct svd* svd = matrix_svd_truncated(M, 3, 1e-12, 50);
+    bool test = svd->k == 3 && svd->u->n_col == 3 && svd->v->n_col == 3;
+    for(int j = 0; j < 3; j++) {
+        test = test && fabs(VECTOR_IDX_INTO(svd->singular_values, j)
+                            - VECTOR_IDX_INTO(full->singular_values, j)) < .0001;
+    }
+    matrix_free(M); svd_free(full); svd_free(svd);
+    return test;
+}
+
+
+bool test_svd_randomized_low_rank() {
+    // M has rank 8, so a sample of 10 columns captures its range exactly.
+    struct matrix* A = matrix_random_uniform(200, 8, 0, 1);
+    struct matrix* B = matrix_random_uniform(8, 50, 0, 1);
+    struct matrix* M = matrix_multiply(A, B);
+    struct svd* exact = matrix_svd(M, SVD_THIN, 1e-12, 50);
+    struct svd* svd = matrix_svd_randomized(M, 5, 5, 1);
+    bool test = svd->k == 5;
+    for(int j = 0; j < 5; j++) {
+        double s = VECTOR_IDX_INTO(exact->singular_values, j);
+        test = test && fabs(VECTOR_IDX_INTO(svd->singular_values, j) - s) < 1e-6 * s;
+    }
+    // The triplets satisfy M v = s u.
+    struct matrix* MV = matrix_multiply(M, svd->v);
+    for(int i = 0; i < M->n_row; i++) {
+        for(int j = 0; j < 5; j++) {
+            test = test && fabs(MATRIX_IDX_INTO(MV, i, j) - MATRIX_IDX_INTO(svd->u, i, j)
+                                * VECTOR_IDX_INTO(svd->singular_values, j)) < 1e-6;
+        }
+    }
+    matrix_free_many(4, A, B, M, MV); svd_free(exact); svd_free(svd);
+    return test;
+}
+
+bool test_matrix_range_finder() {
+    struct matrix* A = matrix_random_uniform(100, 6, 0, 1);
+    struct matrix* B = matrix_random_uniform(6, 30, 0, 1);
+    struct matrix* M = matrix_multiply(A, B);
+    struct matrix* Q = matrix_range_finder(M, 6, 2);
+    // Q is orthonormal, and Q Q^t M recovers M.
+    struct matrix* QtQ = matrix_multiply_MtN(Q, Q);
+    struct matrix* I = matrix_identity(6);
+    struct matrix* QtM = matrix_multiply_MtN(Q, M);
+    struct matrix* P = matrix_multiply(Q, QtM);
+    bool test = matrix_equal(QtQ, I, 1e-8) && matrix_equal(P, M, 1e-6);
+    matrix_free_many(8, A, B, M, Q, QtQ, I, QtM, P);
+    return test;
+}
+
+
+#define N_SVD_TESTS 8
+struct test svd_tests[] = {
+    {test_svd_simple, "test_svd_simple"},
+    {test_svd_random_thin, "test_svd_random_thin"},
+    {test_svd_random_full_wide, "test_svd_random_full_wide"},
+    {test_svd_rank_deficient, "test_svd_rank_deficient"},
+    {test_svd_full_tall, "test_svd_full_tall"},
+    {test_svd_truncated, "test_svd_truncated"},
+    {test_svd_randomized_low_rank, "test_svd_randomized_low_rank"},
+    {test_matrix_range_finder, "test_matrix_range_finder"},
 };
 
 
@@ -694,12 +1359,183 @@ bool test_solve_qr_random() {
 }
 
 
-#define N_LINSOLVE_TESTS 4
+bool test_solve_cg_operator() {
+    // The second difference matrix, only known by its products.
+    int n = 200;
+    struct linop* A = linop_new(n, n, _laplacian_apply, NULL, &n);
+    struct vector* x = vector_linspace(n, -1, 1);
+    struct vector* b = vector_new(n);
+    linop_apply_into(b, A, x);
+    struct krylov_stats stats;
+    struct vector* s = linsolve_cg(A, b, NULL, 1e-12, 1000, &stats);
+    bool test = vector_equal(x, s, 1e-6)
+             && stats.converged && stats.residual < 1e-11 && stats.n_iter <= n + 10;
+    linop_free(A); vector_free_many(3, x, b, s);
+    return test;
+}
+
+/* The five point Laplacian on a k x k grid, stored densely, plus a varying
+   diagonal.
+*/
+struct matrix* _grid_laplacian(int k) {
+    int n = k * k;
+    struct matrix* M = matrix_zeros(n, n);
+    for(int i = 0; i < k; i++) {
+        for(int j = 0; j < k; j++) {
+            int r = i * k + j;
+            MATRIX_IDX_INTO(M, r, r) = 4 + 0.1 * (r % 7);
+            if(i > 0) MATRIX_IDX_INTO(M, r, r - k) = -1;
+            if(i < k - 1) MATRIX_IDX_INTO(M, r, r + k) = -1;
+            if(j > 0) MATRIX_IDX_INTO(M, r, r - 1) = -1;
+            if(j < k - 1) MATRIX_IDX_INTO(M, r, r + 1) = -1;
+        }
+    }
+    return M;
+}
+
+bool test_solve_cg_preconditioned() {
+    struct matrix* M = _grid_laplacian(20);
+    int n = M->n_row;
+    struct linop* A = linop_from_matrix(M);
+    struct vector* x = vector_linspace(n, 0, 1);
+    struct vector* b = matrix_vector_multiply(M, x);
+    struct vector* diagonal = matrix_diagonal(M);
+    struct linop* jacobi = precond_jacobi(diagonal);
+    struct linop* ic = precond_incomplete_cholesky(M);
+    struct krylov_stats plain, with_jacobi, with_ic;
+    struct vector* s = linsolve_cg(A, b, NULL, 1e-10, 1000, &plain);
+    struct vector* s_jacobi = linsolve_cg(A, b, jacobi, 1e-10, 1000, &with_jacobi);
+    struct vector* s_ic = linsolve_cg(A, b, ic, 1e-10, 1000, &with_ic);
+    bool test = vector_equal(x, s, 1e-7) && vector_equal(x, s_jacobi, 1e-7)
+             && vector_equal(x, s_ic, 1e-7)
+             && plain.converged && with_jacobi.converged && with_ic.converged
+             && with_ic.n_iter < plain.n_iter;
+    matrix_free(M); linop_free(A); linop_free(jacobi); linop_free(ic);
+    vector_free_many(6, x, b, diagonal, s, s_jacobi, s_ic);
+    return test;
+}
+
+bool test_solve_minres_indefinite() {
+    // Q diag(1, -2, 3, -4, ...) Q^t, symmetric but not definite.
+    int n = 40;
+    struct matrix* D = matrix_zeros(n, n);
+    for(int i = 0; i < n; i++) {
+        MATRIX_IDX_INTO(D, i, i) = (i % 2 == 0) ? i + 1 : -(i + 1);
+    }
+    struct matrix* X = matrix_random_uniform(n, n, -1, 1);
+    struct qr_decomp* qr = matrix_qr_decomposition(X);
+    struct matrix* Qt = matrix_transpose(qr->q);
+    struct matrix* DQt = matrix_multiply(D, Qt);
+    struct matrix* M = matrix_multiply(qr->q, DQt);
+    struct linop* A = linop_from_matrix(M);
+    struct vector* x = vector_linspace(n, -1, 1);
+    struct vector* b = matrix_vector_multiply(M, x);
+    struct krylov_stats stats;
+    struct vector* s = linsolve_minres(A, b, NULL, 1e-12, 500, &stats);
+    bool test = vector_equal(x, s, 1e-8) && stats.converged && stats.residual < 1e-10;
+    matrix_free_many(5, D, X, Qt, DQt, M); qr_decomp_free(qr); linop_free(A);
+    vector_free_many(3, x, b, s);
+    return test;
+}
+
+bool test_solve_gmres_nonsymmetric() {
+    int n = 100;
+    struct matrix* M = matrix_random_uniform(n, n, -1, 1);
+    for(int i = 0; i < n; i++) {
+        MATRIX_IDX_INTO(M, i, i) += 2 * n + i;
+    }
+    struct linop* A = linop_from_matrix(M);
+    struct vector* x = vector_linspace(n, -1, 1);
+    struct vector* b = matrix_vector_multiply(M, x);
+    struct vector* diagonal = matrix_diagonal(M);
+    struct linop* jacobi = precond_jacobi(diagonal);
+    struct krylov_stats plain, with_jacobi;
+    struct vector* s = linsolve_gmres(A, b, NULL, 10, 1e-12, 500, &plain);
+    struct vector* s_jacobi = linsolve_gmres(A, b, jacobi, 10, 1e-12, 500, &with_jacobi);
+    bool test = vector_equal(x, s, 1e-9) && vector_equal(x, s_jacobi, 1e-9)
+             && plain.converged && with_jacobi.converged
+             && plain.residual < 1e-11 && with_jacobi.residual < 1e-11;
+    matrix_free(M); linop_free(A); linop_free(jacobi);
+    vector_free_many(5, x, b, diagonal, s, s_jacobi);
+    return test;
+}
+
+bool test_solve_mixed_precision() {
+    int n = 200;
+    struct matrix* M = matrix_random_uniform(n, n, -1, 1);
+    for(int i = 0; i < n; i++) {
+        MATRIX_IDX_INTO(M, i, i) += 2 * n;
+    }
+    struct vector* x = vector_linspace(n, -1, 1);
+    struct vector* b = matrix_vector_multiply(M, x);
+    struct refinement_stats stats;
+    struct vector* s = linsolve_mixed_precision(M, b, &stats);
+    // Double precision accuracy, far below the single precision roundoff.
+    bool test = vector_equal(x, s, 1e-13) && !stats.fallback && stats.condition < 100;
+    matrix_free(M); vector_free_many(3, x, b, s);
+    return test;
+}
+
+bool test_solve_mixed_precision_fallback() {
+    // The Hilbert matrix of order 8 has condition number 1.5e10, too much
+    // for a single precision factorization.
+    int n = 8;
+    struct matrix* M = matrix_new(n, n);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < n; j++) {
+            MATRIX_IDX_INTO(M, i, j) = 1.0 / (i + j + 1);
+        }
+    }
+    struct vector* x = vector_constant(n, 1);
+    struct vector* b = matrix_vector_multiply(M, x);
+    struct refinement_stats stats;
+    struct vector* s = linsolve_mixed_precision(M, b, &stats);
+    bool test = vector_equal(x, s, 1e-5) && stats.fallback
+             && stats.condition > LINSOLVE_MIXED_MAX_CONDITION;
+    matrix_free(M); vector_free_many(3, x, b, s);
+    return test;
+}
+
+bool test_solve_lsqr() {
+    // An overdetermined system, badly scaled, whose least squares solution
+    // makes the residual orthogonal to the columns.
+    int n = 400, p = 6;
+    struct matrix* M = matrix_random_uniform(n, p, -1, 1);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(M, i, j) *= pow(10, -j);
+        }
+    }
+    struct vector* b = vector_random_uniform(n, -1, 1);
+    struct linop* A = linop_from_matrix(M);
+    struct krylov_stats plain, preconditioned;
+    struct vector* x_plain = linsolve_lsqr(A, b, NULL, 1e-10, 1000, &plain);
+    struct sketch* S = sketch_new(SKETCH_SPARSE_SIGN, n, 4 * p, 3);
+    struct linop* P = precond_sketch_qr(S, M);
+    struct vector* x = linsolve_lsqr(A, b, P, 1e-10, 1000, &preconditioned);
+
+    struct linreg* lr = linreg_fit(M, b);
+    bool test = preconditioned.converged && preconditioned.n_iter < 40
+             && preconditioned.n_iter < plain.n_iter
+             && vector_equal(x, lr->beta, 1e-6 * vector_norm(lr->beta));
+    linop_free(A); linop_free(P); sketch_free(S); linreg_free(lr);
+    matrix_free(M); vector_free_many(3, b, x_plain, x);
+    return test;
+}
+
+#define N_LINSOLVE_TESTS 11
 struct test linsolve_tests[] = {
     {test_solve_qr_identity, "test_solve_qr_identity"},
     {test_solve_qr_upper_triangular, "test_solve_qr_upper_triangular"},
     {test_solve_qr_general, "test_solve_qr_general"},
     {test_solve_qr_random, "test_solve_qr_random"},
+    {test_solve_cg_operator, "test_solve_cg_operator"},
+    {test_solve_cg_preconditioned, "test_solve_cg_preconditioned"},
+    {test_solve_minres_indefinite, "test_solve_minres_indefinite"},
+    {test_solve_gmres_nonsymmetric, "test_solve_gmres_nonsymmetric"},
+    {test_solve_mixed_precision, "test_solve_mixed_precision"},
+    {test_solve_mixed_precision_fallback, "test_solve_mixed_precision_fallback"},
+    {test_solve_lsqr, "test_solve_lsqr"},
 };
 
 
@@ -775,13 +1611,689 @@ bool test_linreg_random() {
 }
 
 
+/* Fit the rows of X and y in chunks of chunk_size rows. */
+struct linreg* _linreg_fit_chunks(struct matrix* X, struct vector* y, int chunk_size) {
+    struct linreg_stream* s = linreg_stream_begin(X->n_col);
+    for(int begin = 0; begin < X->n_row; begin += chunk_size) {
+        int end = (begin + chunk_size < X->n_row) ? begin + chunk_size : X->n_row;
+        struct matrix* chunk_X = matrix_new(end - begin, X->n_col);
+        struct vector* chunk_y = vector_new(end - begin);
+        for(int i = begin; i < end; i++) {
+            VECTOR_IDX_INTO(chunk_y, i - begin) = VECTOR_IDX_INTO(y, i);
+            for(int j = 0; j < X->n_col; j++) {
+                MATRIX_IDX_INTO(chunk_X, i - begin, j) = MATRIX_IDX_INTO(X, i, j);
+            }
+        }
+        linreg_stream_update(s, chunk_X, chunk_y);
+        matrix_free(chunk_X); vector_free(chunk_y);
+    }
+    return linreg_stream_finish(s);
+}
+
+bool test_linreg_stream() {
+    // The streaming fit matches the batch fit, whatever the chunks and the
+    // number of threads.
+    int n = 3000;
+    struct matrix* X = matrix_random_uniform(n, 6, 0, 1);
+    struct vector* intercept = vector_constant(n, 1);
+    matrix_copy_vector_into_column(X, intercept, 0);
+    struct vector* true_beta = vector_random_uniform(6, -1, 1);
+    struct vector* y = matrix_vector_multiply(X, true_beta);
+    struct vector* noise = vector_random_gaussian(n, 0, .1);
+    vector_add_into(y, y, noise);
+
+    struct linreg* lr = linreg_fit(X, y);
+    int n_threads = parallel_num_threads();
+    bool test = true;
+    for(int threads = 1; threads <= 4; threads *= 4) {
+        parallel_set_num_threads(threads);
+        struct linreg* lr_stream = _linreg_fit_chunks(X, y, 700);
+        test = test && lr_stream->n == n && lr_stream->y_hat == NULL
+            && vector_equal(lr->beta, lr_stream->beta, 1e-10)
+            && fabs(lr->sigma_resid - lr_stream->sigma_resid) < 1e-10 * lr->sigma_resid;
+        linreg_free(lr_stream);
+    }
+    parallel_set_num_threads(n_threads);
+
+    vector_free_many(4, intercept, true_beta, y, noise); matrix_free(X);
+    linreg_free(lr);
+    return test;
+}
+
+bool test_linreg_multi() {
+    // Each response is fit as by linreg_fit alone.
+    int n = 500, p = 4, k = 6;
+    struct matrix* X = matrix_random_uniform(n, p, 0, 1);
+    struct matrix* B = matrix_random_uniform(p, k, -1, 1);
+    struct matrix* Y = matrix_multiply(X, B);
+    struct matrix* noise = matrix_random_uniform(n, k, 0, 1);
+    for(int i = 0; i < n * k; i++) {
+        DATA(Y)[i] += 0.1 * DATA(noise)[i];
+    }
+    struct linreg_multi* lr = linreg_fit_multi(X, Y);
+    bool test = lr->n == n && lr->p == p && lr->k == k;
+    for(int j = 0; j < k; j++) {
+        struct vector* y = matrix_column_copy(Y, j);
+        struct vector* beta = matrix_column_copy(lr->beta, j);
+        struct linreg* lr_j = linreg_fit(X, y);
+        test = test && vector_equal(beta, lr_j->beta, 1e-10)
+            && fabs(VECTOR_IDX_INTO(lr->sigma_resid, j) - lr_j->sigma_resid) < 1e-10 * lr_j->sigma_resid;
+        vector_free_many(2, y, beta); linreg_free(lr_j);
+    }
+    matrix_free_many(4, X, B, Y, noise); linreg_multi_free(lr);
+    return test;
+}
+
+bool test_linreg_ridge_path() {
+    // Compare with the normal equations (Xt X + lambda I) b = Xt y, and the
+    // degrees of freedom trace((Xt X + lambda I)^-1 Xt X), solved densely.
+    int n = 60, p = 5;
+    struct matrix* X = matrix_random_uniform(n, p, -1, 1);
+    struct vector* y = vector_random_uniform(n, -1, 1);
+    double lambdas[] = {0.0, 0.1, 1.0, 10.0};
+    struct ridge_path* path = linreg_ridge_path(X, y, lambdas, 4);
+    struct matrix* XtX = matrix_multiply_MtN(X, X);
+    struct vector* Xty = matrix_vector_multiply_Mtv(X, y);
+    bool test = path->n_lambdas == 4;
+    for(int l = 0; l < 4; l++) {
+        struct matrix* A = matrix_copy(XtX);
+        for(int j = 0; j < p; j++) {
+            MATRIX_IDX_INTO(A, j, j) += lambdas[l];
+        }
+        struct vector* beta = linsolve_qr(A, Xty);
+        struct vector* path_beta = matrix_column_copy(path->beta, l);
+        double df = 0;
+        for(int j = 0; j < p; j++) {
+            struct vector* XtX_j = matrix_column_copy(XtX, j);
+            struct vector* A_inv_XtX_j = linsolve_qr(A, XtX_j);
+            df += VECTOR_IDX_INTO(A_inv_XtX_j, j);
+            vector_free_many(2, XtX_j, A_inv_XtX_j);
+        }
+        struct vector* y_hat = matrix_vector_multiply(X, beta);
+        double rss = 0;
+        for(int i = 0; i < n; i++) {
+            rss += (VECTOR_IDX_INTO(y, i) - VECTOR_IDX_INTO(y_hat, i)) * (VECTOR_IDX_INTO(y, i) - VECTOR_IDX_INTO(y_hat, i));
+        }
+        double gcv = n * rss / ((n - df) * (n - df));
+        test = test && vector_equal(beta, path_beta, 1e-9)
+            && fabs(VECTOR_IDX_INTO(path->df, l) - df) < 1e-9
+            && fabs(VECTOR_IDX_INTO(path->rss, l) - rss) < 1e-9
+            && fabs(VECTOR_IDX_INTO(path->gcv, l) - gcv) < 1e-9
+            && VECTOR_IDX_INTO(path->gcv, path->best) <= VECTOR_IDX_INTO(path->gcv, l);
+        matrix_free(A); vector_free_many(3, beta, path_beta, y_hat);
+    }
+    // No penalty is ordinary least squares.
+    struct linreg* lr = linreg_fit(X, y);
+    struct linreg* ridge = linreg_fit_ridge(X, y, 0.0);
+    test = test && vector_equal(lr->beta, ridge->beta, 1e-9)
+        && fabs(lr->sigma_resid - ridge->sigma_resid) < 1e-9;
+    matrix_free_many(2, X, XtX); vector_free_many(2, y, Xty);
+    ridge_path_free(path); linreg_free(lr); linreg_free(ridge);
+    return test;
+}
+
+/* A design matrix with an intercept and two uniform covariates, and its
+   linear predictor for beta = (0.5, -1, 1).
+*/
+struct matrix* _glm_design(int n, struct vector** eta) {
+    struct matrix* X = matrix_random_uniform(n, 3, 0, 1);
+    *eta = vector_new(n);
+    for(int i = 0; i < n; i++) {
+        MATRIX_IDX_INTO(X, i, 0) = 1;
+        VECTOR_IDX_INTO(*eta, i) = 0.5 - MATRIX_IDX_INTO(X, i, 1) + MATRIX_IDX_INTO(X, i, 2);
+    }
+    return X;
+}
+
+/* At the maximum likelihood, the score X^t (y - mu) vanishes. */
+bool _glm_score_vanishes(struct glm* g, struct matrix* X, struct vector* y) {
+    struct vector* mu = glm_predict(g, X);
+    vector_subtract_into(mu, y, mu);
+    struct vector* score = matrix_vector_multiply_Mtv(X, mu);
+    bool test = vector_norm(score) < 1e-6 * X->n_row;
+    vector_free_many(2, mu, score);
+    return test;
+}
+
+bool test_glm_logistic() {
+    int n = 2000;
+    struct vector* eta;
+    struct matrix* X = _glm_design(n, &eta);
+    struct vector* u = vector_random_uniform(n, 0, 1);
+    struct vector* y = vector_new(n);
+    for(int i = 0; i < n; i++) {
+        double prob = 1 / (1 + exp(-VECTOR_IDX_INTO(eta, i)));
+        VECTOR_IDX_INTO(y, i) = (VECTOR_IDX_INTO(u, i) < prob) ? 1 : 0;
+    }
+    struct glm* g = glm_fit(X, y, GLM_LOGISTIC, NULL, 1e-12, 50);
+    bool test = g->converged && g->n_iter < 15 && _glm_score_vanishes(g, X, y);
+    // Started from its own solution, the fit stops at once.
+    struct glm* warm = glm_fit(X, y, GLM_LOGISTIC, g->beta, 1e-12, 50);
+    test = test && warm->converged && warm->n_iter <= 2
+        && vector_equal(g->beta, warm->beta, 1e-8);
+    matrix_free(X); vector_free_many(3, eta, u, y); glm_free(g); glm_free(warm);
+    return test;
+}
+
+bool test_glm_poisson() {
+    int n = 2000;
+    struct vector* eta;
+    struct matrix* X = _glm_design(n, &eta);
+    struct vector* y = vector_new(n);
+    for(int i = 0; i < n; i++) {
+        // Count the uniform draws whose running product stays above
+        // exp(-mean).
+        double limit = exp(-exp(VECTOR_IDX_INTO(eta, i))), product = 1;
+        int count = -1;
+        do {
+            struct vector* u = vector_random_uniform(1, 0, 1);
+            product *= VECTOR_IDX_INTO(u, 0);
+            vector_free(u);
+            count++;
+        } while(product > limit);
+        VECTOR_IDX_INTO(y, i) = count;
+    }
+    struct glm* g = glm_fit(X, y, GLM_POISSON, NULL, 1e-12, 50);
+    bool test = g->converged && _glm_score_vanishes(g, X, y)
+             && fabs(VECTOR_IDX_INTO(g->beta, 1) + 1) < 0.5
+             && fabs(VECTOR_IDX_INTO(g->beta, 2) - 1) < 0.5;
+    matrix_free(X); vector_free_many(2, eta, y); glm_free(g);
+    return test;
+}
+
+bool test_linreg_score_into() {
+    // A fitted model scores new data of any number of rows.
+    double D[] = {1.0, 0.0,
+                  1.0, 1.0,
+                  1.0, 2.0};
+    struct matrix* X = matrix_from_array(D, 3, 2);
+    double Y[] = {1.0, 3.0, 5.0};
+    struct vector* y = vector_from_array(Y, 3);
+    struct linreg* lr = linreg_fit(X, y);
+
+    double R[] = {1.0, 10.0};
+    struct matrix* row = matrix_from_array(R, 1, 2);
+    struct vector* out = vector_new(1);
+    linreg_score_into(lr, row, out);
+    bool test = fabs(VECTOR_IDX_INTO(out, 0) - 21.0) < 1e-6;
+
+    // Large enough to be split over the threads.
+    int n_threads = parallel_num_threads();
+    parallel_set_num_threads(4);
+    struct matrix* X_new = matrix_random_uniform(50000, 2, 0, 1);
+    struct vector* preds = linreg_predict(lr, X_new);
+    struct vector* expected = matrix_vector_multiply(X_new, lr->beta);
+    parallel_set_num_threads(n_threads);
+    test = test && preds->length == 50000 && vector_equal(preds, expected, 1e-12);
+
+    matrix_free_many(3, X, row, X_new); vector_free_many(4, y, out, preds, expected);
+    linreg_free(lr);
+    return test;
+}
+
+bool test_linreg_save_load() {
+    struct matrix* X = matrix_random_uniform(100, 4, 0, 1);
+    struct vector* y = vector_linspace(100, 0, 1);
+    struct linreg* lr = linreg_fit(X, y);
+    const char* path = "test_linreg_save_load.bin";
+    bool test = linreg_save(lr, path);
+
+    struct mapped_file* f = mapped_file_open(path);
+    test = test && f != NULL;
+    struct linreg* loaded = linreg_from_mapped(f);
+    test = test && loaded != NULL && loaded->n == 100 && loaded->p == 4
+        && loaded->sigma_resid == lr->sigma_resid
+        && vector_equal(loaded->beta, lr->beta, 0.0)
+        && vector_equal(loaded->y_hat, lr->y_hat, 0.0);
+    struct vector* preds = linreg_predict(loaded, X);
+    test = test && vector_equal(preds, lr->y_hat, 1e-12);
+    // A mapping is not a model of another kind.
+    test = test && eigen_from_mapped(f) == NULL;
+    linreg_free(loaded);
+    mapped_file_close(f);
+
+    // A corrupted coefficient is caught by the checksum.
+    FILE* file = fopen(path, "r+b");
+    fseek(file, -(long) sizeof(double), SEEK_END);
+    double x = 1.0;
+    fwrite(&x, sizeof(double), 1, file);
+    fclose(file);
+    f = mapped_file_open(path);
+    test = test && f != NULL && linreg_from_mapped(f) == NULL;
+    mapped_file_close(f);
+
+    // So is a file with a valid checksum whose arrays disagree in shape.
+    lr->n = 101;
+    test = test && linreg_save(lr, path);
+    lr->n = 100;
+    f = mapped_file_open(path);
+    test = test && f != NULL && linreg_from_mapped(f) == NULL;
+    mapped_file_close(f);
+    remove(path);
+
+    matrix_free(X); vector_free_many(2, y, preds); linreg_free(lr);
+    return test;
+}
+
+bool test_linreg_rolling() {
+    // Each window's fit matches linreg_fit on its rows.
+    int n = 300, p = 3, window = 40;
+    struct matrix* X = matrix_random_uniform(n, p, 0, 1);
+    struct vector* y = vector_new(n);
+    for(int i = 0; i < n; i++) {
+        VECTOR_IDX_INTO(y, i) = MATRIX_IDX_INTO(X, i, 0) - 2 * MATRIX_IDX_INTO(X, i, 2)
+                                + sin(i);
+    }
+    struct matrix* beta = matrix_new(n - window + 1, p);
+    struct vector* sigma = vector_new(n - window + 1);
+    linreg_fit_rolling_into(beta, sigma, X, y, window, 25);
+
+    bool test = true;
+    struct matrix* X_w = matrix_new(window, p);
+    struct vector* y_w = vector_new(window);
+    for(int w = 0; w <= n - window; w++) {
+        for(int i = 0; i < window; i++) {
+            for(int j = 0; j < p; j++) {
+                MATRIX_IDX_INTO(X_w, i, j) = MATRIX_IDX_INTO(X, w + i, j);
+            }
+            VECTOR_IDX_INTO(y_w, i) = VECTOR_IDX_INTO(y, w + i);
+        }
+        struct linreg* lr = linreg_fit(X_w, y_w);
+        for(int j = 0; j < p; j++) {
+            test = test && fabs(MATRIX_IDX_INTO(beta, w, j) - VECTOR_IDX_INTO(lr->beta, j)) < 1e-8;
+        }
+        test = test && fabs(VECTOR_IDX_INTO(sigma, w) - lr->sigma_resid) < 1e-8 * lr->sigma_resid;
+        linreg_free(lr);
+    }
+
+    matrix_free_many(3, X, beta, X_w); vector_free_many(3, y, sigma, y_w);
+    return test;
+}
+
+bool test_linreg_cross_validate() {
+    // Each fold's fit matches linreg_fit on the other rows.
+    int n = 103, p = 4, k = 5;
+    struct matrix* X = matrix_random_uniform(n, p, 0, 1);
+    struct vector* y = vector_new(n);
+    for(int i = 0; i < n; i++) {
+        VECTOR_IDX_INTO(y, i) = 3 * MATRIX_IDX_INTO(X, i, 1) + cos(i);
+    }
+    int n_threads = parallel_num_threads();
+    parallel_set_num_threads(4);
+    struct linreg_cv* cv = linreg_cross_validate(X, y, k);
+    parallel_set_num_threads(n_threads);
+
+    bool test = cv->k == k;
+    double sse = 0;
+    for(int f = 0; f < k; f++) {
+        int begin = f * n / k, end = (f + 1) * n / k;
+        struct matrix* X_train = matrix_new(n - (end - begin), p);
+        struct vector* y_train = vector_new(n - (end - begin));
+        for(int i = 0, row = 0; i < n; i++) {
+            if(begin <= i && i < end) {
+                continue;
+            }
+            for(int j = 0; j < p; j++) {
+                MATRIX_IDX_INTO(X_train, row, j) = MATRIX_IDX_INTO(X, i, j);
+            }
+            VECTOR_IDX_INTO(y_train, row++) = VECTOR_IDX_INTO(y, i);
+        }
+        struct linreg* lr = linreg_fit(X_train, y_train);
+        double fold_sse = 0;
+        for(int i = begin; i < end; i++) {
+            double r = VECTOR_IDX_INTO(y, i);
+            for(int j = 0; j < p; j++) {
+                test = test && fabs(MATRIX_IDX_INTO(cv->beta, f, j) - VECTOR_IDX_INTO(lr->beta, j)) < 1e-8;
+                r -= MATRIX_IDX_INTO(X, i, j) * VECTOR_IDX_INTO(lr->beta, j);
+            }
+            fold_sse += r * r;
+        }
+        test = test && fabs(VECTOR_IDX_INTO(cv->fold_mse, f) - fold_sse / (end - begin)) < 1e-8;
+        sse += fold_sse;
+        matrix_free(X_train); vector_free(y_train); linreg_free(lr);
+    }
+    test = test && fabs(cv->mse - sse / n) < 1e-8;
+
+    matrix_free(X); vector_free(y); linreg_cv_free(cv);
+    return test;
+}
+
+bool test_linreg_fit_batch() {
+    // Models of different shapes match their separate fits.
+    int n_models = 40;
+    struct matrix* X[40];
+    struct vector* y[40];
+    for(int m = 0; m < n_models; m++) {
+        int p = 1 + m % 5, n = 20 + 3 * m;
+        X[m] = matrix_random_uniform(n, p, 0, 1);
+        y[m] = vector_new(n);
+        for(int i = 0; i < n; i++) {
+            VECTOR_IDX_INTO(y[m], i) = m * MATRIX_IDX_INTO(X[m], i, 0) + sin(i + m);
+        }
+    }
+    int n_threads = parallel_num_threads();
+    parallel_set_num_threads(4);
+    struct linreg_batch* batch = linreg_fit_batch(X, y, n_models);
+    parallel_set_num_threads(n_threads);
+
+    bool test = batch->n_models == n_models;
+    for(int m = 0; m < n_models; m++) {
+        struct linreg* lr = linreg_fit(X[m], y[m]);
+        struct linreg* b = &batch->models[m];
+        test = test && b->n == lr->n && b->p == lr->p
+            && vector_equal(b->beta, lr->beta, 1e-8)
+            && vector_equal(b->y_hat, lr->y_hat, 1e-8)
+            && fabs(b->sigma_resid - lr->sigma_resid) < 1e-8 * lr->sigma_resid;
+        linreg_free(lr);
+        matrix_free(X[m]); vector_free(y[m]);
+    }
+    linreg_batch_free(batch);
+    return test;
+}
+
+bool test_linreg_sketched() {
+    int n = 3000, p = 5;
+    struct matrix* X = matrix_random_uniform(n, p, -1, 1);
+    struct vector* y = vector_new(n);
+    for(int i = 0; i < n; i++) {
+        VECTOR_IDX_INTO(y, i) = 1 + 2 * MATRIX_IDX_INTO(X, i, 0) - MATRIX_IDX_INTO(X, i, 3)
+                                + 0.1 * sin(7.0 * i);
+    }
+    struct linreg* exact = linreg_fit(X, y);
+    enum sketch_kind kinds[] = {SKETCH_GAUSSIAN, SKETCH_SPARSE_SIGN, SKETCH_SRHT};
+    bool test = true;
+    for(int k = 0; k < 3; k++) {
+        struct sketch* S = sketch_new(kinds[k], n, 100, 5);
+        // Sketch and solve nearly minimizes the residual, the refined fit
+        // is exact.
+        struct krylov_stats stats;
+        struct linreg* approx = linreg_fit_sketched(X, y, S, 0, 100, &stats);
+        test = test && stats.n_iter == 0 && !stats.converged;
+        struct linreg* refined = linreg_fit_sketched(X, y, S, 1e-12, 100, &stats);
+        test = test && stats.converged && stats.n_iter <= 100;
+        // Stopped short of tol, the fit is reported as not converged.
+        struct linreg* partial = linreg_fit_sketched(X, y, S, 1e-12, 1, &stats);
+        test = test && !stats.converged && stats.n_iter == 1;
+        test = test && approx->sigma_resid >= exact->sigma_resid
+            && approx->sigma_resid < 1.2 * exact->sigma_resid
+            && vector_equal(refined->beta, exact->beta, 1e-8)
+            && fabs(refined->sigma_resid - exact->sigma_resid) < 1e-8 * exact->sigma_resid;
+        linreg_free(approx); linreg_free(refined); linreg_free(partial); sketch_free(S);
+    }
+    matrix_free(X); vector_free(y); linreg_free(exact);
+    return test;
+}
+
+bool test_sketch_sparse_sign_columns() {
+    // S I = S, each column has SKETCH_SPARSE_NNZ entries of +-1 / sqrt(nnz)
+    // in distinct rows, even when s leaves little room to avoid repeats.
+    int n = 2000, s = 10;
+    struct matrix* I = matrix_identity(n);
+    struct sketch* S = sketch_new(SKETCH_SPARSE_SIGN, n, s, 11);
+    struct matrix* SI = sketch_apply(S, I);
+    double scale = 1 / sqrt((double) SKETCH_SPARSE_NNZ);
+    bool test = true;
+    for(int j = 0; j < n; j++) {
+        int n_nonzero = 0;
+        for(int k = 0; k < s; k++) {
+            double x = MATRIX_IDX_INTO(SI, k, j);
+            if(x != 0) {
+                n_nonzero++;
+                test = test && fabs(fabs(x) - scale) < 1e-15;
+            }
+        }
+        test = test && n_nonzero == SKETCH_SPARSE_NNZ;
+    }
+    matrix_free_many(2, I, SI); sketch_free(S);
+    return test;
+}
+
 
-#define N_LINREG_TESTS 4
+#define N_LINREG_TESTS 16
 struct test linreg_tests[] = {
     {test_linreg_simple, "test_linreg_simple"},
     {test_linreg_multivar, "test_linreg_multivar"},
     {test_linreg_intercept_only, "test_linreg_intercept_only"},
     {test_linreg_random, "test_linreg_random"},
+    {test_linreg_stream, "test_linreg_stream"},
+    {test_linreg_multi, "test_linreg_multi"},
+    {test_linreg_ridge_path, "test_linreg_ridge_path"},
+    {test_linreg_score_into, "test_linreg_score_into"},
+    {test_linreg_save_load, "test_linreg_save_load"},
+    {test_linreg_rolling, "test_linreg_rolling"},
+    {test_linreg_cross_validate, "test_linreg_cross_validate"},
+    {test_linreg_fit_batch, "test_linreg_fit_batch"},
+    {test_linreg_sketched, "test_linreg_sketched"},
+    {test_sketch_sparse_sign_columns, "test_sketch_sparse_sign_columns"},
+    {test_glm_logistic, "test_glm_logistic"},
+    {test_glm_poisson, "test_glm_poisson"},
+};
+
+
+/*******************************
+ * Unit tests for rand module.
+ *******************************/
+
+bool test_rand_uniform_range() {
+    struct vector* v = vector_random_uniform(10000, -1, 1);
+    bool test = true;
+    double mean = 0;
+    for(int i = 0; i < v->length; i++) {
+        test = test && -1 <= VECTOR_IDX_INTO(v, i) && VECTOR_IDX_INTO(v, i) < 1;
+        mean += VECTOR_IDX_INTO(v, i) / v->length;
+    }
+    test = test && fabs(mean) < 0.05;
+    vector_free(v);
+    return test;
+}
+
+bool test_rand_gaussian_moments() {
+    struct rng* rng = rng_new(7);
+    struct vector* v = vector_new(100001);
+    vector_random_gaussian_into(v, rng, 2.0, 3.0);
+    double mean = 0, var = 0;
+    for(int i = 0; i < v->length; i++) {
+        mean += VECTOR_IDX_INTO(v, i) / v->length;
+    }
+    for(int i = 0; i < v->length; i++) {
+        double d = VECTOR_IDX_INTO(v, i) - mean;
+        var += d * d / v->length;
+    }
+    bool test = fabs(mean - 2.0) < 0.05 && fabs(var - 9.0) < 0.2;
+    rng_free(rng); vector_free(v);
+    return test;
+}
+
+bool test_rng_streams() {
+    // Equal seeds give equal streams, and a jump gives another stream.
+    struct rng* a = rng_new(42);
+    struct rng* b = rng_new(42);
+    struct rng* c = rng_new(42);
+    rng_jump(c);
+    bool test = true;
+    for(int i = 0; i < 100; i++) {
+        uint64_t x = rng_next(a);
+        test = test && x == rng_next(b) && x != rng_next(c);
+    }
+    rng_free(a); rng_free(b); rng_free(c);
+    return test;
+}
+
+bool test_rand_fill_threads() {
+    // The same stream gives the same matrix with any number of threads.
+    int n_threads = parallel_num_threads();
+    struct matrix* M[2];
+    for(int k = 0; k < 2; k++) {
+        parallel_set_num_threads(k == 0 ? 1 : 4);
+        struct rng* rng = rng_new(11);
+        M[k] = matrix_new(301, 97);
+        matrix_random_gaussian_into(M[k], rng, 0, 1);
+        rng_free(rng);
+    }
+    parallel_set_num_threads(n_threads);
+    bool test = matrix_equal(M[0], M[1], 0.0);
+    // The tails of the ziggurat, P(|z| > 2) = 0.0455.
+    int n_tail = 0;
+    for(int i = 0; i < 301 * 97; i++) {
+        n_tail += fabs(DATA(M[0])[i]) > 2;
+    }
+    test = test && fabs(n_tail / (301.0 * 97) - 0.0455) < 0.005;
+    matrix_free_many(2, M[0], M[1]);
+    return test;
+}
+
+#define N_RAND_TESTS 4
+struct test rand_tests[] = {
+    {test_rand_uniform_range, "test_rand_uniform_range"},
+    {test_rand_gaussian_moments, "test_rand_gaussian_moments"},
+    {test_rng_streams, "test_rng_streams"},
+    {test_rand_fill_threads, "test_rand_fill_threads"},
+};
+
+
+/*********************************
+ * Unit tests for kernel module.
+ *********************************/
+
+// The OpenCL tests pass without a device.
+bool test_opencl_runtime() {
+    if(!opencl_init()) {
+        return true;
+    }
+    bool test = opencl_runtime() != NULL && opencl_init();
+    // The runtime is set up again after a shutdown, with an empty pool.
+    opencl_shutdown();
+    test = test && opencl_init() && opencl_runtime()->n_pooled == 0;
+    // A released buffer is handed out again.
+    opencl_lock();
+    cl_mem a = opencl_buffer_acquire(1000);
+    opencl_buffer_release(a);
+    cl_mem b = opencl_buffer_acquire(800);
+    test = test && a == b;
+    opencl_buffer_release(b);
+    opencl_unlock();
+    return test;
+}
+
+bool test_opencl_gemm_f64() {
+    // Shapes off the 32 x 32 tiles, and on them.
+    int shapes[][3] = {{67, 45, 93}, {64, 64, 64}, {1, 130, 3}};
+    bool test = true;
+    for(int s = 0; s < 3; s++) {
+        struct matrix* A = matrix_random_uniform(shapes[s][0], shapes[s][1], -1, 1);
+        struct matrix* B = matrix_random_uniform(shapes[s][1], shapes[s][2], -1, 1);
+        struct matrix* P = matrix_new(shapes[s][0], shapes[s][2]);
+        struct matrix* Q = matrix_new(shapes[s][0], shapes[s][2]);
+        // The host product (matrix_multiply may itself run on the device).
+        matrix_multiply_into(P, A, B);
+        if(opencl_gemm_f64(shapes[s][0], shapes[s][2], shapes[s][1], DATA(A), DATA(B), DATA(Q))) {
+            test = test && matrix_equal(P, Q, 1e-12);
+        }
+        matrix_free_many(4, A, B, P, Q);
+    }
+    return test;
+}
+
+bool test_opencl_gemm_f32() {
+    int M = 75, K = 50, N = 33;
+    struct matrix* A = matrix_random_uniform(M, K, -1, 1);
+    struct matrix* B = matrix_random_uniform(K, N, -1, 1);
+    struct matrix* P = matrix_multiply(A, B);
+    float* a = malloc(sizeof(float) * M * K);
+    float* b = malloc(sizeof(float) * K * N);
+    float* c = malloc(sizeof(float) * M * N);
+    for(int i = 0; i < M * K; i++) {
+        a[i] = DATA(A)[i];
+    }
+    for(int i = 0; i < K * N; i++) {
+        b[i] = DATA(B)[i];
+    }
+    bool test = true;
+    if(opencl_gemm_f32(M, N, K, a, b, c)) {
+        for(int i = 0; i < M * N; i++) {
+            test = test && fabs(c[i] - DATA(P)[i]) < 1e-4;
+        }
+    }
+    free(a); free(b); free(c);
+    matrix_free_many(3, A, B, P);
+    return test;
+}
+
+bool test_matrix_device_chain() {
+    struct matrix* A = matrix_random_uniform(40, 30, -1, 1);
+    struct matrix* B = matrix_random_uniform(30, 50, -1, 1);
+    struct matrix* C = matrix_random_uniform(50, 20, -1, 1);
+    struct matrix* AB = matrix_new(40, 50);
+    struct matrix* ABC = matrix_new(40, 20);
+    matrix_to_device(A);
+    matrix_multiply_device_into(AB, A, B);
+    // The intermediate product is not copied back.
+    bool test = AB->device == NULL || !AB->device->host_valid;
+    matrix_multiply_device_into(ABC, AB, C);
+    matrix_to_host(ABC);
+    struct matrix* P = matrix_new(40, 50);
+    struct matrix* Q = matrix_new(40, 20);
+    matrix_multiply_into(P, A, B);
+    matrix_multiply_into(Q, P, C);
+    test = test && matrix_equal(ABC, Q, 1e-12);
+    // A change on the host is uploaded again.
+    MATRIX_IDX_INTO(A, 0, 0) += 1;
+    matrix_host_changed(A);
+    matrix_multiply_device_into(AB, A, B);
+    matrix_to_host(AB);
+    matrix_multiply_into(P, A, B);
+    test = test && matrix_equal(AB, P, 1e-12);
+    matrix_free_many(7, A, B, C, AB, ABC, P, Q);
+    return test;
+}
+
+bool test_matrix_device_async() {
+    struct matrix* A = matrix_random_uniform(40, 30, -1, 1);
+    struct matrix* B = matrix_random_uniform(30, 50, -1, 1);
+    struct matrix* C = matrix_random_uniform(50, 20, -1, 1);
+    struct matrix* AB = matrix_new(40, 50);
+    struct matrix* ABC = matrix_new(40, 20);
+    // The second product is enqueued before the first is done.
+    struct opencl_future* f1 = matrix_multiply_device_async(AB, A, B);
+    struct opencl_future* f2 = matrix_multiply_device_async(ABC, AB, C);
+    struct opencl_future* f3 = matrix_to_host_async(ABC);
+    opencl_future_wait(f3);
+    bool test = opencl_future_done(f3);
+    struct matrix* P = matrix_new(40, 50);
+    struct matrix* Q = matrix_new(40, 20);
+    matrix_multiply_into(P, A, B);
+    matrix_multiply_into(Q, P, C);
+    test = test && matrix_equal(ABC, Q, 1e-12);
+    opencl_future_free(f1); opencl_future_free(f2); opencl_future_free(f3);
+    matrix_free_many(7, A, B, C, AB, ABC, P, Q);
+    return test;
+}
+
+bool test_matrix_multiply_streamed() {
+    struct matrix* A = matrix_random_uniform(100, 37, -1, 1);
+    struct matrix* B = matrix_random_uniform(37, 45, -1, 1);
+    struct matrix* P = matrix_new(100, 45);
+    struct matrix* Q = matrix_new(100, 45);
+    matrix_multiply_into(P, A, B);
+    bool test = true;
+    // Panels of one row, in odd sizes with a partial last one, and the default.
+    int panel_rows[] = {1, 17, 64, 0};
+    for(int i = 0; i < 4; i++) {
+        matrix_multiply_streamed_into(Q, A, B, panel_rows[i]);
+        test = test && matrix_equal(P, Q, 1e-12);
+    }
+    matrix_free_many(4, A, B, P, Q);
+    return test;
+}
+
+#define N_KERNEL_TESTS 6
+struct test kernel_tests[] = {
+    {test_opencl_runtime, "test_opencl_runtime"},
+    {test_opencl_gemm_f64, "test_opencl_gemm_f64"},
+    {test_opencl_gemm_f32, "test_opencl_gemm_f32"},
+    {test_matrix_device_chain, "test_matrix_device_chain"},
+    {test_matrix_device_async, "test_matrix_device_async"},
+    {test_matrix_multiply_streamed, "test_matrix_multiply_streamed"},
 };
 
 
@@ -831,6 +2343,10 @@ void run_tests(struct test tests[], int n_tests) {
 void run_all() {
     run_tests(vector_tests, N_VECTOR_TESTS);
     run_tests(matrix_tests, N_MATRIX_TESTS);
+    run_tests(qr_update_tests, N_QR_UPDATE_TESTS);
+    run_tests(svd_tests, N_SVD_TESTS);
     run_tests(linsolve_tests, N_LINSOLVE_TESTS);
     run_tests(linreg_tests, N_LINREG_TESTS);
+    run_tests(rand_tests, N_RAND_TESTS);
+    run_tests(kernel_tests, N_KERNEL_TESTS);
 }